@@ -1,4 +1,5 @@
 #include "dlheap.h"
 #include "kingsleyheap.h"
 #include "leamallocheap.h"
+#include "quarterheap.h"
 
@@ -0,0 +1,113 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2012 by Emery Berger
+  http://www.cs.umass.edu/~emery
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_QUARTERHEAP_H
+#define HL_QUARTERHEAP_H
+
+#include "utility/ilog2.h"
+#include "heaps/combining/strictsegheap.h"
+
+/**
+ * @file quarterheap.h
+ * @brief Classes to implement a segregated fits allocator with four size classes
+ * per power of two.
+ *
+ * Kingsley rounds every request up to a power of two, so a request just past one
+ * wastes almost half of its block. Here the classes are 8, 16, 24 and 32 bytes,
+ * followed by four evenly spaced classes between each power of two and the next
+ * (40, 48, 56, 64, 80, 96, ...), which bounds the waste above 32 bytes by a fifth of
+ * the block.
+ * Every class is a multiple of 8, like the Kingsley ones.
+ */
+
+/**
+ * @namespace Quarter
+ * @brief Functions to implement QuarterHeap.
+ */
+
+namespace Quarter {
+
+  enum { MAX_TABLE_SIZE = 1024 };
+
+  inline size_t class2Size (const int i) {
+    if (i < 4) {
+      return (size_t) ((i + 1) << 3);
+    }
+    const int e = 5 + ((i - 4) >> 2);
+    return (size_t) ((1UL << e) + ((size_t) (((i - 4) & 3) + 1) << (e - 2)));
+  }
+
+  inline int size2Class (const size_t sz) {
+    // Small sizes are looked up by their 8-byte granule.
+    static const unsigned char classes[(MAX_TABLE_SIZE >> 3) + 1] = {
+      0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11,
+      11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15,
+      15, 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17,
+      17, 18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19,
+      19, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+      20, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,
+      21, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+      22, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+      23
+    };
+
+    if (sz <= MAX_TABLE_SIZE) {
+      return classes[(sz + 7) >> 3];
+    }
+
+    // 2^e < sz <= 2^(e+1); find the quarter of that range sz falls in.
+    const int e = HL::ilog2 (sz) - 1;
+    const size_t step = (size_t) 1 << (e - 2);
+    const int quarter = (int) ((sz - ((size_t) 1 << e) + step - 1) >> (e - 2));
+    return ((e - 4) << 2) + quarter - 1;
+  }
+
+  // Up to 2^31 bytes, as with Kingsley.
+  enum { NUMBINS = 108 };
+
+}
+
+/**
+ * @class QuarterHeap
+ * @brief A segregated fits allocator with quarter power-of-two size classes.
+ * @param PerClassHeap The heap to use for each size class.
+ * @param BigHeap The heap for "large" objects.
+ * @see Quarter
+ */
+
+namespace HL {
+
+template <class PerClassHeap, class BigHeap>
+  class QuarterHeap :
+   public StrictSegHeap<Quarter::NUMBINS,
+                        Quarter::size2Class,
+                        Quarter::class2Size,
+                        PerClassHeap,
+                        BigHeap> {};
+
+}
+
+#endif
@@ -42,6 +42,12 @@ extern "C" {
   void   xxfree (void *);
   void * xxrealloc (void *, size_t);
 
+  // Returns a zeroed block, clearing it only if needed.
+  void * xxcalloc (size_t, size_t);
+
+  // Returns a block aligned to the given power of two.
+  void * xxmemalign (size_t, size_t);
+
   // Takes a pointer and returns how much space it holds.
   size_t xxmalloc_usable_size (void *);
 
@@ -148,12 +154,7 @@ extern "C" void * MYCDECL CUSTOM_CALLOC(size_t nelem, size_t elsize)
   if (elsize && nelem != n / elsize) {
     return NULL;
   }
-  void * ptr = CUSTOM_MALLOC(n);
-  // Zero out the malloc'd block.
-  if (ptr != NULL) {
-    memset (ptr, 0, n);
-  }
-  return ptr;
+  return xxcalloc (nelem, elsize);
 }
 
 
@@ -198,22 +199,8 @@ extern "C" void * MYCDECL CUSTOM_MEMALIGN (size_t alignment, size_t size)
       return NULL;
     }
 
-  if (alignment == sizeof(double)) {
-    return CUSTOM_MALLOC (size);
-  } else {
-    // Try to just allocate an object of the requested size.
-    // If it happens to be aligned properly, just return it.
-    void * ptr = CUSTOM_MALLOC(size);
-    if (((size_t) ptr & (alignment - 1)) == (size_t) ptr) {
-      // It is already aligned just fine; return it.
-      return ptr;
-    }
-    // It was not aligned as requested: free the object and allocate a big one.
-    CUSTOM_FREE(ptr);
-    ptr = CUSTOM_MALLOC (size + 2 * alignment);
-    void * alignedPtr = (void *) (((size_t) ptr + alignment - 1) & ~(alignment - 1));
-    return alignedPtr;
-  }
+  // The heap knows how to align its objects, and how to free them afterwards.
+  return xxmemalign (alignment, size);
 }
 
 extern "C" void * MYCDECL CUSTOM_ALIGNED_ALLOC(size_t alignment, size_t size)
@@ -225,7 +212,9 @@ extern "C" void * MYCDECL CUSTOM_ALIGNED_ALLOC(size_t alignment, size_t size)
   // memalign(), except for the added restriction that size should be
   // a multiple of alignment." Rather than check and potentially fail,
   // we just enforce this by rounding up the size, if necessary.
-  size = size + alignment - (size % alignment);
+  if (size % alignment) {
+    size = size + alignment - (size % alignment);
+  }
   return CUSTOM_MEMALIGN(alignment, size);
 }
 
@@ -468,7 +457,7 @@ void operator delete[] (void * ptr)
 
 extern "C" void * MYCDECL CUSTOM_VALLOC (size_t sz)
 {
-  return CUSTOM_MEMALIGN (8192, sz);
+  return CUSTOM_MEMALIGN (4096, sz);
 }
 
 
@@ -476,7 +465,7 @@ extern "C" void * MYCDECL CUSTOM_PVALLOC (size_t sz)
 {
   // Rounds up to the next pagesize and then calls valloc. Hoard
   // doesn't support aligned memory requests.
-  return CUSTOM_VALLOC ((sz + 8191) & ~8191);
+  return CUSTOM_VALLOC ((sz + 4095) & ~4095);
 }
 
 // The wacky recalloc function, for Windows.
@@ -183,7 +183,7 @@ public:
       // firstBitIndex, lastBitIndex, lastWordIndex);
       // Full words.
       void* start = getWord(firstWordIndex);
-      int size = (lastWordIndex - firstWordIndex) * WORDSIZE;
+      size_t size = (lastWordIndex - firstWordIndex) * sizeof(unsigned long);
       memset(start, 0, size);
     } else {
       assert(0);
@@ -0,0 +1,266 @@
+#if !defined(DOUBLETAKE_CHECKPOINTIMAGE_H)
+#define DOUBLETAKE_CHECKPOINTIMAGE_H
+
+/*
+ * @file   checkpointimage.h
+ * @brief  Writes the checkpoint of the epoch being rolled back to a file, and loads it back.
+ *         With DOUBLETAKE_IMAGE=save:<file>, a rollback first writes the restored state to
+ *         <file>: globals, the used heap, the data of libdoubletake and its internal heap,
+ *         and the stacks, logs and quarantine lists of the threads (see imageformat.h).
+ *         The same program started with DOUBLETAKE_IMAGE=load:<file> restores that state
+ *         before main and replays the epoch with the watchpoints of the image, so that
+ *         the diagnosis can run on another machine. The addresses of the loading process
+ *         must be the same, which tools/dtimage arranges by disabling address space
+ *         randomization; both runs need it. Only images of a single thread can be
+ *         replayed, and files opened before the epoch are not part of the image.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "imageformat.hh"
+#include "log.hh"
+#include "real.hh"
+#include "xdefines.hh"
+
+class checkpointimage {
+  enum eMode { IMAGE_OFF, IMAGE_SAVE, IMAGE_LOAD };
+
+public:
+  checkpointimage() : _mode(IMAGE_OFF), _fd(-1), _failed(false), _offset(0) {
+    memset(&_header, 0, sizeof(_header));
+    _path[0] = '\0';
+  }
+
+  static checkpointimage& getInstance() {
+    static char buf[sizeof(checkpointimage)];
+    static checkpointimage* theOneTrueObject = new (buf) checkpointimage();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+    const char* env = getenv("DOUBLETAKE_IMAGE");
+    if(env == NULL) {
+      return;
+    }
+
+    if(strncmp(env, "save:", 5) == 0) {
+      _mode = IMAGE_SAVE;
+    } else if(strncmp(env, "load:", 5) == 0) {
+      _mode = IMAGE_LOAD;
+    } else {
+      PRWRN("DOUBLETAKE_IMAGE should be save:<file> or load:<file>, not %s", env);
+      return;
+    }
+    strncpy(_path, env + 5, sizeof(_path) - 1);
+  }
+
+  inline bool isSaving() const { return _mode == IMAGE_SAVE; }
+  inline bool isLoading() const { return _mode == IMAGE_LOAD; }
+  inline const char* getPath() const { return _path; }
+
+  /// Start writing an image of a process with the given layout.
+  bool create(const uint64_t* layout, uint32_t threads) {
+    _fd = Real::open(_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(_fd < 0) {
+      PRWRN("Failed to create checkpoint image %s: %s", _path, strerror(errno));
+      return false;
+    }
+
+    memset(&_header, 0, sizeof(_header));
+    memcpy(_header.magic, IMAGE_MAGIC, sizeof(_header.magic));
+    _header.version = IMAGE_VERSION;
+    _header.threads = threads;
+    memcpy(_header.layout, layout, sizeof(_header.layout));
+
+    _offset = sizeof(_header);
+    _failed = false;
+    return true;
+  }
+
+  /// Add [start, start + size) to the image. With sparse, pages of zeros are left out.
+  void add(uint32_t kind, uint32_t thread, const void* start, size_t size, bool sparse) {
+    if(!sparse) {
+      addSection(kind, thread, start, size);
+      return;
+    }
+
+    const char* pos = (const char*)start;
+    const char* end = pos + size;
+    const char* run = NULL;
+
+    while(pos < end) {
+      size_t len = xdefines::PageSize - ((uintptr_t)pos & xdefines::PAGE_SIZE_MASK);
+      if(len > (size_t)(end - pos)) {
+        len = end - pos;
+      }
+
+      bool zero = isZero(pos, len);
+      if(!zero && run == NULL) {
+        run = pos;
+      } else if(zero && run != NULL) {
+        addSection(kind, thread, run, pos - run);
+        run = NULL;
+      }
+      pos += len;
+    }
+
+    if(run != NULL) {
+      addSection(kind, thread, run, end - run);
+    }
+  }
+
+  /// Write the header and close the image.
+  /// @return false if some of the image could not be written.
+  bool finish() {
+    if(!_failed && !writeAll(&_header, sizeof(_header), 0)) {
+      _failed = true;
+    }
+    Real::close(_fd);
+    _fd = -1;
+    return !_failed;
+  }
+
+  /// Restore the image into this process, whose layout must be the one of the image.
+  /// The data of libdoubletake, this object included, is overwritten on the way, so
+  /// nothing but locals is used once the first section is read.
+  bool load(const uint64_t* layout) {
+    char path[PATH_MAX];
+    struct imageHeader header;
+
+    strncpy(path, _path, sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+
+    int fd = Real::open(path, O_RDONLY);
+    if(fd < 0) {
+      PRWRN("Failed to open checkpoint image %s: %s", path, strerror(errno));
+      return false;
+    }
+
+    if(!readAll(fd, &header, sizeof(header), 0) ||
+       memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0 ||
+       header.version != IMAGE_VERSION) {
+      PRWRN("%s is not a checkpoint image", path);
+      Real::close(fd);
+      return false;
+    }
+
+    if(header.threads != 1 || memcmp(header.layout, layout, sizeof(header.layout)) != 0) {
+      PRWRN("Checkpoint image %s can not be replayed here: %u threads, layout %s", path,
+            header.threads,
+            memcmp(header.layout, layout, sizeof(header.layout)) ? "differs" : "matches");
+      Real::close(fd);
+      return false;
+    }
+
+    off_t offset = sizeof(header);
+    for(uint64_t i = 0; i < header.sections; i++) {
+      struct imageSection section;
+
+      if(!readAll(fd, &section, sizeof(section), offset)) {
+        Real::close(fd);
+        return false;
+      }
+      offset += sizeof(section);
+
+      // Stack backups are kept inaccessible between epochs.
+      uintptr_t first = section.address & ~(uintptr_t)xdefines::PAGE_SIZE_MASK;
+      uintptr_t last = alignup(section.address + section.size, xdefines::PageSize);
+      Real::mprotect((void*)first, last - first, PROT_READ | PROT_WRITE);
+
+      if(!readAll(fd, (void*)section.address, section.size, offset)) {
+        Real::close(fd);
+        return false;
+      }
+      offset += section.size;
+    }
+
+    Real::close(fd);
+    return true;
+  }
+
+private:
+  static bool isZero(const char* data, size_t size) {
+    size_t i = 0;
+
+    for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, data + i, sizeof(word));
+      if(word != 0) {
+        return false;
+      }
+    }
+    for(; i < size; i++) {
+      if(data[i] != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void addSection(uint32_t kind, uint32_t thread, const void* start, size_t size) {
+    struct imageSection section = { kind, thread, (uint64_t)(uintptr_t)start, size };
+
+    if(_failed || !writeAll(&section, sizeof(section), _offset) ||
+       !writeAll(start, size, _offset + sizeof(section))) {
+      _failed = true;
+      return;
+    }
+    _offset += sizeof(section) + size;
+    _header.sections++;
+  }
+
+  bool writeAll(const void* data, size_t size, off_t offset) {
+    const char* pos = (const char*)data;
+
+    while(size > 0) {
+      ssize_t bytes = Real::pwrite(_fd, pos, size, offset);
+      if(bytes < 0 && errno == EINTR) {
+        continue;
+      } else if(bytes <= 0) {
+        PRWRN("Failed to write checkpoint image %s: %s", _path, strerror(errno));
+        return false;
+      }
+      pos += bytes;
+      size -= bytes;
+      offset += bytes;
+    }
+    return true;
+  }
+
+  static bool readAll(int fd, void* data, size_t size, off_t offset) {
+    char* pos = (char*)data;
+
+    while(size > 0) {
+      ssize_t bytes = Real::pread(fd, pos, size, offset);
+      if(bytes < 0 && errno == EINTR) {
+        continue;
+      } else if(bytes <= 0) {
+        return false;
+      }
+      pos += bytes;
+      size -= bytes;
+      offset += bytes;
+    }
+    return true;
+  }
+
+  eMode _mode;
+  char _path[PATH_MAX];
+
+  /// The image being written.
+  int _fd;
+  bool _failed;
+  off_t _offset;
+  struct imageHeader _header;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#if !defined(DOUBLETAKE_COPYKERNELS_H)
+#define DOUBLETAKE_COPYKERNELS_H
+
+/*
+ * @file   copykernels.h
+ * @brief  Copy kernels for the two directions of a checkpoint.
+ *         A backup is not read again until a rollback, which is rare, so it is written
+ *         with streaming (non-temporal) stores that bypass the caches instead of evicting
+ *         the application's working set at every epoch. The widest kernel the CPU supports
+ *         (AVX-512, AVX2 or SSE2) is picked once by CPUID at initialization.
+ *         Restored memory is used by the application right away, so recovery keeps the
+ *         cache-friendly libc memcpy.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+class copykernels {
+public:
+  typedef void* (*copyFunc)(void* dest, const void* src, size_t size);
+
+  copykernels() : _backupCopy(memcpy) {}
+
+  static copykernels& getInstance() {
+    static char buf[sizeof(copykernels)];
+    static copykernels* theOneTrueObject = new (buf) copykernels();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) {
+      _backupCopy = streamCopyAVX512;
+    } else if(__builtin_cpu_supports("avx2")) {
+      _backupCopy = streamCopyAVX2;
+    } else {
+      _backupCopy = streamCopySSE2;
+    }
+#endif
+  }
+
+  /// The kernel used to copy live memory into a backup area.
+  inline copyFunc backupKernel() const { return _backupCopy; }
+
+  /// The kernel used to copy a backup area back into live memory.
+  inline copyFunc restoreKernel() const { return memcpy; }
+
+  static inline void backup(void* dest, const void* src, size_t size) {
+    getInstance()._backupCopy(dest, src, size);
+  }
+
+  static inline void restore(void* dest, const void* src, size_t size) {
+    memcpy(dest, src, size);
+  }
+
+#if defined(__x86_64__)
+  // Each kernel aligns the destination to a cache line with memcpy, streams
+  // whole cache lines, and copies the tail with memcpy again.
+  static void* streamCopySSE2(void* dest, const void* src, size_t size) {
+    char* d = (char*)dest;
+    const char* s = (const char*)src;
+    size_t head = alignHead(d, size);
+
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for(; size >= 64; size -= 64, d += 64, s += 64) {
+      __m128i a = _mm_loadu_si128((const __m128i*)s);
+      __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+      __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+      __m128i e = _mm_loadu_si128((const __m128i*)(s + 48));
+      _mm_stream_si128((__m128i*)d, a);
+      _mm_stream_si128((__m128i*)(d + 16), b);
+      _mm_stream_si128((__m128i*)(d + 32), c);
+      _mm_stream_si128((__m128i*)(d + 48), e);
+    }
+
+    _mm_sfence();
+    memcpy(d, s, size);
+    return dest;
+  }
+
+  __attribute__((target("avx2"))) static void* streamCopyAVX2(void* dest, const void* src,
+                                                               size_t size) {
+    char* d = (char*)dest;
+    const char* s = (const char*)src;
+    size_t head = alignHead(d, size);
+
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for(; size >= 128; size -= 128, d += 128, s += 128) {
+      __m256i a = _mm256_loadu_si256((const __m256i*)s);
+      __m256i b = _mm256_loadu_si256((const __m256i*)(s + 32));
+      __m256i c = _mm256_loadu_si256((const __m256i*)(s + 64));
+      __m256i e = _mm256_loadu_si256((const __m256i*)(s + 96));
+      _mm256_stream_si256((__m256i*)d, a);
+      _mm256_stream_si256((__m256i*)(d + 32), b);
+      _mm256_stream_si256((__m256i*)(d + 64), c);
+      _mm256_stream_si256((__m256i*)(d + 96), e);
+    }
+
+    _mm_sfence();
+    memcpy(d, s, size);
+    return dest;
+  }
+
+  __attribute__((target("avx512f"))) static void* streamCopyAVX512(void* dest, const void* src,
+                                                                    size_t size) {
+    char* d = (char*)dest;
+    const char* s = (const char*)src;
+    size_t head = alignHead(d, size);
+
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for(; size >= 128; size -= 128, d += 128, s += 128) {
+      __m512i a = _mm512_loadu_si512((const void*)s);
+      __m512i b = _mm512_loadu_si512((const void*)(s + 64));
+      _mm512_stream_si512((__m512i*)d, a);
+      _mm512_stream_si512((__m512i*)(d + 64), b);
+    }
+
+    _mm_sfence();
+    memcpy(d, s, size);
+    return dest;
+  }
+#endif
+
+private:
+  // Bytes to copy before dest is cache-line aligned.
+  static inline size_t alignHead(char* dest, size_t size) {
+    size_t head = (64 - ((uintptr_t)dest & 63)) & 63;
+    return head < size ? head : size;
+  }
+
+  copyFunc _backupCopy;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#if !defined(DOUBLETAKE_COPYWORKERS_H)
+#define DOUBLETAKE_COPYWORKERS_H
+
+/*
+ * @file   copyworkers.h
+ * @brief  A small pool of internal helper threads splitting large checkpoint copies.
+ *         Backing up or recovering the heap happens while every application thread
+ *         is stopped, so one thread copying gigabytes is the whole stop-the-world pause.
+ *         A large copy is split into page-aligned chunks: the calling thread copies the
+ *         first one and each helper copies its own. Helpers are pinned round-robin to the
+ *         CPUs we may run on and always take the same chunk of a region, so that on NUMA
+ *         machines every chunk of the backup memory is touched from the same node.
+ *         The helpers are created with the real pthread_create, so DoubleTake never sees
+ *         them as application threads; they block every signal and sleep on a condition
+ *         variable between copies. A forked child has none of them and copies alone.
+ *         Every chunk is copied with the kernel given by the caller, see copykernels.h.
+ *         DOUBLETAKE_COPY_THREADS sets the number of helpers (0 disables the pool).
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include "copykernels.hh"
+#include "log.hh"
+#include "real.hh"
+#include "xdefines.hh"
+
+class copyworkers {
+public:
+  copyworkers()
+    : _workers(0), _generation(0), _pending(0), _dest(NULL), _src(NULL), _size(0),
+      _chunkSize(0), _kernel(memcpy) {}
+
+  static copyworkers& getInstance() {
+    static char buf[sizeof(copyworkers)];
+    static copyworkers* theOneTrueObject = new (buf) copyworkers();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+    cpu_set_t cpus;
+    int workers;
+
+    CPU_ZERO(&cpus);
+    if(sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+      CPU_SET(0, &cpus);
+    }
+
+    // The calling thread copies a chunk too.
+    const char* env = getenv("DOUBLETAKE_COPY_THREADS");
+    workers = env ? atoi(env) : CPU_COUNT(&cpus) - 1;
+    if(workers > xdefines::MAX_COPY_WORKERS) {
+      workers = xdefines::MAX_COPY_WORKERS;
+    }
+    if(workers <= 0) {
+      return;
+    }
+
+    Real::pthread_mutex_init(&_lock, NULL);
+    Real::pthread_cond_init(&_startCond, NULL);
+    Real::pthread_cond_init(&_doneCond, NULL);
+
+    // Helpers must never run the application's signal handlers.
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    int cpu = 0;
+    for(int i = 0; i < workers; i++) {
+      _worker[i].pool = this;
+      _worker[i].index = i + 1;
+      _worker[i].cpu = cpu = nextCpu(&cpus, cpu);
+
+      if(Real::pthread_create(&_worker[i].thread, NULL, workerEntry, &_worker[i]) != 0) {
+        PRWRN("Failed to create checkpoint copy thread %d", i);
+        break;
+      }
+      _workers++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    PRINF("%d checkpoint copy threads", _workers);
+
+    // fork() is not interposed, so a child of the application learns it here.
+    pthread_atfork(NULL, NULL, forgetInChild);
+  }
+
+  /// A forked child has none of the helpers, so it copies alone.
+  void resetAfterFork() { _workers = 0; }
+
+  /// Copy into a backup area.
+  inline void backup(void* dest, const void* src, size_t size) {
+    copy(dest, src, size, copykernels::getInstance().backupKernel());
+  }
+
+  /// Copy a backup area back into live memory.
+  inline void restore(void* dest, const void* src, size_t size) {
+    copy(dest, src, size, copykernels::getInstance().restoreKernel());
+  }
+
+  /// Copy with kernel, split among the helpers when the copy is large enough.
+  void copy(void* dest, const void* src, size_t size, copykernels::copyFunc kernel) {
+    if(_workers == 0 || size < xdefines::PARALLEL_COPY_THRESHOLD) {
+      kernel(dest, src, size);
+      return;
+    }
+
+    Real::pthread_mutex_lock(&_lock);
+    _dest = (char*)dest;
+    _src = (const char*)src;
+    _size = size;
+    _kernel = kernel;
+    _chunkSize = alignup(size / (_workers + 1), xdefines::PageSize);
+    _pending = _workers;
+    _generation++;
+    Real::pthread_cond_broadcast(&_startCond);
+    Real::pthread_mutex_unlock(&_lock);
+
+    copyChunk(0);
+
+    Real::pthread_mutex_lock(&_lock);
+    while(_pending > 0) {
+      Real::pthread_cond_wait(&_doneCond, &_lock);
+    }
+    Real::pthread_mutex_unlock(&_lock);
+  }
+
+private:
+  static void forgetInChild() { getInstance().resetAfterFork(); }
+
+  struct worker {
+    copyworkers* pool;
+    pthread_t thread;
+    int index;
+    int cpu;
+  };
+
+  // Next allowed CPU after cpu, wrapping around.
+  static int nextCpu(cpu_set_t* cpus, int cpu) {
+    for(int i = 1; i <= CPU_SETSIZE; i++) {
+      int next = (cpu + i) % CPU_SETSIZE;
+      if(CPU_ISSET(next, cpus)) {
+        return next;
+      }
+    }
+    return cpu;
+  }
+
+  static void* workerEntry(void* arg) {
+    worker* self = (worker*)arg;
+    cpu_set_t cpu;
+
+    CPU_ZERO(&cpu);
+    CPU_SET(self->cpu, &cpu);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu);
+
+    self->pool->run(self->index);
+    return NULL;
+  }
+
+  void run(int index) {
+    unsigned long seen = 0;
+
+    while(true) {
+      Real::pthread_mutex_lock(&_lock);
+      while(_generation == seen) {
+        Real::pthread_cond_wait(&_startCond, &_lock);
+      }
+      seen = _generation;
+      Real::pthread_mutex_unlock(&_lock);
+
+      copyChunk(index);
+
+      Real::pthread_mutex_lock(&_lock);
+      if(--_pending == 0) {
+        Real::pthread_cond_signal(&_doneCond);
+      }
+      Real::pthread_mutex_unlock(&_lock);
+    }
+  }
+
+  void copyChunk(int index) {
+    size_t offset = index * _chunkSize;
+    if(offset >= _size) {
+      return;
+    }
+
+    size_t size = _size - offset;
+    if(size > _chunkSize) {
+      size = _chunkSize;
+    }
+    _kernel(_dest + offset, _src + offset, size);
+  }
+
+  int _workers;
+  worker _worker[xdefines::MAX_COPY_WORKERS];
+
+  pthread_mutex_t _lock;
+  pthread_cond_t _startCond;
+  pthread_cond_t _doneCond;
+
+  // The copy being done: bumping _generation starts it, _pending counts the busy helpers.
+  unsigned long _generation;
+  int _pending;
+  char* _dest;
+  const char* _src;
+  size_t _size;
+  size_t _chunkSize;
+  copykernels::copyFunc _kernel;
+};
+
+#endif
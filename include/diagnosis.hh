@@ -0,0 +1,118 @@
+#if !defined(DOUBLETAKE_DIAGNOSIS_H)
+#define DOUBLETAKE_DIAGNOSIS_H
+
+/*
+ * @file   diagnosis.h
+ * @brief  Diagnoses a detected error in a forked child instead of the whole process.
+ *         A rollback used to freeze the program for the replay with watchpoints, and a
+ *         second error aborted it. With DOUBLETAKE_DIAGNOSE=fork, the process forks where
+ *         the error is detected: the child rolls back, replays the epoch and reports the
+ *         culprit, with the files it uses made private so that the parent does not see
+ *         the undo and the replay. The parent logs the error and goes on
+ *         (DOUBLETAKE_ON_ERROR=continue, the default), or waits for the report and aborts
+ *         (DOUBLETAKE_ON_ERROR=abort). Only one child diagnoses at a time; errors found
+ *         meanwhile are only logged.
+ *         The replay needs every thread of the epoch, so a process with other threads
+ *         still rolls back in place.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "copyworkers.hh"
+#include "log.hh"
+
+class diagnosis {
+public:
+  enum ePolicy { CONTINUE, ABORT };
+
+  diagnosis() : _enabled(false), _isChild(false), _policy(CONTINUE), _pid(-1) {}
+
+  static diagnosis& getInstance() {
+    static char buf[sizeof(diagnosis)];
+    static diagnosis* theOneTrueObject = new (buf) diagnosis();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+    const char* mode = getenv("DOUBLETAKE_DIAGNOSE");
+    _enabled = (mode != NULL && strcmp(mode, "fork") == 0);
+
+    const char* policy = getenv("DOUBLETAKE_ON_ERROR");
+    _policy = (policy != NULL && strcmp(policy, "abort") == 0) ? ABORT : CONTINUE;
+  }
+
+  inline bool isEnabled() const { return _enabled; }
+
+  /// @return true in the child diagnosing an error.
+  inline bool isChild() const { return _isChild; }
+
+  /// Fork a child to diagnose the error just detected.
+  /// @return true in the parent, which does not roll back, false in the child or if
+  /// the fork failed.
+  bool fork() {
+    if(isDiagnosing()) {
+      PRWRN("DoubleTake: Error detected while child %d is diagnosing another one, going on.",
+            _pid);
+      return true;
+    }
+
+    // Like the snapshot process, a clone without an exit signal is invisible to the application.
+    pid_t pid = (pid_t)syscall(SYS_clone, 0UL, NULL, NULL, NULL, NULL);
+    if(pid == 0) {
+      _isChild = true;
+      _pid = -1;
+      // The copy helpers stay with the parent; waiting for them would never end.
+      copyworkers::getInstance().resetAfterFork();
+      return false;
+    }
+
+    if(pid < 0) {
+      PRWRN("DoubleTake: Failed to fork a diagnosis child (%s), rolling back in place.",
+            strerror(errno));
+      return false;
+    }
+
+    PRINT("DoubleTake: Error detected, diagnosing it in child %d.\n", pid);
+    _pid = pid;
+
+    if(_policy == ABORT) {
+      waitForChild();
+      abort();
+    }
+    return true;
+  }
+
+  /// Wait until the diagnosis child, if any, has reported.
+  void waitForChild() {
+    if(_pid > 0) {
+      while(waitpid(_pid, NULL, __WALL) < 0 && errno == EINTR)
+        ;
+      _pid = -1;
+    }
+  }
+
+private:
+  bool isDiagnosing() {
+    if(_pid > 0 && waitpid(_pid, NULL, __WALL | WNOHANG) != 0) {
+      _pid = -1;
+    }
+    return _pid > 0;
+  }
+
+  bool _enabled;
+  bool _isChild;
+  ePolicy _policy;
+
+  /// The child diagnosing an error, -1 if none.
+  pid_t _pid;
+};
+
+#endif
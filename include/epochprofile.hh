@@ -0,0 +1,222 @@
+#if !defined(DOUBLETAKE_EPOCHPROFILE_H)
+#define DOUBLETAKE_EPOCHPROFILE_H
+
+/*
+ * @file   epochprofile.h
+ * @brief  Which code ends epochs, and what it costs.
+ *         Every epoch end is charged to what asked for it (the system call, sync
+ *         operation or scheduler decision, see epochstats.h) and to the call site of
+ *         the thread ending it, that is its frames outside of libdoubletake. The cost
+ *         of an epoch end runs from the call until the next epoch has begun: stopping
+ *         the threads, the checks, the commit and the next checkpoint.
+ *         With DOUBLETAKE_EPOCH_PROFILE set, the call sites that cost most are reported
+ *         at exit, EPOCH_PROFILE_TOP of them or as many as its value.
+ */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <new>
+
+#include "callsite.hh"
+#include "hashfuncs.hh"
+#include "real.hh"
+#include "selfmap.hh"
+#include "xdefines.hh"
+
+class epochprofile {
+public:
+  epochprofile() : _enabled(false), _top(0), _dropped(0), _pending(-1), _endStart(0) {}
+
+  static epochprofile& getInstance() {
+    static char buf[sizeof(epochprofile)];
+    static epochprofile* theOneTrueObject = new (buf) epochprofile();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+    const char* env = getenv("DOUBLETAKE_EPOCH_PROFILE");
+    if(env == NULL) {
+      return;
+    }
+
+    _enabled = true;
+    _top = strtoul(env, NULL, 10);
+    if(_top == 0) {
+      _top = xdefines::EPOCH_PROFILE_TOP;
+    }
+    std::fill(_sites, _sites + xdefines::EPOCH_PROFILE_SITES, siteEntry());
+  }
+
+  void finalize() {
+    if(!_enabled) {
+      return;
+    }
+
+    // The last epoch ends with the program.
+    epochBegin();
+    report();
+    _enabled = false;
+  }
+
+  /// @return the time an epoch end starts, before the threads are stopped.
+  inline unsigned long start() { return _enabled ? getTime() : 0; }
+
+  /// Charge the epoch end that started at start to trigger and the call site of the
+  /// current thread. Other threads are stopped.
+  void epochEnd(const char* trigger, unsigned long start) {
+    void* frames[xdefines::CALLSITE_MAXIMUM_LENGTH * 4];
+    void* callsite[xdefines::CALLSITE_MAXIMUM_LENGTH];
+    int depth = 0;
+
+    if(!_enabled) {
+      return;
+    }
+
+    // The frames of DoubleTake are the same for every call of a wrapper.
+    int count = selfmap::getCallStack(frames, xdefines::CALLSITE_MAXIMUM_LENGTH * 4);
+    for(int i = 0; i < count && depth < xdefines::CALLSITE_MAXIMUM_LENGTH; i++) {
+      if(!selfmap::getInstance().isDoubleTakeLibrary(frames[i])) {
+        callsite[depth++] = frames[i];
+      }
+    }
+
+    _pending = findSite(trigger, depth, callsite);
+    if(_pending < 0) {
+      _dropped++;
+      return;
+    }
+
+    _sites[_pending].count++;
+    _endStart = start;
+  }
+
+  /// A new epoch has begun, which completes the cost of the last epoch end.
+  void epochBegin() {
+    if(_pending >= 0) {
+      _sites[_pending].cost += getTime() - _endStart;
+      _pending = -1;
+    }
+  }
+
+private:
+  struct siteEntry {
+    const char* trigger;
+    size_t hash;
+    CallSite callsite;
+    unsigned long count;
+    unsigned long cost;
+  };
+
+  static unsigned long getTime() {
+    struct timespec ts;
+    Real::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+  }
+
+  static bool isSameSite(siteEntry* site, const char* trigger, int depth, void** callsite) {
+    if(site->callsite.depth() != (unsigned long)depth || strcmp(site->trigger, trigger) != 0) {
+      return false;
+    }
+    for(int i = 0; i < depth; i++) {
+      if(site->callsite.get(i) != (unsigned long)callsite[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// @return the entry of trigger at callsite, a new one if needed, -1 if the table is full.
+  int findSite(const char* trigger, int depth, void** callsite) {
+    size_t hash = HashFuncs::hashString(trigger, strlen(trigger));
+    for(int i = 0; i < depth; i++) {
+      hash = hash * 31 + HashFuncs::hashAddr(callsite[i], sizeof(void*));
+    }
+
+    for(int probe = 0; probe < xdefines::EPOCH_PROFILE_SITES; probe++) {
+      int index = (hash + probe) % xdefines::EPOCH_PROFILE_SITES;
+      siteEntry* site = &_sites[index];
+
+      if(site->trigger == NULL) {
+        site->trigger = trigger;
+        site->hash = hash;
+        site->callsite.save(depth, callsite);
+        return index;
+      } else if(site->hash == hash && isSameSite(site, trigger, depth, callsite)) {
+        return index;
+      }
+    }
+    return -1;
+  }
+
+  void report() {
+    int order[xdefines::EPOCH_PROFILE_SITES];
+    int used = 0;
+    unsigned long ends = 0;
+    unsigned long total = 0;
+
+    for(int i = 0; i < xdefines::EPOCH_PROFILE_SITES; i++) {
+      if(_sites[i].count != 0) {
+        order[used++] = i;
+        ends += _sites[i].count;
+        total += _sites[i].cost;
+      }
+    }
+
+    std::sort(order, order + used,
+              [this](int a, int b) { return _sites[a].cost > _sites[b].cost; });
+
+    fprintf(stderr, "DoubleTake epoch ends: %lu at %d call sites, %.3f ms\n", ends, used,
+            total / 1e6);
+    for(int i = 0; i < used && i < (int)_top; i++) {
+      siteEntry* site = &_sites[order[i]];
+
+      fprintf(stderr, "  %5.1f%% %10.3f ms %8lu  %s\n",
+              total ? site->cost * 100.0 / total : 0.0, site->cost / 1e6, site->count,
+              site->trigger);
+      for(int frame = 0; frame < (int)site->callsite.depth(); frame++) {
+        printFrame((void*)site->callsite.get(frame));
+      }
+    }
+
+    if(_dropped != 0) {
+      fprintf(stderr, "  %lu epoch ends at call sites past the first %d\n", _dropped,
+              xdefines::EPOCH_PROFILE_SITES);
+    }
+  }
+
+  static void printFrame(void* addr) {
+    Dl_info info;
+
+    if(dladdr(addr, &info) == 0 || info.dli_fname == NULL) {
+      fprintf(stderr, "        %p\n", addr);
+      return;
+    }
+
+    const char* file = strrchr(info.dli_fname, '/');
+    file = file ? file + 1 : info.dli_fname;
+    if(info.dli_sname != NULL) {
+      fprintf(stderr, "        %p %s(%s+%#lx)\n", addr, file, info.dli_sname,
+              (unsigned long)addr - (unsigned long)info.dli_saddr);
+    } else {
+      fprintf(stderr, "        %p %s+%#lx\n", addr, file,
+              (unsigned long)addr - (unsigned long)info.dli_fbase);
+    }
+  }
+
+  bool _enabled;
+  unsigned long _top;
+  unsigned long _dropped;
+
+  /// The entry charged with the epoch end in progress, -1 if none.
+  int _pending;
+  unsigned long _endStart;
+
+  siteEntry _sites[xdefines::EPOCH_PROFILE_SITES];
+};
+
+#endif
@@ -0,0 +1,144 @@
+#if !defined(DOUBLETAKE_EPOCHSCHEDULER_H)
+#define DOUBLETAKE_EPOCHSCHEDULER_H
+
+/*
+ * @file   epochscheduler.h
+ * @brief  Ends epochs that irrevocable system calls would let grow too large.
+ *         A long compute phase used to stay in one epoch, so a rollback had to replay
+ *         all of it and its logs could run out, aborting the program. Threads now ask
+ *         the scheduler at malloc, mutex_lock and recorded system calls, where the epoch
+ *         can end before anything depends on the phase, whether the epoch has run for
+ *         its time slice, has consumed its share of heap, or has filled a record log of
+ *         the thread past EPOCH_LOG_WATERMARK percent.
+ *         While ending a scheduled epoch costs more than 1/EPOCH_OVERHEAD_RATIO of its
+ *         length, the slice and heap share are doubled, up to EPOCH_MAX_STRETCH times,
+ *         so that short epochs are coalesced; they shrink back once it is cheap again.
+ *         DOUBLETAKE_EPOCH_SLICE_MS and DOUBLETAKE_EPOCH_HEAP_MB override the defaults
+ *         (0 disables the limit).
+ *         An epoch only over its time slice does not have to commit: with background
+ *         verification, it goes on for another slice (see verifier.h).
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <new>
+
+#include "globalinfo.hh"
+#include "real.hh"
+#include "threadstruct.hh"
+#include "xdefines.hh"
+
+class epochscheduler {
+public:
+  epochscheduler()
+    : _active(false), _due(false), _mustCommit(false), _slice(0), _heapLimit(0), _stretch(1),
+      _start(0), _endStart(0), _heapStart(NULL) {}
+
+  static epochscheduler& getInstance() {
+    static char buf[sizeof(epochscheduler)];
+    static epochscheduler* theOneTrueObject = new (buf) epochscheduler();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+    const char* env = getenv("DOUBLETAKE_EPOCH_SLICE_MS");
+    _slice = (env ? strtoul(env, NULL, 10) : (unsigned long)xdefines::EPOCH_SLICE_MS) * 1000000UL;
+
+    env = getenv("DOUBLETAKE_EPOCH_HEAP_MB");
+    _heapLimit = env ? strtoul(env, NULL, 10) * 1048576UL : (size_t)xdefines::EPOCH_HEAP_LIMIT;
+  }
+
+  /// Start timing an epoch whose heap ends at heapPosition. Other threads are stopped.
+  void epochBegin(void* heapPosition) {
+    unsigned long now = getTime();
+
+    if(_due && _endStart != 0) {
+      unsigned long cost = now - _endStart;
+      unsigned long length = _endStart - _start;
+
+      if(cost * xdefines::EPOCH_OVERHEAD_RATIO > length) {
+        if(_stretch < xdefines::EPOCH_MAX_STRETCH) {
+          _stretch *= 2;
+        }
+      } else if(_stretch > 1) {
+        _stretch /= 2;
+      }
+    }
+
+    _start = now;
+    _endStart = 0;
+    _due = false;
+    _mustCommit = false;
+    _heapStart = (char*)heapPosition;
+    _active = true;
+  }
+
+  /// Give the current epoch another time slice. Other threads are stopped.
+  void epochContinue() {
+    _start = getTime();
+    _due = false;
+  }
+
+  /// @return true if the epoch is due because of its heap or logs, not only its time slice.
+  inline bool mustCommit() const { return _mustCommit; }
+
+  void epochEnd() {
+    _active = false;
+    _endStart = getTime();
+  }
+
+  /// @return true if the current thread should end the epoch now. heapPosition is
+  /// where the heap ends, NULL if the caller does not know.
+  inline bool shouldEnd(void* heapPosition = NULL) {
+    static __thread unsigned int checks = 0;
+
+    if(!_active || global_isRollback() || ++checks < xdefines::EPOCH_CHECK_INTERVAL) {
+      return false;
+    }
+    checks = 0;
+
+    if(isDue(heapPosition)) {
+      _due = true;
+      return true;
+    }
+    return false;
+  }
+
+private:
+  bool isDue(void* heapPosition) {
+    if((heapPosition != NULL && _heapLimit != 0 &&
+        (size_t)((char*)heapPosition - _heapStart) >= _heapLimit * _stretch) ||
+       current->syncevents.isAbove(xdefines::EPOCH_LOG_WATERMARK) ||
+       current->syscalls.isAbove(xdefines::EPOCH_LOG_WATERMARK) ||
+       current->inputs.isAbove(xdefines::EPOCH_LOG_WATERMARK)) {
+      _mustCommit = true;
+      return true;
+    }
+
+    return _slice != 0 && getTime() - _start >= _slice * _stretch;
+  }
+
+  static unsigned long getTime() {
+    struct timespec ts;
+    Real::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+  }
+
+  bool _active;
+  bool _due;
+  bool _mustCommit;
+
+  /// Limits of an epoch before stretching: nanoseconds and bytes of heap.
+  unsigned long _slice;
+  size_t _heapLimit;
+  unsigned long _stretch;
+
+  /// When the current epoch began and when the last one began to end.
+  unsigned long _start;
+  unsigned long _endStart;
+  char* _heapStart;
+};
+
+#endif
@@ -0,0 +1,306 @@
+#if !defined(DOUBLETAKE_EPOCHSTATS_H)
+#define DOUBLETAKE_EPOCHSTATS_H
+
+/*
+ * @file   epochstats.h
+ * @brief  Where the time of each epoch goes.
+ *         For every epoch, xrun records how long it ran, how long stopping the other
+ *         threads took, the bytes backed up for the heap, globals, stacks and quarantine
+ *         lists when it began, the time spent in the overflow, use-after-free and leak
+ *         checks, and what ended it: the system call, sync operation or scheduler
+ *         decision that asked for the epoch end.
+ *         DOUBLETAKE_EPOCH_STATS=json writes one JSON object per epoch as it ends,
+ *         DOUBLETAKE_EPOCH_STATS=summary writes totals and histograms of the epoch
+ *         lengths and stop latencies at exit. Either goes to stderr, or to the file
+ *         after a colon, e.g. json:/tmp/epochs.json.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "log.hh"
+#include "real.hh"
+#include "xdefines.hh"
+
+class epochstats {
+public:
+  enum eFormat { OFF, JSON, SUMMARY };
+  enum eRegion { REGION_HEAP = 0, REGION_GLOBALS, REGION_STACKS, REGION_QUARANTINE, NUM_REGIONS };
+  enum eCheck { CHECK_OVERFLOW = 0, CHECK_UAF, CHECK_LEAK, NUM_CHECKS };
+  enum eOutcome { COMMIT = 0, ROLLBACK, EXIT, NUM_OUTCOMES };
+
+  epochstats() : _format(OFF), _fd(-1), _trigger(NULL), _begin(0), _end(0), _epochs(0) {
+    memset(&_record, 0, sizeof(_record));
+    memset(&_total, 0, sizeof(_total));
+    memset(_outcomes, 0, sizeof(_outcomes));
+    memset(_durations, 0, sizeof(_durations));
+    memset(_stops, 0, sizeof(_stops));
+    memset(_triggers, 0, sizeof(_triggers));
+  }
+
+  static epochstats& getInstance() {
+    static char buf[sizeof(epochstats)];
+    static epochstats* theOneTrueObject = new (buf) epochstats();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+    const char* env = getenv("DOUBLETAKE_EPOCH_STATS");
+    if(env == NULL) {
+      return;
+    }
+
+    const char* path = strchr(env, ':');
+    size_t len = path ? (size_t)(path - env) : strlen(env);
+    if(len == 4 && strncmp(env, "json", len) == 0) {
+      _format = JSON;
+    } else if(len == 7 && strncmp(env, "summary", len) == 0) {
+      _format = SUMMARY;
+    } else {
+      PRWRN("DOUBLETAKE_EPOCH_STATS should be json or summary, not %s", env);
+      return;
+    }
+
+    _fd = STDERR_FILENO;
+    if(path != NULL) {
+      _fd = Real::open(path + 1, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+      if(_fd < 0) {
+        PRWRN("Failed to open %s for epoch statistics: %s", path + 1, strerror(errno));
+        _format = OFF;
+      }
+    }
+  }
+
+  void finalize() {
+    if(_format == SUMMARY) {
+      dumpSummary();
+    }
+    if(_fd > STDERR_FILENO) {
+      Real::close(_fd);
+    }
+    _format = OFF;
+  }
+
+  inline bool isEnabled() const { return _format != OFF; }
+
+  /// @return when a timed step starts, 0 if statistics are off.
+  inline unsigned long start() const { return isEnabled() ? getTime() : 0; }
+
+  /// Record what ends the current epoch, unless something already did. Kept with
+  /// statistics off too, for the epoch profile. trigger must stay valid, e.g. a literal.
+  inline void setTrigger(const char* trigger) {
+    const char* none = NULL;
+
+    __atomic_compare_exchange_n(&_trigger, &none, trigger, false, __ATOMIC_RELAXED,
+                                __ATOMIC_RELAXED);
+  }
+
+  /// @return what ends the current epoch.
+  inline const char* getTrigger() const { return _trigger ? _trigger : "unknown"; }
+
+  /// A new epoch begins. Other threads are stopped.
+  void epochBegin() {
+    _trigger = NULL;
+    if(!isEnabled()) {
+      return;
+    }
+
+    memset(&_record, 0, sizeof(_record));
+    _begin = getTime();
+    _end = 0;
+  }
+
+  /// The epoch goes on after one of its slices was verified in the background.
+  void epochContinue() {
+    _trigger = NULL;
+    _record.slices++;
+  }
+
+  /// The epoch stops running; the checks follow.
+  void epochEnd() {
+    if(isEnabled() && _end == 0) {
+      _end = getTime();
+    }
+  }
+
+  inline void addBackup(eRegion region, size_t bytes) {
+    if(isEnabled()) {
+      _record.backup[region] += bytes;
+    }
+  }
+
+  inline void addStop(unsigned long start) {
+    if(start != 0) {
+      _record.stop += getTime() - start;
+    }
+  }
+
+  inline void addCheck(eCheck check, unsigned long start) {
+    if(start != 0) {
+      _record.checks[check] += getTime() - start;
+    }
+  }
+
+  /// Report the epoch that commits or is rolled back.
+  void epochDone(eOutcome outcome) {
+    if(!isEnabled()) {
+      return;
+    }
+
+    epochEnd();
+    _record.duration = _end - _begin;
+
+    const char* trigger = getTrigger();
+    if(_format == JSON) {
+      writeRecord(outcome, trigger);
+    } else {
+      account(outcome, trigger);
+    }
+    _epochs++;
+  }
+
+private:
+  struct epochRecord {
+    unsigned long duration;
+    unsigned long stop;
+    unsigned long checks[NUM_CHECKS];
+    size_t backup[NUM_REGIONS];
+    // Slices of the epoch verified in the background.
+    unsigned long slices;
+  };
+
+  struct triggerCount {
+    const char* name;
+    unsigned long count;
+  };
+
+  static unsigned long getTime() {
+    struct timespec ts;
+    Real::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+  }
+
+  static const char* outcomeName(int outcome) {
+    static const char* names[NUM_OUTCOMES] = { "commit", "rollback", "exit" };
+    return names[outcome];
+  }
+
+  /// Bucket 0 holds what took less than a microsecond, bucket i less than 2^i.
+  static int getBucket(unsigned long ns) {
+    unsigned long us = ns / 1000;
+    int bucket = 0;
+
+    while(us > 0 && bucket < xdefines::EPOCH_STATS_BUCKETS - 1) {
+      us >>= 1;
+      bucket++;
+    }
+    return bucket;
+  }
+
+  void writeRecord(eOutcome outcome, const char* trigger) {
+    print("{\"epoch\":%lu,\"outcome\":\"%s\",\"trigger\":\"%s\",\"duration_ns\":%lu,"
+          "\"stop_ns\":%lu,\"slices\":%lu,"
+          "\"backup_bytes\":{\"heap\":%zu,\"globals\":%zu,\"stacks\":%zu,\"quarantine\":%zu},"
+          "\"check_ns\":{\"overflow\":%lu,\"uaf\":%lu,\"leak\":%lu}}\n",
+          _epochs, outcomeName(outcome), trigger, _record.duration, _record.stop,
+          _record.slices, _record.backup[REGION_HEAP], _record.backup[REGION_GLOBALS],
+          _record.backup[REGION_STACKS], _record.backup[REGION_QUARANTINE],
+          _record.checks[CHECK_OVERFLOW], _record.checks[CHECK_UAF], _record.checks[CHECK_LEAK]);
+  }
+
+  void account(eOutcome outcome, const char* trigger) {
+    _outcomes[outcome]++;
+    _durations[getBucket(_record.duration)]++;
+    _stops[getBucket(_record.stop)]++;
+
+    _total.duration += _record.duration;
+    _total.stop += _record.stop;
+    _total.slices += _record.slices;
+    for(int check = 0; check < NUM_CHECKS; check++) {
+      _total.checks[check] += _record.checks[check];
+    }
+    for(int region = 0; region < NUM_REGIONS; region++) {
+      _total.backup[region] += _record.backup[region];
+    }
+
+    // The last entry counts the ends that do not fit any more.
+    int i;
+    for(i = 0; i < xdefines::EPOCH_STATS_TRIGGERS - 1 && _triggers[i].name != NULL; i++) {
+      if(strcmp(_triggers[i].name, trigger) == 0) {
+        break;
+      }
+    }
+    if(_triggers[i].name == NULL) {
+      _triggers[i].name = (i < xdefines::EPOCH_STATS_TRIGGERS - 1) ? trigger : "other";
+    }
+    _triggers[i].count++;
+  }
+
+  void dumpSummary() {
+    print("DoubleTake epochs: %lu, commit %lu rollback %lu exit %lu, background slices %lu\n",
+          _epochs, _outcomes[COMMIT], _outcomes[ROLLBACK], _outcomes[EXIT], _total.slices);
+    print("  ms: running %.3f stopping %.3f overflow check %.3f uaf check %.3f leak check %.3f\n",
+          _total.duration / 1e6, _total.stop / 1e6, _total.checks[CHECK_OVERFLOW] / 1e6,
+          _total.checks[CHECK_UAF] / 1e6, _total.checks[CHECK_LEAK] / 1e6);
+    print("  backup bytes: heap %zu globals %zu stacks %zu quarantine %zu\n",
+          _total.backup[REGION_HEAP], _total.backup[REGION_GLOBALS],
+          _total.backup[REGION_STACKS], _total.backup[REGION_QUARANTINE]);
+
+    print("  ended by:\n");
+    for(int i = 0; i < xdefines::EPOCH_STATS_TRIGGERS && _triggers[i].name != NULL; i++) {
+      print("    %-24s %lu\n", _triggers[i].name, _triggers[i].count);
+    }
+
+    dumpHistogram("epoch length", _durations);
+    dumpHistogram("stop latency", _stops);
+  }
+
+  void dumpHistogram(const char* name, const unsigned long* buckets) {
+    print("  %s:\n", name);
+    for(int bucket = 0; bucket < xdefines::EPOCH_STATS_BUCKETS; bucket++) {
+      if(buckets[bucket] != 0) {
+        print("    < %lu us %lu\n", 1UL << bucket, buckets[bucket]);
+      }
+    }
+  }
+
+  __attribute__((format(printf, 2, 3))) void print(const char* format, ...) {
+    char line[512];
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if(len > 0) {
+      Real::write(_fd, line, (size_t)len < sizeof(line) ? len : sizeof(line) - 1);
+    }
+  }
+
+  eFormat _format;
+  int _fd;
+
+  /// The current epoch.
+  const char* _trigger;
+  unsigned long _begin;
+  unsigned long _end;
+  struct epochRecord _record;
+
+  /// Epochs reported so far, and their totals for the summary.
+  unsigned long _epochs;
+  struct epochRecord _total;
+  unsigned long _outcomes[NUM_OUTCOMES];
+  unsigned long _durations[xdefines::EPOCH_STATS_BUCKETS];
+  unsigned long _stops[xdefines::EPOCH_STATS_BUCKETS];
+  struct triggerCount _triggers[xdefines::EPOCH_STATS_TRIGGERS];
+};
+
+#endif
@@ -13,6 +13,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "hashfuncs.hh"
@@ -24,6 +27,7 @@
 #include "sysrecord.hh"
 #include "spinlock.hh"
 #include "threadstruct.hh"
+#include "undolog.hh"
 #include "xdefines.hh"
 
 using namespace std;
@@ -60,6 +64,9 @@ public:
   // This is called after we are sure that there is no need to rollback.
 	// Also, we call this after all closed files has been cleaned up.
   void updateOpenedFiles() {
+    // Writes of this epoch will not be undone any more.
+    _undo.clear();
+
     // Get file position for all files in the global hash table.
     filesHashMap::iterator i;
     fileInfo* thisFile;
@@ -296,6 +303,8 @@ public:
   // Now we have to rollback current transaction
 	// by traversing every entry in _filesMap and _dirsMap.
   void prepareRollback() {
+    // Undo the writes of this epoch first.
+    _undo.rollback();
 
     // We must recove all file offsets of all files now.
     filesHashMap::iterator i;
@@ -329,6 +338,57 @@ public:
     }
   }
 
+  // Give every regular file its own open file description in a diagnosis child, so that
+  // neither the undo nor the replay of the epoch changes the files or offsets of the parent.
+  // Files opened for writing are replaced by a private copy in memory, read through a
+  // descriptor of their own since theirs may be write-only.
+  // @return false if a file could not be isolated, which the undo would then change.
+  bool isolate() {
+    filesHashMap::iterator i;
+    for(i = _filesMap.begin(); i != _filesMap.end(); i++) {
+      fileInfo* thisFile = (fileInfo*)i.getData();
+      int fd = thisFile->fd;
+      struct stat st;
+
+      if(Real::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        continue;
+      }
+
+      int flags = Real::fcntl(fd, F_GETFL);
+      off_t pos = Real::lseek(fd, 0, SEEK_CUR);
+      char path[32];
+      int copy;
+
+      snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+      copy = Real::open(path, O_RDONLY);
+
+      if(copy >= 0 && (flags & O_ACCMODE) != O_RDONLY) {
+        int source = copy;
+        off_t offset = 0;
+
+        copy = (int)syscall(SYS_memfd_create, "doubletake", 0);
+        while(copy >= 0 && offset < st.st_size) {
+          if(Real::sendfile(copy, source, &offset, st.st_size - offset) <= 0) {
+            Real::close(copy);
+            copy = -1;
+          }
+        }
+        Real::close(source);
+      }
+
+      if(copy < 0) {
+        PRWRN("Failed to isolate file %d from the parent: %s", fd, strerror(errno));
+        return false;
+      }
+
+      Real::dup2(copy, fd);
+      Real::close(copy);
+      Real::fcntl(fd, F_SETFL, flags & (O_APPEND | O_NONBLOCK));
+      Real::lseek(fd, pos, SEEK_SET);
+    }
+    return true;
+  }
+
   // We are trying to open a file in the rollback phase
   // There is no need to allocate a new block of memory since
   // we already have one.
@@ -519,6 +579,47 @@ public:
     }
   }
 
+  inline bool isUndoLogFull() const { return _undo.isFull(); }
+
+  /// Save what a write of size bytes at offset (-1 for the file offset) to the regular
+  /// file fd overwrites, so that a rollback can undo it.
+  /// @return false if the write can not be undone.
+  bool saveWrite(int fd, off_t offset, size_t size) {
+    off_t position = -1;
+    struct stat st;
+
+    if(Real::fstat(fd, &st) != 0) {
+      return false;
+    }
+
+    if(offset == -1) {
+      position = Real::lseek(fd, 0, SEEK_CUR);
+      if(position == -1) {
+        return false;
+      }
+      offset = position;
+    }
+
+    // Writes to a file opened with O_APPEND always go to its end.
+    int flags = Real::fcntl(fd, F_GETFL);
+    if(flags != -1 && (flags & O_APPEND)) {
+      offset = st.st_size;
+    }
+
+    return _undo.save(fd, position, offset, size, st.st_size);
+  }
+
+  /// Save what truncating the regular file fd to length cuts off.
+  /// @return false if the truncation can not be undone.
+  bool saveTruncate(int fd, off_t length) {
+    struct stat st;
+
+    if(Real::fstat(fd, &st) != 0) {
+      return false;
+    }
+    return _undo.save(fd, -1, length, st.st_size > length ? st.st_size - length : 0, st.st_size);
+  }
+
   // Check whether this file is a normal file, not a socket file.
   bool checkPermission(int fd) {
     bool isAllowed = false;
@@ -543,6 +644,9 @@ public:
 private:
 	SysRecord _sysrecord;
 
+  // Writes to regular files in this epoch.
+  undolog _undo;
+
   /*
     typedef std::pair<int, fileInfo> objectPair;
 
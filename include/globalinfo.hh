@@ -11,8 +11,12 @@
  */
 
 #include <assert.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "log.hh"
 #include "real.hh"
@@ -22,26 +26,28 @@ enum SystemPhase {
   E_SYS_INIT,        // Initialization phase
   E_SYS_EPOCH_END,   // We are just before commit.
   E_SYS_EPOCH_BEGIN, // We have to start a new epoch when no overflow.
+  E_SYS_EPOCH_RESUME, // The current epoch goes on while it is verified in the background.
 };
 extern bool g_isRollback;
 extern bool g_hasRollbacked;
 extern int g_numOfEnds;
 extern enum SystemPhase g_phase;
-extern pthread_cond_t g_condCommitter;
-extern pthread_cond_t g_condWaiters;
 extern pthread_mutex_t g_mutex;
-extern pthread_mutex_t g_mutexSignalhandler;
+// Stopped threads are counted in g_waiters, and sleep until g_resumes changes.
 extern int g_waiters;
 extern int g_waitersTotal;
+extern int g_resumes;
 
 inline void global_lock() { Real::pthread_mutex_lock(&g_mutex); }
 
 inline void global_unlock() { Real::pthread_mutex_unlock(&g_mutex); }
 
-inline void global_lockInsideSignalhandler() { Real::pthread_mutex_lock(&g_mutexSignalhandler); }
+inline void global_futexWait(int* addr, int value) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
 
-inline void global_unlockInsideSignalhandler() {
-  Real::pthread_mutex_unlock(&g_mutexSignalhandler);
+inline void global_futexWake(int* addr, int count) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
 }
 
 inline void global_initialize() {
@@ -49,11 +55,11 @@ inline void global_initialize() {
   g_hasRollbacked = false;
   g_phase = E_SYS_INIT;
   g_numOfEnds = 0;
+  g_waiters = 0;
+  g_waitersTotal = 0;
+  g_resumes = 0;
 
   Real::pthread_mutex_init(&g_mutex, NULL);
-  Real::pthread_mutex_init(&g_mutexSignalhandler, NULL);
-  Real::pthread_cond_init(&g_condCommitter, NULL);
-  Real::pthread_cond_init(&g_condWaiters, NULL);
 }
 
 inline void global_setEpochEnd() {
@@ -69,6 +75,8 @@ inline bool global_isRollback() { return g_isRollback; }
 
 inline bool global_isEpochBegin() { return g_phase == E_SYS_EPOCH_BEGIN; }
 
+inline bool global_isEpochResume() { return g_phase == E_SYS_EPOCH_RESUME; }
+
 inline void global_setRollback() {
   g_isRollback = true;
   g_hasRollbacked = true;
@@ -77,35 +85,53 @@ inline void global_setRollback() {
 inline bool global_hasRollbacked() { return g_hasRollbacked; }
 
 inline void global_wakeup() {
-  // Wakeup all other threads.
-  Real::pthread_cond_broadcast(&g_condWaiters);
+  // Wakeup all other threads with a single broadcast.
+  __atomic_add_fetch(&g_resumes, 1, __ATOMIC_SEQ_CST);
+  global_futexWake(&g_resumes, INT_MAX);
 }
 
-inline void global_epochBegin() {
-  global_lockInsideSignalhandler();
+// Wait for the value of a counter changed by other threads.
+inline void global_waitCounter(int* counter, int value) {
+  int seen;
+
+  while((seen = __atomic_load_n(counter, __ATOMIC_SEQ_CST)) != value) {
+    global_futexWait(counter, seen);
+  }
+}
 
+inline void global_epochBegin() {
   g_phase = E_SYS_EPOCH_BEGIN;
   PRINF("waken up all waiters\n");
-  // Wakeup all other threads.
-  Real::pthread_cond_broadcast(&g_condWaiters);
+  global_wakeup();
 
-  if(g_waiters != 0) {
-    Real::pthread_cond_wait(&g_condCommitter, &g_mutexSignalhandler);
-  }
-  global_unlockInsideSignalhandler();
+  // The stopped threads must leave before any of them can be stopped again.
+  global_waitCounter(&g_waiters, 0);
+}
+
+// Let the stopped threads go on with the current epoch.
+inline void global_epochResume() {
+  g_phase = E_SYS_EPOCH_RESUME;
+  global_wakeup();
+  global_waitCounter(&g_waiters, 0);
 }
 
 inline thread_t* global_getCurrent() { return current; }
 
 // Waiting for the stops of threads, no need to hold the lock.
 inline void global_waitThreadsStops(int totalwaiters) {
-  global_lockInsideSignalhandler();
-  g_waitersTotal = totalwaiters;
-  //    PRINF("During waiting: g_waiters %d g_waitersTotal %d\n", g_waiters, g_waitersTotal);
-  while(g_waiters != g_waitersTotal) {
-    Real::pthread_cond_wait(&g_condCommitter, &g_mutexSignalhandler);
+  __atomic_store_n(&g_waitersTotal, totalwaiters, __ATOMIC_SEQ_CST);
+  global_waitCounter(&g_waiters, totalwaiters);
+}
+
+// Sleep until the committer resumes the stopped threads or starts a rollback.
+inline void global_waitForResume() {
+  while(true) {
+    int resumes = __atomic_load_n(&g_resumes, __ATOMIC_SEQ_CST);
+    if(!global_isEpochEnd() || global_isRollback()) {
+      break;
+    }
+    global_futexWait(&g_resumes, resumes);
   }
-  global_unlockInsideSignalhandler();
 }
 
 inline void global_checkWaiters() { 
@@ -117,29 +143,19 @@ inline void global_waitForNotification() {
   assert(global_isEpochEnd() == true);
 
   //    printf("waitForNotification, waiters is %d at thread %p\n", g_waiters, pthread_self());
-  global_lockInsideSignalhandler();
-  //PRINF("waitForNotification g_waiters %d totalWaiters %d\n", g_waiters, g_waitersTotal);
-  g_waiters++;
-
-	// Wakeup the committer
-  if(g_waiters == g_waitersTotal) {
-    Real::pthread_cond_signal(&g_condCommitter);
+	// Wakeup the committer once every signaled thread has stopped.
+  if(__atomic_add_fetch(&g_waiters, 1, __ATOMIC_SEQ_CST) ==
+     __atomic_load_n(&g_waitersTotal, __ATOMIC_SEQ_CST)) {
+    global_futexWake(&g_waiters, 1);
   }
 
   // Only waken up when it is not the end of epoch anymore.
-  while(global_isEpochEnd()) {
-    PRINF("waitForNotification before waiting again\n");
-    Real::pthread_cond_wait(&g_condWaiters, &g_mutexSignalhandler);
-    PRINF("waitForNotification after waken up. isEpochEnd() %d \n", global_isEpochEnd());
-  }
+  global_waitForResume();
+  PRINF("waitForNotification after waken up. isEpochEnd() %d \n", global_isEpochEnd());
 
-  g_waiters--;
-
-  if(g_waiters == 0) {
-    Real::pthread_cond_signal(&g_condCommitter);
+  if(__atomic_sub_fetch(&g_waiters, 1, __ATOMIC_SEQ_CST) == 0) {
+    global_futexWake(&g_waiters, 1);
   }
-
-  global_unlockInsideSignalhandler();
 }
 
 #endif
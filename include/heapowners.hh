@@ -0,0 +1,59 @@
+#if !defined(DOUBLETAKE_HEAPOWNERS_H)
+#define DOUBLETAKE_HEAPOWNERS_H
+
+/*
+ * @file   heapowners.h
+ * @brief  Which per-thread heap each page of the user heap belongs to.
+ *         A heap takes its chunks from xheap, which hands out whole pages, so a page
+ *         never holds objects of two heaps and one byte per page is enough. The map is
+ *         not part of the checkpoint: after a rollback, pages below the restored heap
+ *         position keep their owners, and pages above it are recorded again when they
+ *         are handed out again.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include "mm.hh"
+#include "xdefines.hh"
+
+class heapowners {
+public:
+  heapowners() : _start(0), _owners(NULL) {}
+
+  static heapowners& getInstance() {
+    static char buf[sizeof(heapowners)];
+    static heapowners* theOneTrueObject = new (buf) heapowners();
+    return *theOneTrueObject;
+  }
+
+  void initialize(void* start, size_t size) {
+    assert(xdefines::NUM_HEAPS <= 256);
+
+    _start = (uintptr_t)start;
+    _owners = (unsigned char*)MM::mmapAllocatePrivate(size / xdefines::PageSize);
+  }
+
+  /// The chunk [ptr, ptr + size) now belongs to heap.
+  void setOwner(void* ptr, size_t size, int heap) {
+    size_t first = getIndex(ptr);
+    size_t last = getIndex((char*)ptr + size - 1);
+
+    for(size_t i = first; i <= last; i++) {
+      _owners[i] = (unsigned char)heap;
+    }
+  }
+
+  inline int getOwner(void* ptr) { return _owners[getIndex(ptr)]; }
+
+private:
+  inline size_t getIndex(void* ptr) { return ((uintptr_t)ptr - _start) / xdefines::PageSize; }
+
+  uintptr_t _start;
+  unsigned char* _owners;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#if !defined(DOUBLETAKE_IMAGEFORMAT_H)
+#define DOUBLETAKE_IMAGEFORMAT_H
+
+/*
+ * @file   imageformat.h
+ * @brief  On-disk format of checkpoint images, shared by libdoubletake and tools/dtimage.
+ *         An image is a header followed by sections. Each section is a range of memory,
+ *         written at its address in the process, followed by its bytes. Large regions
+ *         are only written for their runs of non-zero pages, so a section never holds
+ *         a page of zeros there. The header is written last, once the sections are.
+ */
+
+#include <stdint.h>
+
+#define IMAGE_MAGIC "DTIMAGE"
+
+enum { IMAGE_VERSION = 1 };
+
+/// Addresses that must be the same in the process loading the image.
+enum e_imageLayout {
+  LAYOUT_LIBRARY = 0, // The xrun object, within the data of libdoubletake.
+  LAYOUT_GLOBALS,     // The first global region of the application.
+  LAYOUT_HEAP,        // The start of the user heap.
+  LAYOUT_STACK,       // The top of the stack of the main thread.
+  LAYOUT_WORDS
+};
+
+enum e_imageKind {
+  IMAGE_GLOBALS = 0,   // Globals of the application and its libraries.
+  IMAGE_LIBRARY,       // Data of libdoubletake: threads, contexts and sync lists.
+  IMAGE_HEAP,          // The user heap and its metadata.
+  IMAGE_INTERNAL_HEAP, // Logs, file and memtrack records of DoubleTake.
+  IMAGE_STACK,         // The stack of a thread when the epoch began.
+  IMAGE_LOG,           // Sync events, system calls and inputs of a thread.
+  IMAGE_QUARANTINE,    // The quarantine list of a thread and its backup.
+  IMAGE_KINDS
+};
+
+struct imageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t threads;
+  uint64_t sections;
+  uint64_t layout[LAYOUT_WORDS];
+};
+
+struct imageSection {
+  uint32_t kind;
+  uint32_t thread;
+  uint64_t address;
+  uint64_t size;
+};
+
+inline const char* imageKindName(uint32_t kind) {
+  static const char* names[IMAGE_KINDS] = { "globals", "library",  "heap",      "internal",
+                                            "stack",   "log",      "quarantine" };
+  return kind < IMAGE_KINDS ? names[kind] : "unknown";
+}
+
+#endif
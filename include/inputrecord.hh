@@ -0,0 +1,74 @@
+#if !defined(DOUBLETAKE_INPUTRECORD_H)
+#define DOUBLETAKE_INPUTRECORD_H
+
+/*
+ * @file   inputrecord.h
+ * @brief  The bytes a recorded system call returns, as they are saved for the replay:
+ *         what it returned in its data buffers, followed by all of its extra buffers.
+ *         Only for calls with data buffers, such as read or recvfrom, is the return value
+ *         the number of bytes in them. Other calls return a pointer (getcwd) or an id
+ *         (getppid), and their record holds their extra buffers only.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+class inputrecord {
+public:
+  /// @return the total size of the count buffers of vector.
+  static size_t getSize(const struct iovec* vector, int count) {
+    size_t size = 0;
+    for(int i = 0; i < count; i++) {
+      size += vector[i].iov_len;
+    }
+    return size;
+  }
+
+  /// @return how many bytes a call that returned ret put into its count data buffers,
+  /// which hold size bytes.
+  static size_t getDataLength(ssize_t ret, int count, size_t size) {
+    if(count == 0 || ret <= 0) {
+      return 0;
+    }
+    return (size_t)ret < size ? (size_t)ret : size;
+  }
+
+  /// Save length bytes of the data buffers and all of the extra buffers into dest.
+  static void save(char* dest, const struct iovec* data, int count, size_t length,
+                   const struct iovec* extra, int extras) {
+    gather(dest, data, count, length);
+    gather(dest + length, extra, extras, getSize(extra, extras));
+  }
+
+  /// Put length bytes of data and the extra buffers saved in src back where they belong.
+  static void restore(const char* src, const struct iovec* data, int count, size_t length,
+                      const struct iovec* extra, int extras) {
+    scatter(data, count, src, length);
+    scatter(extra, extras, src + length, getSize(extra, extras));
+  }
+
+private:
+  // Copy size bytes from src into the count buffers of vector, in order.
+  static void scatter(const struct iovec* vector, int count, const char* src, size_t size) {
+    for(int i = 0; i < count && size > 0; i++) {
+      size_t len = vector[i].iov_len < size ? vector[i].iov_len : size;
+      memcpy(vector[i].iov_base, src, len);
+      src += len;
+      size -= len;
+    }
+  }
+
+  // Copy size bytes from the count buffers of vector, in order, into dest.
+  static void gather(char* dest, const struct iovec* vector, int count, size_t size) {
+    for(int i = 0; i < count && size > 0; i++) {
+      size_t len = vector[i].iov_len < size ? vector[i].iov_len : size;
+      memcpy(dest, vector[i].iov_base, len);
+      dest += len;
+      size -= len;
+    }
+  }
+};
+
+#endif
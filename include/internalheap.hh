@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <new>
 
@@ -142,6 +143,27 @@ public:
 
   void free(void* ptr) { _heap.free(getThreadIndex(), ptr); }
 
+  /// Grow a buffer of *capacity bytes, with used of them in use, to hold size bytes.
+  /// The capacity starts at a page and doubles.
+  /// @return the new buffer, holding the used bytes of data, which is freed.
+  char* grow(char* data, size_t used, size_t* capacity, size_t size) {
+    size_t newCapacity = (*capacity != 0) ? *capacity : (size_t)xdefines::PageSize;
+    while(newCapacity < size) {
+      newCapacity *= 2;
+    }
+
+    char* newData = (char*)malloc(newCapacity);
+    if(data != NULL) {
+      memcpy(newData, data, used);
+      free(data);
+    }
+    *capacity = newCapacity;
+    return newData;
+  }
+
+  /// Where the heap ends, including its metadata.
+  void* getHeapPosition() { return _heap.getHeapPosition(); }
+
 private:
   perheap<xoneheap<SourceInternalHeap>> _heap;
 };
@@ -0,0 +1,250 @@
+#if !defined(DOUBLETAKE_LARGEHEAP_H)
+#define DOUBLETAKE_LARGEHEAP_H
+
+/*
+ * @file   largeheap.h
+ * @brief  Objects larger than LARGE_OBJECT_THRESHOLD, and objects aligned to a page or
+ *         more of any size, each on pages of its own.
+ *         A size class would round such an object up to the next power of two, and
+ *         growing it would always copy it. Here the span of an object is just the pages
+ *         it needs, with its header at the start and its last sentinel in the last word.
+ *         An aligned object takes one page more, whose end holds its header.
+ *         Freed spans are kept in address order, merged with their free neighbours and
+ *         reused by first fit. An object grows in place over the free span right after
+ *         it, or over fresh pages when it ends at the heap position. The user heap is one
+ *         mapping that is checkpointed as a whole, so objects never leave it with mremap.
+ *         The free spans live in the metadata of the user heap, which is part of the
+ *         checkpoint: a rollback restores them with the heap.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include "objectheader.hh"
+#include "sentinelmap.hh"
+#include "spinlock.hh"
+#include "xdefines.hh"
+
+template <class SourceHeap> class largeheap : public SourceHeap {
+public:
+  largeheap() : _count(0) { _lock.init(); }
+
+  /// @return whether objects of sz, or blocks of size sz, belong here.
+  static inline bool isLarge(size_t sz) { return sz > xdefines::LARGE_OBJECT_THRESHOLD; }
+
+  /// @return whether the object at ptr came from here.
+  static inline bool isSpanObject(void* ptr) { return getObject(ptr)->isObjectSpan(); }
+
+  void* malloc(size_t sz) {
+    size_t size = alignup(sizeof(objectHeader) + sz + xdefines::SENTINEL_SIZE,
+                          xdefines::PageSize);
+    char* span = NULL;
+
+    _lock.lock();
+    for(unsigned int i = 0; i < _count; i++) {
+      if(_spans[i].size >= size) {
+        span = _spans[i].start;
+        take(i, size);
+        break;
+      }
+    }
+    _lock.unlock();
+
+    if(span != NULL) {
+      return makeObject(span, span + size, false);
+    }
+    span = (char*)SourceHeap::malloc(size);
+    return makeObject(span, span + size, true);
+  }
+
+  /// An object of sz aligned to boundary, a multiple of the page size. Its span starts
+  /// one page before it, and the free spans are searched for one that fits so aligned.
+  void* memalign(size_t boundary, size_t sz) {
+    size_t lead = xdefines::PageSize;
+    size_t size = lead + alignup(sz + xdefines::SENTINEL_SIZE, xdefines::PageSize);
+    char* span = NULL;
+
+    _lock.lock();
+    for(unsigned int i = 0; i < _count; i++) {
+      char* start = _spans[i].start;
+      char* end = start + _spans[i].size;
+      char* aligned = (char*)alignup((uintptr_t)start + lead, boundary);
+
+      if(aligned + size - lead <= end) {
+        span = aligned - lead;
+        if(span == start) {
+          take(i, size);
+        } else {
+          // The pages before the object stay free, and those after it are free again.
+          _spans[i].size = span - start;
+        }
+        if(span + size < end) {
+          insert(span + size, end - span - size);
+        }
+        break;
+      }
+    }
+    _lock.unlock();
+
+    if(span != NULL) {
+      return makeObject(span + lead - sizeof(objectHeader), span + size, false);
+    }
+
+    // The pages skipped to align the object are free for the next one.
+    size_t skipped = 0;
+    span = (char*)SourceHeap::memalign(boundary, lead, size, &skipped);
+    if(skipped != 0) {
+      _lock.lock();
+      insert(span - skipped, skipped);
+      _lock.unlock();
+    }
+    return makeObject(span + lead - sizeof(objectHeader), span + size, true);
+  }
+
+  // The span of an object is found from its header and size, so that aligned objects,
+  // whose header ends the page before them, come back whole.
+  void free(void* ptr) {
+    objectHeader* o = getObject(ptr);
+    char* span = (char*)aligndown((uintptr_t)o, xdefines::PageSize);
+    char* end = getEnd(ptr, o->getSize());
+
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    // Spans may be split differently next time, so no sentinel of this one may stay.
+    sentinelmap::getInstance().cleanup(span, end - span);
+#endif
+
+    _lock.lock();
+    insert(span, end - span);
+    _lock.unlock();
+  }
+
+  /// Grow the block of ptr in place, so that it holds sz bytes.
+  /// @return false if the pages after it are taken.
+  bool grow(void* ptr, size_t sz) {
+    objectHeader* o = getObject(ptr);
+    size_t blockSize = o->getSize();
+    char* end = getEnd(ptr, blockSize);
+    char* newEnd = getEnd(ptr, sz);
+    bool grown = false;
+
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    // An object that overflowed is copied and freed instead, so that its free reports it.
+    size_t* sentinel = (size_t*)((intptr_t)ptr + blockSize);
+    if(*sentinel != xdefines::SENTINEL_WORD) {
+      return false;
+    }
+#endif
+
+    if(newEnd <= end) {
+      grown = true;
+    } else {
+      _lock.lock();
+      for(unsigned int i = 0; i < _count && _spans[i].start <= end; i++) {
+        if(_spans[i].start == end && _spans[i].size >= (size_t)(newEnd - end)) {
+          take(i, newEnd - end);
+          grown = true;
+          break;
+        }
+      }
+      _lock.unlock();
+
+      if(!grown) {
+        grown = SourceHeap::extend(end, newEnd - end);
+      }
+    }
+    if(!grown) {
+      return false;
+    }
+
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    sentinelmap::getInstance().clearSentinelAt(sentinel);
+#endif
+    blockSize = newEnd - (char*)ptr - xdefines::SENTINEL_SIZE;
+    o->setSize(blockSize);
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    sentinelmap::getInstance().setupSentinels(ptr, blockSize);
+#endif
+    return true;
+  }
+
+private:
+  static objectHeader* getObject(void* ptr) { return (objectHeader*)ptr - 1; }
+
+  // The end of the pages of an object at ptr with a block of blockSize.
+  static char* getEnd(void* ptr, size_t blockSize) {
+    return (char*)alignup((uintptr_t)ptr + blockSize + xdefines::SENTINEL_SIZE,
+                          xdefines::PageSize);
+  }
+
+  // The block takes all of the span from the header at start to end, but its last sentinel.
+  static void* makeObject(char* start, char* end, bool isZero) {
+    size_t blockSize = end - start - sizeof(objectHeader) - xdefines::SENTINEL_SIZE;
+    objectHeader* o = new (start) objectHeader(blockSize);
+    void* ptr = (void*)(o + 1);
+
+    o->markObjectSpan();
+    if(isZero) {
+      o->markObjectZero();
+    }
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    sentinelmap::getInstance().setupSentinels(ptr, blockSize);
+#endif
+    return ptr;
+  }
+
+  // Take size bytes from the start of the free span i. Called with the lock held.
+  void take(unsigned int i, size_t size) {
+    if(_spans[i].size > size) {
+      _spans[i].start += size;
+      _spans[i].size -= size;
+      return;
+    }
+
+    _count--;
+    for(unsigned int j = i; j < _count; j++) {
+      _spans[j] = _spans[j + 1];
+    }
+  }
+
+  // Add a free span, merged with its neighbours. Called with the lock held.
+  void insert(char* start, size_t size) {
+    unsigned int i = 0;
+    while(i < _count && _spans[i].start < start) {
+      i++;
+    }
+
+    bool mergePrev = (i > 0 && _spans[i - 1].start + _spans[i - 1].size == start);
+    bool mergeNext = (i < _count && start + size == _spans[i].start);
+
+    if(mergePrev && mergeNext) {
+      _spans[i - 1].size += size + _spans[i].size;
+      take(i, _spans[i].size);
+    } else if(mergePrev) {
+      _spans[i - 1].size += size;
+    } else if(mergeNext) {
+      _spans[i].start = start;
+      _spans[i].size += size;
+    } else if(_count < xdefines::LARGE_HEAP_SPANS) {
+      for(unsigned int j = _count; j > i; j--) {
+        _spans[j] = _spans[j - 1];
+      }
+      _spans[i].start = start;
+      _spans[i].size = size;
+      _count++;
+    }
+    // Otherwise the span is lost, like the rest of a chunk of the zone heap.
+  }
+
+  struct span {
+    char* start;
+    size_t size;
+  };
+
+  spinlock _lock;
+  unsigned int _count;
+  struct span _spans[xdefines::LARGE_HEAP_SPANS];
+};
+
+#endif
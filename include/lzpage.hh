@@ -0,0 +1,186 @@
+#if !defined(DOUBLETAKE_LZPAGE_H)
+#define DOUBLETAKE_LZPAGE_H
+
+/*
+ * @file   lzpage.h
+ * @brief  A small LZ77 codec for compressing checkpoint pages, with no external library.
+ *         The format follows LZ4 blocks: every sequence starts with a token byte whose
+ *         high nibble is the literal length and whose low nibble is the match length
+ *         minus 4. A nibble of 15 is continued by bytes adding up to 255 each. The
+ *         literals follow, then a 2-byte little-endian match offset. The last sequence
+ *         only has literals. Matches are found with a single hash table of 4-byte
+ *         sequences, which favors speed over ratio: heap pages are mostly compressed
+ *         once per epoch and only decompressed on the rare rollback path.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+class lzpage {
+  enum { MIN_MATCH = 4 };
+  enum { MAX_OFFSET = 65535 };
+  enum { HASH_BITS = 12 };
+  enum { HASH_SIZE = 1 << HASH_BITS };
+
+public:
+  /// Compress size bytes (less than 64KB) of src into dest.
+  /// @return the compressed size, or 0 if it does not fit into capacity.
+  static size_t compress(const void* src, size_t size, void* dest, size_t capacity) {
+    const uint8_t* in = (const uint8_t*)src;
+    uint8_t* out = (uint8_t*)dest;
+    // Position plus one of the last sequence with a hash, 0 if none.
+    uint16_t table[HASH_SIZE];
+    size_t anchor = 0;
+    size_t pos = 0;
+    size_t outPos = 0;
+
+    memset(table, 0, sizeof(table));
+
+    while(pos + MIN_MATCH <= size) {
+      uint32_t sequence = read32(in + pos);
+      uint32_t h = hash(sequence);
+      size_t candidate = table[h];
+      table[h] = (uint16_t)(pos + 1);
+
+      if(candidate == 0 || pos - (candidate - 1) > MAX_OFFSET ||
+         read32(in + candidate - 1) != sequence) {
+        pos++;
+        continue;
+      }
+
+      size_t match = candidate - 1;
+      size_t length = MIN_MATCH;
+      while(pos + length < size && in[match + length] == in[pos + length]) {
+        length++;
+      }
+
+      if(!emit(out, &outPos, capacity, in + anchor, pos - anchor, pos - match, length)) {
+        return 0;
+      }
+
+      pos += length;
+      anchor = pos;
+    }
+
+    if(!emit(out, &outPos, capacity, in + anchor, size - anchor, 0, 0)) {
+      return 0;
+    }
+    return outPos;
+  }
+
+  /// Decompress size bytes of src, which must expand to exactly destSize bytes.
+  /// @return false if src is corrupted.
+  static bool decompress(const void* src, size_t size, void* dest, size_t destSize) {
+    const uint8_t* in = (const uint8_t*)src;
+    uint8_t* out = (uint8_t*)dest;
+    size_t pos = 0;
+    size_t outPos = 0;
+
+    while(pos < size) {
+      uint8_t token = in[pos++];
+
+      size_t literals = token >> 4;
+      if(literals == 15 && !readLength(in, size, &pos, &literals)) {
+        return false;
+      }
+      if(literals > size - pos || literals > destSize - outPos) {
+        return false;
+      }
+      memcpy(out + outPos, in + pos, literals);
+      pos += literals;
+      outPos += literals;
+
+      // The last sequence has no match.
+      if(pos == size) {
+        break;
+      }
+
+      if(size - pos < 2) {
+        return false;
+      }
+      size_t offset = in[pos] | (in[pos + 1] << 8);
+      pos += 2;
+
+      size_t length = (token & 15) + MIN_MATCH;
+      if(length == 15 + MIN_MATCH && !readLength(in, size, &pos, &length)) {
+        return false;
+      }
+      if(offset == 0 || offset > outPos || length > destSize - outPos) {
+        return false;
+      }
+
+      // Byte by byte, since the match may overlap what it produces.
+      const uint8_t* match = out + outPos - offset;
+      for(size_t i = 0; i < length; i++) {
+        out[outPos + i] = match[i];
+      }
+      outPos += length;
+    }
+
+    return outPos == destSize;
+  }
+
+private:
+  static inline uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  }
+
+  static inline uint32_t hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - HASH_BITS);
+  }
+
+  // Write one sequence. A length of 0 means there is no match.
+  static bool emit(uint8_t* out, size_t* outPos, size_t capacity, const uint8_t* literals,
+                   size_t literalCount, size_t offset, size_t length) {
+    // Token, both length continuations and the offset at most.
+    size_t needed = 1 + literalCount / 255 + 1 + literalCount + 2 + length / 255 + 1;
+    if(*outPos + needed > capacity) {
+      return false;
+    }
+
+    size_t matchCode = length ? length - MIN_MATCH : 0;
+    uint8_t* token = out + (*outPos)++;
+    *token = (uint8_t)(((literalCount < 15 ? literalCount : 15) << 4) |
+                       (matchCode < 15 ? matchCode : 15));
+
+    if(literalCount >= 15) {
+      writeLength(out, outPos, literalCount - 15);
+    }
+    memcpy(out + *outPos, literals, literalCount);
+    *outPos += literalCount;
+
+    if(length) {
+      out[(*outPos)++] = (uint8_t)(offset & 0xff);
+      out[(*outPos)++] = (uint8_t)(offset >> 8);
+      if(matchCode >= 15) {
+        writeLength(out, outPos, matchCode - 15);
+      }
+    }
+    return true;
+  }
+
+  static void writeLength(uint8_t* out, size_t* outPos, size_t length) {
+    while(length >= 255) {
+      out[(*outPos)++] = 255;
+      length -= 255;
+    }
+    out[(*outPos)++] = (uint8_t)length;
+  }
+
+  static bool readLength(const uint8_t* in, size_t size, size_t* pos, size_t* length) {
+    uint8_t byte;
+    do {
+      if(*pos >= size) {
+        return false;
+      }
+      byte = in[(*pos)++];
+      *length += byte;
+    } while(byte == 255);
+    return true;
+  }
+};
+
+#endif
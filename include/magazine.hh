@@ -0,0 +1,77 @@
+#if !defined(DOUBLETAKE_MAGAZINE_H)
+#define DOUBLETAKE_MAGAZINE_H
+
+/*
+ * @file   magazine.h
+ * @brief  Small objects freed by a thread, kept for its next allocations of the same size.
+ *         A magazine is a stack of objects for each size up to MAGAZINE_MAX_SIZE, in
+ *         steps of 16 bytes as xmemory rounds them, so an allocation it can serve skips
+ *         the layers of the per-thread heap. Every object remembers the size its
+ *         sentinels are still set for, so that an object reused for the same size does
+ *         not touch the sentinel bitmap again.
+ *         The magazines live in the metadata of the user heap, which is part of the
+ *         checkpoint: a rollback restores them with the heap, and the replayed epoch
+ *         gets the same objects back.
+ */
+
+#include <stddef.h>
+
+#include "xdefines.hh"
+
+class magazine {
+public:
+  magazine() {
+    for(int i = 0; i < CLASSES; i++) {
+      _stacks[i].count = 0;
+    }
+  }
+
+  /// @return whether objects of sz, already aligned to 16 bytes, can be kept.
+  static inline bool fits(size_t sz) { return sz <= xdefines::MAGAZINE_MAX_SIZE; }
+
+  /// @return an object of sz, and in armed the size its sentinels are set for, or NULL.
+  inline void* pop(size_t sz, size_t* armed) {
+    struct stack* s = &_stacks[getClass(sz)];
+
+    if(s->count == 0) {
+      return NULL;
+    }
+    s->count--;
+    *armed = s->armed[s->count];
+    return s->objects[s->count];
+  }
+
+  /// @return whether another object of sz can be kept.
+  inline bool hasRoom(size_t sz) {
+    return _stacks[getClass(sz)].count < xdefines::MAGAZINE_SLOTS;
+  }
+
+  /// Keep ptr, allocated for sz, with sentinels set for armed bytes (0 for none).
+  /// @return false if the magazine of sz is full.
+  inline bool push(size_t sz, void* ptr, size_t armed) {
+    struct stack* s = &_stacks[getClass(sz)];
+
+    if(s->count == xdefines::MAGAZINE_SLOTS) {
+      return false;
+    }
+    s->objects[s->count] = ptr;
+    s->armed[s->count] = armed;
+    s->count++;
+    return true;
+  }
+
+private:
+  enum { CLASSES = xdefines::MAGAZINE_MAX_SIZE / 16 };
+
+  static inline int getClass(size_t sz) { return (sz >> 4) - 1; }
+
+  struct stack {
+    unsigned int count;
+    unsigned int armed[xdefines::MAGAZINE_SLOTS];
+    void* objects[xdefines::MAGAZINE_SLOTS];
+  };
+
+  struct stack _stacks[CLASSES];
+};
+
+#endif
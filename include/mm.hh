@@ -8,6 +8,8 @@
 #include <string.h>
 #include <sys/mman.h>
 
+#include "xdefines.hh"
+
 #include "log.hh"
 #include "real.hh"
 
@@ -25,7 +27,99 @@ public:
     return allocate(false, sz, fd, startaddr);
   }
 
+  /// Map a large, long-lived private region: the user heap, its backups and the sentinel
+  /// bitmap. By default it is the same as mmapAllocatePrivate. With DOUBLETAKE_HUGEPAGES=thp,
+  /// the region is aligned to 2MB (at the same offset as alignAs, so that a backup lines up
+  /// with the huge pages of the memory it mirrors) and advised with MADV_HUGEPAGE.
+  /// With DOUBLETAKE_HUGEPAGES=hugetlb, the region comes from the hugetlbfs pool if
+  /// the kernel can map it there, and from transparent huge pages otherwise.
+  static void* mmapAllocateLarge(size_t sz, void* startaddr = NULL, void* alignAs = NULL) {
+    int mode = hugePageMode();
+    if(mode == HUGE_PAGES_NONE || sz < xdefines::HugePageSize) {
+      return allocate(false, sz, -1, startaddr);
+    }
+
+    size_t len = alignup(sz, xdefines::HugePageSize);
+    void* ptr;
+
+    if(startaddr != NULL) {
+      // A fixed address can not be moved. Only the huge pages that fit inside the region
+      // are used, so that nothing after it is mapped over or advised.
+      ptr = allocate(false, sz, -1, startaddr);
+
+      char* begin = (char*)alignup((uintptr_t)startaddr, xdefines::HugePageSize);
+      char* end = (char*)aligndown((uintptr_t)startaddr + sz, xdefines::HugePageSize);
+      if(begin < end) {
+        useHugePages(mode, begin, end - begin);
+      }
+      return ptr;
+    }
+
+    // Without MAP_NORESERVE the whole region is reserved from the pool up front,
+    // so a small pool makes the mmap fail instead of a later page fault.
+    if(mode == HUGE_PAGES_HUGETLB) {
+      ptr = Real::mmap(NULL, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if(ptr != MAP_FAILED) {
+        return ptr;
+      }
+      PRINF("hugetlbfs mapping of %zx bytes failed (%s), trying THP", len, strerror(errno));
+    }
+
+    // Over-map by one huge page and trim both ends.
+    char* raw = (char*)allocate(false, len + xdefines::HugePageSize, -1, NULL);
+    uintptr_t offset = (uintptr_t)alignAs & (xdefines::HugePageSize - 1);
+    char* aligned = (char*)(alignup((uintptr_t)raw - offset, xdefines::HugePageSize) + offset);
+
+    if(aligned > raw) {
+      Real::munmap(raw, aligned - raw);
+    }
+    Real::munmap(aligned + len, raw + xdefines::HugePageSize - aligned);
+    ptr = aligned;
+
+    if(Real::madvise(ptr, len, MADV_HUGEPAGE) != 0) {
+      PRINF("MADV_HUGEPAGE failed on %p (%s)", ptr, strerror(errno));
+    }
+    return ptr;
+  }
+
 private:
+  enum { HUGE_PAGES_NONE, HUGE_PAGES_THP, HUGE_PAGES_HUGETLB };
+
+  static int hugePageMode() {
+    static int mode = -1;
+
+    if(mode == -1) {
+      const char* env = getenv("DOUBLETAKE_HUGEPAGES");
+      if(env != NULL && strcmp(env, "thp") == 0) {
+        mode = HUGE_PAGES_THP;
+      } else if(env != NULL && strcmp(env, "hugetlb") == 0) {
+        mode = HUGE_PAGES_HUGETLB;
+      } else {
+        mode = HUGE_PAGES_NONE;
+      }
+    }
+    return mode;
+  }
+
+  // Back [ptr, ptr + len), huge-page aligned and inside a mapping of ours, with huge pages.
+  static void useHugePages(int mode, void* ptr, size_t len) {
+    if(mode == HUGE_PAGES_HUGETLB) {
+      void* huge = Real::mmap(ptr, len, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_FIXED, -1, 0);
+      if(huge != MAP_FAILED) {
+        return;
+      }
+      PRINF("hugetlbfs mapping of %zx bytes failed (%s), trying THP", len, strerror(errno));
+      // A failed MAP_FIXED may have unmapped the range already.
+      allocate(false, len, -1, ptr);
+    }
+
+    if(Real::madvise(ptr, len, MADV_HUGEPAGE) != 0) {
+      PRINF("MADV_HUGEPAGE failed on %p (%s)", ptr, strerror(errno));
+    }
+  }
+
   static void* allocate(bool isShared, size_t sz, int fd, void* startaddr) {
     int protInfo = PROT_READ | PROT_WRITE;
     int sharedInfo = isShared ? MAP_SHARED : MAP_PRIVATE;
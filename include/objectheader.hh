@@ -15,6 +15,12 @@
  * @author Emery Berger <http://www.cs.umass.edu/~emery>
  * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
  */
+#define OBJECT_CHECKED_WORD (0x1)
+#define OBJECT_CHECKED_WORD_MASK (0xFFFFFFFE)
+#define OBJECT_ZERO_WORD (0x2)
+#define OBJECT_SPAN_WORD (0x4)
+#define OBJECT_SIZE_MASK (0xFFFFFFF8)
+
 class objectHeader {
 public:
   objectHeader(size_t sz)
@@ -26,10 +32,13 @@ public:
 #endif
   }
 
-  size_t getSize() { return (size_t)_blockSize; }
+  size_t getSize() { return (size_t)(_blockSize & OBJECT_SIZE_MASK); }
 
   size_t getObjectSize() { return (size_t)_objectSize; }
 
+  // The block grows in place, keeping the bits that are not part of its size.
+  void setSize(size_t sz) { _blockSize = sz | (_blockSize & ~OBJECT_SIZE_MASK); }
+
   size_t setObjectSize(size_t sz) {
     _objectSize = sz;
     return sz;
@@ -49,14 +58,24 @@ public:
 
   bool isObjectFree() { return (_objectSize == 0); }
 
-#define OBJECT_CHECKED_WORD (0x1)
-#define OBJECT_CHECKED_WORD_MASK (0xFFFFFFFE)
-
   void* getNextObject() {
-    return ((void*)((intptr_t) & _sentinel + 4 * xdefines::SENTINEL_SIZE + _blockSize));
+    return ((void*)((intptr_t) & _sentinel + 4 * xdefines::SENTINEL_SIZE + getSize()));
   }
 
-  // Since _blockSize is always power of 2 in our allocator,
+  // A block just carved out of the heap is still zero, until it is allocated
+  // for the first time. The next bit of _blockSize tells.
+  void markObjectZero() { _blockSize |= OBJECT_ZERO_WORD; }
+
+  bool isObjectZero() { return (_blockSize & OBJECT_ZERO_WORD) ? true : false; }
+
+  void cleanObjectZero() { _blockSize &= ~OBJECT_ZERO_WORD; }
+
+  // An object on pages of its own, see largeheap.h, whatever its size.
+  void markObjectSpan() { _blockSize |= OBJECT_SPAN_WORD; }
+
+  bool isObjectSpan() { return (_blockSize & OBJECT_SPAN_WORD) ? true : false; }
+
+  // Since _blockSize is always a multiple of 8 in our allocator,
   // thus we are using the least significant bit to mark whether
   // an heap object is reachable or not.
   void markObjectChecked() { _blockSize |= OBJECT_CHECKED_WORD; }
@@ -0,0 +1,288 @@
+#if !defined(DOUBLETAKE_OUTPUTCOMMIT_H)
+#define DOUBLETAKE_OUTPUTCOMMIT_H
+
+/*
+ * @file   outputcommit.h
+ * @brief  Output to terminals, pipes and sockets, kept until the epoch commits.
+ *         Such output can not be taken back on rollback, so every write used to end
+ *         the epoch. Now each thread appends its writes to its own buffer on the
+ *         internal heap, and the buffers are released to the real fds, in the order
+ *         of the writes, only when the epoch ends without an error. A thread whose
+ *         buffer goes over OUTPUT_COMMIT_WATERMARK ends the epoch early.
+ *         Writes are reported as complete right away, so an error found when the
+ *         output is released can not be returned to the caller any more.
+ *         Output is released while all other threads are stopped, so it never waits
+ *         for an fd: one of those threads may be the reader. What would block is kept
+ *         as the tail, which the thread that ended the epoch writes once the threads run
+ *         again. Until the tail is out, later output stays in the buffers.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <new>
+
+#include "internalheap.hh"
+#include "log.hh"
+#include "real.hh"
+#include "xdefines.hh"
+
+class outputcommit {
+  // A deferred write, followed by its data, of which done bytes are released.
+  struct record {
+    unsigned long sequence;
+    int fd;
+    int flags;
+    size_t size;
+    size_t done;
+  };
+
+  struct buffer {
+    char* data;
+    size_t used;
+    size_t capacity;
+    // What the thread would have kept during a replay, whose output is out already.
+    size_t replayed;
+  };
+
+public:
+  // Flags of a record released with write() instead of send().
+  enum { WRITE = -1 };
+
+  outputcommit() : _sequence(0), _tailDone(0), _tailBusy(false) {
+    memset(_buffers, 0, sizeof(_buffers));
+    memset(&_tail, 0, sizeof(_tail));
+  }
+
+  static outputcommit& getInstance() {
+    static char buf[sizeof(outputcommit)];
+    static outputcommit* theOneTrueObject = new (buf) outputcommit();
+    return *theOneTrueObject;
+  }
+
+  void initialize() { pthread_atfork(NULL, NULL, forgetInChild); }
+
+  /// @return true if output to a file of this mode can not be taken back, so it is kept
+  /// until the epoch commits.
+  static inline bool isDeferred(mode_t mode) {
+    return S_ISFIFO(mode) || S_ISSOCK(mode) || S_ISCHR(mode);
+  }
+
+  /// @return true if a send() with these flags behaves the same when released later.
+  static inline bool isDeferredFlags(int flags) {
+    return (flags & ~(MSG_NOSIGNAL | MSG_MORE)) == 0;
+  }
+
+  /// Keep the count iovecs written to fd in the buffer of the current thread.
+  /// @return false if the output is too large to be kept.
+  bool add(int fd, int flags, const struct iovec* vector, int count) {
+    size_t size = getSize(vector, count);
+    if(size > xdefines::OUTPUT_COMMIT_WATERMARK) {
+      return false;
+    }
+
+    buffer* buf = &_buffers[getThreadIndex()];
+    size_t needed = sizeof(record) + alignup(size, sizeof(record));
+    if(buf->used + needed > buf->capacity) {
+      buf->data = InternalHeap::getInstance().grow(buf->data, buf->used, &buf->capacity,
+                                                   buf->used + needed);
+    }
+
+    record* entry = (record*)(buf->data + buf->used);
+    entry->sequence = __atomic_fetch_add(&_sequence, 1, __ATOMIC_RELAXED);
+    entry->fd = fd;
+    entry->flags = flags;
+    entry->size = size;
+    entry->done = 0;
+
+    char* data = (char*)(entry + 1);
+    for(int i = 0; i < count; i++) {
+      memcpy(data, vector[i].iov_base, vector[i].iov_len);
+      data += vector[i].iov_len;
+    }
+
+    buf->used += needed;
+    return true;
+  }
+
+  /// Count the output of a replay like add() keeps it, without keeping it: it was
+  /// released before the rollback. The replay then ends its epochs where the original
+  /// run did. @return false if the output is too large to be kept.
+  bool replay(const struct iovec* vector, int count) {
+    size_t size = getSize(vector, count);
+    if(size > xdefines::OUTPUT_COMMIT_WATERMARK) {
+      return false;
+    }
+    _buffers[getThreadIndex()].replayed += sizeof(record) + alignup(size, sizeof(record));
+    return true;
+  }
+
+  /// @return true if the current thread should end the epoch to release its output.
+  inline bool isOverWatermark() {
+    buffer* buf = &_buffers[getThreadIndex()];
+    return buf->used + buf->replayed >= xdefines::OUTPUT_COMMIT_WATERMARK;
+  }
+
+  /// Release the output of all threads in the order it was written. Only one thread is active.
+  void commit() {
+    size_t offsets[xdefines::MAX_ALIVE_THREADS];
+    memset(offsets, 0, sizeof(offsets));
+
+    // The tail of the last commit is not out yet, and goes first.
+    if(__atomic_load_n(&_tail.used, __ATOMIC_ACQUIRE) != 0) {
+      return;
+    }
+
+    bool blocked = false;
+
+    while(true) {
+      record* next = NULL;
+      int owner = -1;
+
+      for(int i = 0; i < xdefines::MAX_ALIVE_THREADS; i++) {
+        if(offsets[i] < _buffers[i].used) {
+          record* entry = (record*)(_buffers[i].data + offsets[i]);
+          if(next == NULL || entry->sequence < next->sequence) {
+            next = entry;
+            owner = i;
+          }
+        }
+      }
+
+      if(next == NULL) {
+        break;
+      }
+
+      // After the first write that would block, the rest goes to the tail in order.
+      if(!blocked) {
+        blocked = !release(next, false);
+      }
+      size_t size = sizeof(record) + alignup(next->size, sizeof(record));
+      if(blocked) {
+        addTail(next, size);
+      }
+      offsets[owner] += size;
+    }
+
+    for(int i = 0; i < xdefines::MAX_ALIVE_THREADS; i++) {
+      _buffers[i].used = 0;
+      _buffers[i].replayed = 0;
+    }
+  }
+
+  /// Write the tail of the last commit, waiting for the fds. Called when the other
+  /// threads run again, which may be reading them, or at exit.
+  void releaseTail() {
+    if(__atomic_load_n(&_tail.used, __ATOMIC_ACQUIRE) == 0 ||
+       __atomic_exchange_n(&_tailBusy, true, __ATOMIC_ACQUIRE)) {
+      return;
+    }
+
+    // A rollback may come back here, which goes on where the writes stopped.
+    while(_tailDone < _tail.used) {
+      record* entry = (record*)(_tail.data + _tailDone);
+      release(entry, true);
+      _tailDone += sizeof(record) + alignup(entry->size, sizeof(record));
+    }
+
+    _tailDone = 0;
+    __atomic_store_n(&_tail.used, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&_tailBusy, false, __ATOMIC_RELEASE);
+  }
+
+private:
+  static size_t getSize(const struct iovec* vector, int count) {
+    size_t size = 0;
+    for(int i = 0; i < count; i++) {
+      size += vector[i].iov_len;
+    }
+    return size;
+  }
+
+  // The output kept before a fork belongs to the parent, which releases it.
+  static void forgetInChild() {
+    for(int i = 0; i < xdefines::MAX_ALIVE_THREADS; i++) {
+      getInstance()._buffers[i].used = 0;
+      getInstance()._buffers[i].replayed = 0;
+    }
+    getInstance()._tail.used = 0;
+    getInstance()._tailDone = 0;
+    getInstance()._tailBusy = false;
+  }
+
+  // Keep the record entry of size bytes, with what is left of its data, in the tail.
+  void addTail(record* entry, size_t size) {
+    if(_tail.used + size > _tail.capacity) {
+      _tail.data = InternalHeap::getInstance().grow(_tail.data, _tail.used, &_tail.capacity,
+                                                    _tail.used + size);
+    }
+    memcpy(_tail.data + _tail.used, entry, size);
+    _tail.used += size;
+  }
+
+  // Write the data of entry that is not out yet. Unless wait is set, the writes do not
+  // block, even on a blocking fd.
+  // @return false if the rest of entry would block.
+  bool release(record* entry, bool wait) {
+    const char* data = (const char*)(entry + 1);
+    int flags = 0;
+
+    if(!wait && entry->flags == WRITE) {
+      flags = Real::fcntl(entry->fd, F_GETFL);
+      if(flags != -1 && !(flags & O_NONBLOCK)) {
+        Real::fcntl(entry->fd, F_SETFL, flags | O_NONBLOCK);
+      }
+    }
+
+    bool done = true;
+    while(entry->done < entry->size) {
+      ssize_t bytes;
+      size_t size = entry->size - entry->done;
+      if(entry->flags == WRITE) {
+        bytes = Real::write(entry->fd, data + entry->done, size);
+      } else {
+        bytes = Real::sendto(entry->fd, data + entry->done, size,
+                             entry->flags | (wait ? 0 : MSG_DONTWAIT), NULL, 0);
+      }
+
+      if(bytes > 0) {
+        entry->done += bytes;
+      } else if(bytes < 0 && errno == EINTR) {
+        continue;
+      } else if(bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if(!wait) {
+          done = false;
+          break;
+        }
+        struct pollfd pfd = { entry->fd, POLLOUT, 0 };
+        Real::poll(&pfd, 1, -1);
+      } else {
+        PRWRN("Lost %zu bytes of output to fd %d: %s", size, entry->fd, strerror(errno));
+        break;
+      }
+    }
+
+    if(!wait && entry->flags == WRITE && flags != -1 && !(flags & O_NONBLOCK)) {
+      Real::fcntl(entry->fd, F_SETFL, flags);
+    }
+    return done;
+  }
+
+  /// Orders the writes of all threads.
+  unsigned long _sequence;
+  buffer _buffers[xdefines::MAX_ALIVE_THREADS];
+
+  /// Output that would have blocked at the last commit, of which _tailDone bytes are out.
+  buffer _tail;
+  size_t _tailDone;
+  bool _tailBusy;
+};
+
+#endif
@@ -0,0 +1,301 @@
+#if !defined(DOUBLETAKE_PAGESTORE_H)
+#define DOUBLETAKE_PAGESTORE_H
+
+/*
+ * @file   pagestore.h
+ * @brief  Compressed checkpoint store, replacing the shadow copy kept by xmapping.
+ *         Every page of a region has a descriptor. All-zero pages need nothing else, a
+ *         page equal to another one stored in the same backup shares its data, and
+ *         other pages are compressed with lzpage (or kept raw if they do not compress)
+ *         into a data area that is only appended to. An incremental backup re-encodes
+ *         the pages written in the epoch and leaves the old data behind as garbage;
+ *         once the garbage outgrows the live data, the next backup encodes every page
+ *         from the start of the data area again and gives the tail back to the kernel.
+ *         Pages are only decompressed on the rare rollback path.
+ *         Selected at startup with DOUBLETAKE_CHECKPOINT=compress.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "log.hh"
+#include "lzpage.hh"
+#include "mm.hh"
+#include "real.hh"
+#include "softdirty.hh"
+#include "xdefines.hh"
+
+class pagestore {
+  // A descriptor holds the kind of page, whether its data is owned by another
+  // page, the offset of the data and its length.
+  enum { PAGE_ZERO = 0, PAGE_RAW = 1, PAGE_LZ = 2 };
+  static const uint64_t KIND_SHIFT = 62;
+  static const uint64_t SHARED_BIT = 1ULL << 61;
+  static const uint64_t OFFSET_SHIFT = 16;
+  static const uint64_t OFFSET_MASK = (1ULL << 45) - 1;
+  static const uint64_t LENGTH_MASK = (1ULL << 16) - 1;
+
+  // Pages of one backup are looked up by content hash to find duplicates.
+  enum { DEDUP_BITS = 16 };
+  enum { DEDUP_ENTRIES = 1 << DEDUP_BITS };
+
+  // Garbage allowed on top of the live data before encoding everything again.
+  enum { GARBAGE_SLACK = xdefines::USER_HEAP_CHUNK };
+
+  struct dedupEntry {
+    unsigned long generation;
+    uint64_t hash;
+    const char* page;
+    uint64_t descriptor;
+  };
+
+public:
+  pagestore()
+    : _start(NULL), _pages(0), _descriptors(NULL), _data(NULL), _capacity(0), _used(0),
+      _live(0), _highWater(0), _maxPages(0) {}
+
+  static bool isEnabled() {
+    static int enabled = -1;
+
+    if(enabled == -1) {
+      const char* backend = getenv("DOUBLETAKE_CHECKPOINT");
+      enabled = (backend != NULL && strcmp(backend, "compress") == 0);
+    }
+    return enabled;
+  }
+
+  void initialize(void* start, size_t size) {
+    _start = (char*)start;
+    _pages = size / xdefines::PageSize;
+    _descriptors = (uint64_t*)MM::mmapAllocatePrivate(
+        alignup(_pages * sizeof(uint64_t), xdefines::PageSize));
+
+    // Every page fits raw, so a full backup never runs out of space.
+    _capacity = size;
+    _data = (char*)MM::mmapAllocateLarge(size);
+
+    if(dedupTable() == NULL) {
+      dedupTable() = (dedupEntry*)MM::mmapAllocatePrivate(DEDUP_ENTRIES * sizeof(dedupEntry));
+    }
+  }
+
+  /// Store the first size bytes of the region. Unless full is set, only those
+  /// pages written since the soft-dirty bits were cleared are encoded again.
+  /// @return the bytes encoded.
+  size_t backup(size_t size, bool full) {
+    size_t pages = alignup(size, xdefines::PageSize) / xdefines::PageSize;
+    size_t stored = 0;
+
+    generation()++;
+    if(!full && softdirty::getInstance().isEnabled() &&
+       _used - _live <= _live + GARBAGE_SLACK &&
+       softdirty::getInstance().forEachDirtyRun(_start, size, [&](void* run, size_t len) {
+         stored += len;
+         return storePages(run, len);
+       })) {
+      updateMaxPages(pages);
+      return stored;
+    }
+
+    // Encode everything from the start of the data area again. Descriptors
+    // past size would point to overwritten data, so those pages become zero.
+    generation()++;
+    _used = 0;
+    _live = 0;
+    memset(_descriptors, 0, _maxPages * sizeof(uint64_t));
+    _maxPages = pages;
+
+    for(size_t i = 0; i < pages; i++) {
+      storePage(i, _start + i * xdefines::PageSize, true);
+    }
+
+    // Give the pages of the data area that are not used any more back to the kernel.
+    size_t inUse = alignup(_used, xdefines::PageSize);
+    if(_highWater > inUse) {
+      Real::madvise(_data + inUse, _highWater - inUse, MADV_DONTNEED);
+    }
+    _highWater = inUse;
+    return pages * xdefines::PageSize;
+  }
+
+  /// Recover the first size bytes of the region, the written pages only if possible.
+  void recover(size_t size) {
+    if(softdirty::getInstance().isEnabled() &&
+       softdirty::getInstance().forEachDirtyRun(_start, size, [this](void* run, size_t len) {
+         loadPages(run, len);
+         return true;
+       })) {
+      return;
+    }
+
+    loadPages(_start, size);
+  }
+
+  /// Update the stored bytes of [start, start + size) with their current content.
+  void commit(void* start, size_t size) {
+    char page[xdefines::PageSize];
+    uintptr_t end = (uintptr_t)start + size;
+
+    for(uintptr_t addr = (uintptr_t)start; addr < end;) {
+      size_t index = (addr - (uintptr_t)_start) / xdefines::PageSize;
+      uintptr_t pageEnd = (uintptr_t)_start + (index + 1) * xdefines::PageSize;
+      size_t len = (pageEnd < end ? pageEnd : end) - addr;
+
+      loadPage(index, page);
+      memcpy(page + (addr & xdefines::PAGE_SIZE_MASK), (void*)addr, len);
+      REQUIRE(storePage(index, page, false), "No space left in the checkpoint store");
+      addr += len;
+    }
+    updateMaxPages(alignup(end - (uintptr_t)_start, xdefines::PageSize) / xdefines::PageSize);
+  }
+
+private:
+  // The table is shared by all stores since backups happen one at a time.
+  static dedupEntry*& dedupTable() {
+    static dedupEntry* table = NULL;
+    return table;
+  }
+
+  // Entries from older backups are ignored.
+  static unsigned long& generation() {
+    static unsigned long current = 0;
+    return current;
+  }
+
+  void updateMaxPages(size_t pages) {
+    if(pages > _maxPages) {
+      _maxPages = pages;
+    }
+  }
+
+  bool storePages(void* start, size_t size) {
+    size_t first = ((intptr_t)start - (intptr_t)_start) / xdefines::PageSize;
+    size_t count = alignup(size, xdefines::PageSize) / xdefines::PageSize;
+
+    for(size_t i = first; i < first + count; i++) {
+      if(!storePage(i, _start + i * xdefines::PageSize, true)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void loadPages(void* start, size_t size) {
+    size_t first = ((intptr_t)start - (intptr_t)_start) / xdefines::PageSize;
+    size_t count = alignup(size, xdefines::PageSize) / xdefines::PageSize;
+
+    for(size_t i = first; i < first + count; i++) {
+      loadPage(i, _start + i * xdefines::PageSize);
+    }
+  }
+
+  // Encode page as the content of page index. Pages can only be shared with
+  // pages that stay unchanged until the end of this backup (dedup).
+  bool storePage(size_t index, const char* page, bool dedup) {
+    if(_used + xdefines::PageSize > _capacity) {
+      return false;
+    }
+
+    uint64_t old = _descriptors[index];
+    if(kind(old) != PAGE_ZERO && !(old & SHARED_BIT)) {
+      _live -= length(old);
+    }
+
+    uint64_t hash;
+    if(isZeroPage(page, &hash)) {
+      _descriptors[index] = PAGE_ZERO;
+      return true;
+    }
+
+    dedupEntry* entry = &dedupTable()[hash & (DEDUP_ENTRIES - 1)];
+    if(dedup && entry->generation == generation() && entry->hash == hash &&
+       memcmp(entry->page, page, xdefines::PageSize) == 0) {
+      _descriptors[index] = entry->descriptor | SHARED_BIT;
+      return true;
+    }
+
+    uint64_t type = PAGE_LZ;
+    size_t len = lzpage::compress(page, xdefines::PageSize, _data + _used, xdefines::PageSize - 1);
+    if(len == 0) {
+      type = PAGE_RAW;
+      len = xdefines::PageSize;
+      memcpy(_data + _used, page, len);
+    }
+
+    uint64_t descriptor = (type << KIND_SHIFT) | ((uint64_t)_used << OFFSET_SHIFT) | len;
+    _descriptors[index] = descriptor;
+    _used += len;
+    _live += len;
+    if(_used > _highWater) {
+      _highWater = _used;
+    }
+
+    if(dedup) {
+      entry->generation = generation();
+      entry->hash = hash;
+      entry->page = page;
+      entry->descriptor = descriptor;
+    }
+    return true;
+  }
+
+  void loadPage(size_t index, char* dest) {
+    uint64_t descriptor = _descriptors[index];
+    const char* data = _data + ((descriptor >> OFFSET_SHIFT) & OFFSET_MASK);
+
+    switch(kind(descriptor)) {
+    case PAGE_ZERO:
+      memset(dest, 0, xdefines::PageSize);
+      break;
+
+    case PAGE_RAW:
+      memcpy(dest, data, xdefines::PageSize);
+      break;
+
+    default:
+      REQUIRE(lzpage::decompress(data, length(descriptor), dest, xdefines::PageSize),
+              "Corrupted checkpoint page %p", dest);
+      break;
+    }
+  }
+
+  static inline uint64_t kind(uint64_t descriptor) { return descriptor >> KIND_SHIFT; }
+  static inline size_t length(uint64_t descriptor) { return descriptor & LENGTH_MASK; }
+
+  // Hash the page and check whether it is all zero in one pass.
+  static bool isZeroPage(const char* page, uint64_t* hash) {
+    const uint64_t* words = (const uint64_t*)page;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint64_t bits = 0;
+
+    for(size_t i = 0; i < xdefines::PageSize / sizeof(uint64_t); i++) {
+      bits |= words[i];
+      h = (h ^ words[i]) * 0x100000001b3ULL;
+    }
+
+    *hash = h ^ (h >> 29);
+    return bits == 0;
+  }
+
+  /// The region being stored.
+  char* _start;
+  size_t _pages;
+  uint64_t* _descriptors;
+
+  /// The data area, with _used bytes in use of which _live are still referenced.
+  char* _data;
+  size_t _capacity;
+  size_t _used;
+  size_t _live;
+
+  /// Bytes of the data area touched since it was last given back.
+  size_t _highWater;
+
+  /// Pages that may have a non-zero descriptor.
+  size_t _maxPages;
+};
+
+#endif
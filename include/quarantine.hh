@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "copykernels.hh"
 #include "watchpoint.hh"
 #include "xdefines.hh"
 
@@ -86,7 +87,7 @@ public:
     _LRIndexBackup = _LRIndex;
     _totalSizeBackup = _totalSize;
 
-    memcpy(_objectsBackup, _objects, _objectsSize);
+    copykernels::backup(_objectsBackup, _objects, _objectsSize);
   }
 
   void restore() {
@@ -94,7 +95,16 @@ public:
     _LRIndex = _LRIndexBackup;
     _totalSize = _totalSizeBackup;
 
-    memcpy(_objects, _objectsBackup, _objectsSize);
+    copykernels::restore(_objects, _objectsBackup, _objectsSize);
+  }
+
+  /// The bytes copied by backup() or restore().
+  inline size_t getBackupSize() const { return _objectsSize; }
+
+  /// The list and its backup, which follows it.
+  void getBuffers(void** start, size_t* size) {
+    *start = _objects;
+    *size = _objectsSize * 2;
   }
 
   // We will check whether an object is added into free list or not.
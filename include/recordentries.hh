@@ -69,6 +69,24 @@ public:
     return entry;
   }
 
+  // Allocate count consecutive entries.
+  Entry* alloc(size_t count) {
+    Entry* entry = NULL;
+    if(count <= _total - _cur) {
+      entry = (Entry*)&_start[_cur];
+      _cur += count;
+    } else {
+      PRWRN("Not enough entries for %zu, now _cur %zu, _total %zu!!!\n", count, _cur, _total);
+      ::abort();
+    }
+    return entry;
+  }
+
+  size_t getFreeEntries() { return _total - _cur; }
+
+  // @return true once percent of the entries are in use.
+  inline bool isAbove(size_t percent) { return _cur * 100 >= _total * percent; }
+
   void cleanup() {
     _iter = 0;
     _cur = 0;
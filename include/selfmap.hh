@@ -63,6 +63,8 @@ public:
 
   bool isStack() const { return _file == "[stack]"; }
 
+  bool isWritable() const { return _writable; }
+
   bool isGlobals(std::string mainfile) const {
     // global mappings are RW_P, and either the heap, or the mapping is backed
     // by a file (and all files have absolute paths)
@@ -157,6 +159,7 @@ public:
   void printCallStack();
   void printCallStack(int depth, void** array);
   static int getCallStack(void** array);
+  static int getCallStack(void** array, int frames);
 
   void getStackInformation(void** stackBottom, void** stackTop) {
     for(const auto& entry : _mappings) {
@@ -207,6 +210,30 @@ public:
     *regionNumb = index;
   }
 
+  /// Collect the data of libdoubletake itself, with the anonymous mapping of its bss.
+  void getDoubleTakeRegions(regioninfo* regions, int* regionNumb) {
+    size_t index = 0;
+    uintptr_t dataEnd = 0;
+
+    for(const auto& entry : _mappings) {
+      const mapping& m = entry.second;
+
+      if(!m.isWritable() || m.isStack()) {
+        continue;
+      }
+
+      if(m.getFile().find("libdoubletake") != std::string::npos ||
+         (m.getFile().empty() && m.getBase() == dataEnd)) {
+        regions[index].start = (void*)m.getBase();
+        regions[index].end = (void*)m.getLimit();
+        index++;
+        dataEnd = m.getFile().empty() ? 0 : m.getLimit();
+      }
+    }
+
+    *regionNumb = index;
+  }
+
 private:
   selfmap() {
     // Read the name of the main executable
@@ -66,7 +66,7 @@ public:
     // PRINT("**************Sentinelmap INITIALIZATION: elements %lx size %lx. Totalbytes %lx\n",
     // _elements, size, _totalBytes);
     // Now we allocate specific size of shared memory
-    void* buf = MM::mmapAllocatePrivate(_totalBytes);
+    void* buf = MM::mmapAllocateLarge(_totalBytes);
     _bitmap.initialize(buf, _elements, _elements / sizeof(unsigned long));
 
     // PRINF("bitmap start at buf %p\n", buf);
@@ -0,0 +1,219 @@
+#if !defined(DOUBLETAKE_SNAPSHOT_H)
+#define DOUBLETAKE_SNAPSHOT_H
+
+/*
+ * @file   snapshot.h
+ * @brief  Copy-on-write checkpoint backend.
+ *         Instead of copying the heap and globals into the backup memory of xmapping,
+ *         every epochBegin clones a frozen snapshot process. The kernel then keeps the
+ *         pre-epoch image of every page written in the epoch, so the cost of a checkpoint
+ *         is proportional to the pages written instead of the heap size. On rollback, the
+ *         written pages (all pages if soft-dirty tracking is not available) are pulled
+ *         back from the snapshot with process_vm_readv. A snapshot closes all files but
+ *         its pipe to the parent, and a forked child of the application has none.
+ *         The backend is selected at startup with DOUBLETAKE_CHECKPOINT=fork; the default
+ *         (or DOUBLETAKE_CHECKPOINT=copy) keeps the memcpy backend.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "log.hh"
+#include "mm.hh"
+#include "real.hh"
+#include "softdirty.hh"
+#include "xdefines.hh"
+
+class snapshot {
+public:
+  snapshot() : _enabled(false), _pid(-1), _pipeFd(-1) {}
+
+  static snapshot& getInstance() {
+    static char buf[sizeof(snapshot)];
+    static snapshot* theOneTrueObject = new (buf) snapshot();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+    const char* backend = getenv("DOUBLETAKE_CHECKPOINT");
+    if(backend == NULL || strcmp(backend, "fork") != 0) {
+      return;
+    }
+
+    _enabled = probe();
+    if(_enabled) {
+      PRINF("Using copy-on-write snapshot processes for checkpoints");
+      pthread_atfork(NULL, NULL, forgetInChild);
+    } else {
+      PRWRN("Snapshot processes can not be read (%s), using memcpy checkpoints",
+            strerror(errno));
+    }
+  }
+
+  void finalize() { release(); }
+
+  /// @return true if the current epoch is checkpointed by a snapshot process.
+  inline bool isActive() const { return _pid > 0; }
+
+  /// Replace the snapshot of the last epoch by a new one. All other threads are stopped.
+  void take() {
+    if(!_enabled) {
+      return;
+    }
+
+    release();
+    if(!spawn()) {
+      // xmapping falls back to memcpy for this epoch.
+      PRWRN("Failed to clone a snapshot process (%s)", strerror(errno));
+    }
+  }
+
+  /// Recover [start, start + size) from the snapshot.
+  void restore(void* start, size_t size) {
+    bool restored;
+
+    if(softdirty::getInstance().isEnabled()) {
+      restored = softdirty::getInstance().forEachDirtyRun(
+          start, size, [this](void* run, size_t len) { return readRange(run, len); });
+    } else {
+      restored = false;
+    }
+
+    if(!restored) {
+      REQUIRE(readRange(start, size), "Failed to recover memory from snapshot %d: %s", _pid,
+              strerror(errno));
+    }
+  }
+
+private:
+  // The snapshot belongs to the parent: a child of the application must neither kill it
+  // nor keep its pipe open. fork() is not interposed, so the child learns it here.
+  static void forgetInChild() {
+    snapshot& self = getInstance();
+    if(self._pid > 0) {
+      Real::close(self._pipeFd);
+      self._pid = -1;
+      self._pipeFd = -1;
+    }
+  }
+
+  // A clone without an exit signal: the application can not reap it by
+  // wait() or waitpid(-1), and it never sees a SIGCHLD for it.
+  bool spawn() {
+    struct rlimit limit;
+    int fds[2];
+
+    if(pipe2(fds, O_CLOEXEC) != 0) {
+      return false;
+    }
+
+    // Known before the clone, which may only make raw system calls.
+    long maxFd = 65536;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+      maxFd = limit.rlim_cur;
+    }
+
+    pid_t pid = (pid_t)syscall(SYS_clone, 0UL, NULL, NULL, NULL, NULL);
+    if(pid == 0) {
+      // Only raw system calls here since this copy of libc believes it is the parent.
+      char c;
+      closeAllBut(fds[0], maxFd);
+      // Wait until the parent releases this snapshot or exits.
+      while(syscall(SYS_read, fds[0], &c, 1) < 0 && errno == EINTR)
+        ;
+      syscall(SYS_exit_group, 0);
+    }
+
+    Real::close(fds[0]);
+    if(pid < 0) {
+      Real::close(fds[1]);
+      return false;
+    }
+
+    _pid = pid;
+    _pipeFd = fds[1];
+    return true;
+  }
+
+  // Close every file of a snapshot but keep. Its copy of the file table would otherwise
+  // hold the files of the application open, such as the write end of a pipe whose reader
+  // waits for the end of the file.
+  static void closeAllBut(int keep, long maxFd) {
+#if defined(SYS_close_range)
+    if((keep == 0 || syscall(SYS_close_range, 0U, (unsigned)keep - 1, 0U) == 0) &&
+       syscall(SYS_close_range, (unsigned)keep + 1, ~0U, 0U) == 0) {
+      return;
+    }
+#endif
+    for(long fd = 0; fd < maxFd; fd++) {
+      if(fd != keep) {
+        syscall(SYS_close, fd);
+      }
+    }
+  }
+
+  void release() {
+    if(_pid > 0) {
+      Real::close(_pipeFd);
+      kill(_pid, SIGKILL);
+      while(waitpid(_pid, NULL, __WALL) < 0 && errno == EINTR)
+        ;
+      _pid = -1;
+      _pipeFd = -1;
+    }
+  }
+
+  bool readRange(void* start, size_t size) {
+    char* addr = (char*)start;
+
+    while(size > 0) {
+      struct iovec local = { addr, size };
+      struct iovec remote = { addr, size };
+
+      ssize_t bytes = process_vm_readv(_pid, &local, 1, &remote, 1, 0);
+      if(bytes <= 0) {
+        return false;
+      }
+
+      addr += bytes;
+      size -= bytes;
+    }
+
+    return true;
+  }
+
+  // Check that the snapshot can be read back, e.g. ptrace restrictions allow it.
+  bool probe() {
+    char* page = (char*)MM::mmapAllocatePrivate(xdefines::PageSize);
+    bool works = false;
+
+    page[0] = 1;
+    if(spawn()) {
+      page[0] = 2;
+      works = readRange(page, xdefines::PageSize) && page[0] == 1;
+      release();
+    }
+
+    MM::mmapDeallocate(page, xdefines::PageSize);
+    return works;
+  }
+
+  bool _enabled;
+  pid_t _pid;
+  int _pipeFd;
+};
+
+#endif
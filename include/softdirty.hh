@@ -0,0 +1,187 @@
+#if !defined(DOUBLETAKE_SOFTDIRTY_H)
+#define DOUBLETAKE_SOFTDIRTY_H
+
+/*
+ * @file   softdirty.h
+ * @brief  Track pages written since the last epoch with the kernel's soft-dirty bits.
+ *         Writing "4" to /proc/self/clear_refs clears the soft-dirty bit of every page
+ *         in the process, and bit 55 of each /proc/self/pagemap entry tells whether a
+ *         page has been written since then. The checkpoint code uses this to back up
+ *         and recover only those pages touched in the current epoch instead of copying
+ *         the whole heap and all globals.
+ *         If the kernel is built without CONFIG_MEM_SOFT_DIRTY or the proc files are
+ *         not accessible, tracking stays disabled and callers do a full copy.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "copykernels.hh"
+#include "copyworkers.hh"
+#include "log.hh"
+#include "mm.hh"
+#include "real.hh"
+#include "xdefines.hh"
+
+class softdirty {
+  // Bit 55 of a pagemap entry is the soft-dirty bit.
+  static const uint64_t PAGEMAP_SOFT_DIRTY = 1ULL << 55;
+
+  // How many pagemap entries are read with one pread.
+  enum { PAGEMAP_BATCH = 512 };
+
+public:
+  softdirty() : _enabled(false), _pagemapFd(-1), _clearRefsFd(-1) {}
+
+  static softdirty& getInstance() {
+    static char buf[sizeof(softdirty)];
+    static softdirty* theOneTrueObject = new (buf) softdirty();
+    return *theOneTrueObject;
+  }
+
+  /// Open the proc files and check that the kernel really maintains soft-dirty bits.
+  void initialize() {
+    _pagemapFd = Real::open("/proc/self/pagemap", O_RDONLY);
+    _clearRefsFd = Real::open("/proc/self/clear_refs", O_WRONLY);
+
+    if(_pagemapFd == -1 || _clearRefsFd == -1 || !probe()) {
+      PRINF("soft-dirty tracking is not available, using full checkpoints");
+      closeFiles();
+      return;
+    }
+
+    _enabled = true;
+    PRINF("soft-dirty tracking is enabled, using incremental checkpoints");
+  }
+
+  void finalize() {
+    closeFiles();
+    _enabled = false;
+  }
+
+  inline bool isEnabled() const { return _enabled; }
+
+  /// Start a new tracking window. Called once per epoch, after every region is backed up.
+  inline void clearRefs() {
+    if(_enabled && !writeClearRefs()) {
+      // We can not trust the bits from now on.
+      PRWRN("Failed to clear soft-dirty bits (%s), using full checkpoints", strerror(errno));
+      finalize();
+    }
+  }
+
+  /// Copy those pages of [start, start + size) written in the current window
+  /// from src to dest with the given kernel. One of src and dest is start itself.
+  /// The bytes copied are added to copied, if given.
+  /// @return false if the pagemap could not be read; nothing is copied then.
+  bool copyDirtyPages(void* start, size_t size, char* dest, const char* src,
+                      copykernels::copyFunc kernel, size_t* copied = NULL) {
+    return forEachDirtyRun(start, size, [&](void* run, size_t len) {
+      size_t offset = (intptr_t)run - (intptr_t)start;
+      copyworkers::getInstance().copy(dest + offset, src + offset, len, kernel);
+      if(copied != NULL) {
+        *copied += len;
+      }
+      return true;
+    });
+  }
+
+  /// Call fn(runStart, runSize) on every run of contiguous pages inside
+  /// [start, start + size) that were written in the current window.
+  /// @return false if the pagemap could not be read or fn failed.
+  template <typename Func> bool forEachDirtyRun(void* start, size_t size, Func fn) {
+    uintptr_t begin = aligndown((uintptr_t)start, xdefines::PageSize);
+    uintptr_t end = alignup((uintptr_t)start + size, xdefines::PageSize);
+    uint64_t entries[PAGEMAP_BATCH];
+
+    // A run of contiguous dirty pages is handled with one call.
+    uintptr_t runStart = 0;
+
+    for(uintptr_t page = begin; page < end;) {
+      size_t pages = (end - page) / xdefines::PageSize;
+      if(pages > PAGEMAP_BATCH) {
+        pages = PAGEMAP_BATCH;
+      }
+
+      if(!readPagemap(page, entries, pages)) {
+        return false;
+      }
+
+      for(size_t i = 0; i < pages; i++, page += xdefines::PageSize) {
+        if(entries[i] & PAGEMAP_SOFT_DIRTY) {
+          if(runStart == 0) {
+            runStart = page;
+          }
+        } else if(runStart != 0) {
+          if(!callRun(runStart, page, start, fn)) {
+            return false;
+          }
+          runStart = 0;
+        }
+      }
+    }
+
+    return runStart == 0 || callRun(runStart, end, start, fn);
+  }
+
+private:
+  // Clip [runStart, runEnd) to the caller's range before handing it over.
+  template <typename Func>
+  static bool callRun(uintptr_t runStart, uintptr_t runEnd, void* start, Func& fn) {
+    if(runStart < (uintptr_t)start) {
+      runStart = (uintptr_t)start;
+    }
+
+    return fn((void*)runStart, runEnd - runStart);
+  }
+
+  bool writeClearRefs() { return Real::write(_clearRefsFd, "4", 1) == 1; }
+
+  bool readPagemap(uintptr_t page, uint64_t* entries, size_t pages) {
+    off_t offset = (off_t)(page / xdefines::PageSize * sizeof(uint64_t));
+    ssize_t bytes = pages * sizeof(uint64_t);
+
+    return Real::pread(_pagemapFd, entries, bytes, offset) == bytes;
+  }
+
+  // Some kernels accept the clear_refs write but never set bit 55, so make sure
+  // the bit actually follows a write to a private page.
+  bool probe() {
+    volatile char* page = (volatile char*)MM::mmapAllocatePrivate(xdefines::PageSize);
+    uint64_t entry;
+    bool works = false;
+
+    page[0] = 1;
+    if(writeClearRefs() && readPagemap((uintptr_t)page, &entry, 1) &&
+       !(entry & PAGEMAP_SOFT_DIRTY)) {
+      page[0] = 2;
+      works = readPagemap((uintptr_t)page, &entry, 1) && (entry & PAGEMAP_SOFT_DIRTY);
+    }
+
+    MM::mmapDeallocate((void*)page, xdefines::PageSize);
+    return works;
+  }
+
+  void closeFiles() {
+    if(_pagemapFd != -1) {
+      Real::close(_pagemapFd);
+      _pagemapFd = -1;
+    }
+    if(_clearRefsFd != -1) {
+      Real::close(_clearRefsFd);
+      _clearRefsFd = -1;
+    }
+  }
+
+  bool _enabled;
+  int _pagemapFd;
+  int _clearRefsFd;
+};
+
+#endif
@@ -7,7 +7,6 @@
  * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
  */
 
-#include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,14 +31,11 @@ public:
     ptr = MM::mmapAllocatePrivate(size + metasize, (void*)startaddr);
     base = (char*)ptr;
 
-    Real::pthread_mutex_init(&_mutex, NULL);
-
     // Initialize the following content according the values of xpersist class.
     base = (char*)((intptr_t)ptr + metasize);
     _start = base;
     _end = base + size;
     _position = (char*)_start;
-    _remaining = size;
     _magic = 0xCAFEBABE;
     return ptr;
   }
@@ -54,23 +50,16 @@ public:
     // Round up the size to page aligned.
     sz = xdefines::PageSize * ((sz + xdefines::PageSize - 1) / xdefines::PageSize);
 
-    lock();
+    // Increment the bump pointer. Threads only race on it, so an atomic add is enough;
+    // the pointer may go past the end since running out of memory exits anyway.
+    char* p = __atomic_fetch_add(&_position, sz, __ATOMIC_RELAXED);
 
-    if(_remaining < sz) {
-      fprintf(stderr, "Out of memory error: available = %zx, requested = %zx, thread = %d.\n",
-              _remaining, sz, (int)pthread_self());
-			unlock();
+    if(p > (char*)_end || (size_t)((char*)_end - p) < sz) {
+      fprintf(stderr, "Out of memory error: position = %p, end = %p, requested = %zx.\n",
+              (void*)p, (void*)_end, sz);
       exit(-1);
     }
 
-    void* p = _position;
-
-    // Increment the bump pointer and drop the amount of memory.
-    _remaining -= sz;
-    _position += sz;
-
-    unlock();
-
     // fprintf (stderr, "%d : shareheapmalloc %p with size %x, remaining %x\n", getpid(), p, sz,
     // *_remaining);
     return p;
@@ -83,7 +72,7 @@ public:
 
   inline void* getHeapEnd() { return (void*)_end; }
 
-  inline void* getHeapPosition() { return (void*)_position; }
+  inline void* getHeapPosition() { return (void*)__atomic_load_n(&_position, __ATOMIC_RELAXED); }
 
   // These should never be used.
   inline void free(void*) { sanityCheck(); abort(); }
@@ -94,10 +83,6 @@ public:
   } // FIXME
 
 private:
-  void lock() { Real::pthread_mutex_lock(&_mutex); }
-
-  void unlock() { Real::pthread_mutex_unlock(&_mutex); }
-
   void sanityCheck() {
     if(_magic != 0xCAFEBABE) {
       fprintf(stderr, "%d : WTF!\n", getpid());
@@ -111,16 +96,10 @@ private:
   /// The end of the heap area.
   volatile char* _end;
 
-  /// Pointer to the current bump pointer.
+  /// Pointer to the current bump pointer, moved atomically.
   char* _position;
 
-  /// Pointer to the amount of memory remaining.
-  size_t _remaining;
-
   size_t _magic;
-
-  // We will use a lock to protect the allocation request from different threads.
-  pthread_mutex_t _mutex;
 };
 
 #endif
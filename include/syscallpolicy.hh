@@ -0,0 +1,365 @@
+#if !defined(DOUBLETAKE_SYSCALLPOLICY_H)
+#define DOUBLETAKE_SYSCALLPOLICY_H
+
+/*
+ * @file   syscallpolicy.h
+ * @brief  How each system call is handled during an epoch.
+ *         REVOCABLE calls run inside the epoch; their effects are undone on rollback
+ *         where DoubleTake knows how (e.g. the undo log of file writes).
+ *         RECORD calls run inside the epoch, and the replay gets their results from
+ *         the syscall record.
+ *         BUFFER calls keep their output until the epoch commits.
+ *         IRREVOCABLE calls end the epoch before they run.
+ *         The defaults are in SYSCALL_POLICY_TABLE. DOUBLETAKE_SYSCALL_POLICY overrides
+ *         them at startup, e.g. "clock_gettime=irrevocable,getppid=revocable" ("all"
+ *         names every call). A call whose wrapper can not follow its policy, e.g. a
+ *         record without knowing what memory the call fills, ends the epoch instead.
+ *         With DOUBLETAKE_SYSCALL_STATS set, the calls made under each policy are
+ *         counted and dumped at exit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include "log.hh"
+#include "xdefines.hh"
+
+// X(name, default policy) for every system call wrapper following a policy.
+#define SYSCALL_POLICY_TABLE(X) \
+  X(read, RECORD)                        \
+  X(write, BUFFER)                       \
+  X(stat, RECORD)                        \
+  X(fstat, RECORD)                       \
+  X(lstat, RECORD)                       \
+  X(poll, IRREVOCABLE)                   \
+  X(mprotect, IRREVOCABLE)               \
+  X(brk, IRREVOCABLE)                    \
+  X(sigaction, IRREVOCABLE)              \
+  X(sigprocmask, IRREVOCABLE)            \
+  X(sigreturn, IRREVOCABLE)              \
+  X(pwrite, REVOCABLE)                   \
+  X(readv, RECORD)                       \
+  X(writev, BUFFER)                      \
+  X(access, RECORD)                      \
+  X(pipe, IRREVOCABLE)                   \
+  X(select, IRREVOCABLE)                 \
+  X(mremap, IRREVOCABLE)                 \
+  X(msync, IRREVOCABLE)                  \
+  X(mincore, IRREVOCABLE)                \
+  X(madvise, IRREVOCABLE)                \
+  X(shmget, IRREVOCABLE)                 \
+  X(shmat, IRREVOCABLE)                  \
+  X(shmctl, IRREVOCABLE)                 \
+  X(pause, IRREVOCABLE)                  \
+  X(nanosleep, RECORD)                   \
+  X(getitimer, IRREVOCABLE)              \
+  X(alarm, IRREVOCABLE)                  \
+  X(sendfile, IRREVOCABLE)               \
+  X(socket, IRREVOCABLE)                 \
+  X(connect, IRREVOCABLE)                \
+  X(sendto, BUFFER)                      \
+  X(recvfrom, RECORD)                    \
+  X(sendmsg, BUFFER)                     \
+  X(recvmsg, RECORD)                     \
+  X(bind, IRREVOCABLE)                   \
+  X(listen, IRREVOCABLE)                 \
+  X(setsockopt, IRREVOCABLE)             \
+  X(execve, IRREVOCABLE)                 \
+  X(wait4, IRREVOCABLE)                  \
+  X(kill, IRREVOCABLE)                   \
+  X(uname, RECORD)                       \
+  X(semget, IRREVOCABLE)                 \
+  X(semop, IRREVOCABLE)                  \
+  X(semctl, IRREVOCABLE)                 \
+  X(flock, IRREVOCABLE)                  \
+  X(fsync, IRREVOCABLE)                  \
+  X(fdatasync, IRREVOCABLE)              \
+  X(truncate, IRREVOCABLE)               \
+  X(ftruncate, REVOCABLE)                \
+  X(getcwd, RECORD)                      \
+  X(chdir, IRREVOCABLE)                  \
+  X(fchdir, IRREVOCABLE)                 \
+  X(rename, IRREVOCABLE)                 \
+  X(mkdir, IRREVOCABLE)                  \
+  X(rmdir, IRREVOCABLE)                  \
+  X(creat, IRREVOCABLE)                  \
+  X(link, IRREVOCABLE)                   \
+  X(unlink, IRREVOCABLE)                 \
+  X(symlink, IRREVOCABLE)                \
+  X(chmod, IRREVOCABLE)                  \
+  X(fchmod, IRREVOCABLE)                 \
+  X(chown, IRREVOCABLE)                  \
+  X(fchown, IRREVOCABLE)                 \
+  X(lchown, IRREVOCABLE)                 \
+  X(umask, IRREVOCABLE)                  \
+  X(getrlimit, RECORD)                   \
+  X(getrusage, RECORD)                   \
+  X(sysinfo, RECORD)                     \
+  X(getuid, REVOCABLE)                   \
+  X(getgid, REVOCABLE)                   \
+  X(setuid, IRREVOCABLE)                 \
+  X(setgid, IRREVOCABLE)                 \
+  X(geteuid, REVOCABLE)                  \
+  X(getegid, REVOCABLE)                  \
+  X(setpgid, IRREVOCABLE)                \
+  X(getppid, RECORD)                     \
+  X(getpgrp, REVOCABLE)                  \
+  X(setsid, IRREVOCABLE)                 \
+  X(setreuid, IRREVOCABLE)               \
+  X(setregid, IRREVOCABLE)               \
+  X(setgroups, IRREVOCABLE)              \
+  X(setresuid, IRREVOCABLE)              \
+  X(getresuid, IRREVOCABLE)              \
+  X(setresgid, IRREVOCABLE)              \
+  X(getresgid, IRREVOCABLE)              \
+  X(getpgid, RECORD)                     \
+  X(setfsuid, IRREVOCABLE)               \
+  X(setfsgid, IRREVOCABLE)               \
+  X(getsid, RECORD)                      \
+  X(sigpending, IRREVOCABLE)             \
+  X(sigtimedwait, IRREVOCABLE)           \
+  X(sigsuspend, IRREVOCABLE)             \
+  X(sigaltstack, IRREVOCABLE)            \
+  X(utime, IRREVOCABLE)                  \
+  X(mknod, IRREVOCABLE)                  \
+  X(personality, IRREVOCABLE)            \
+  X(ustat, IRREVOCABLE)                  \
+  X(statfs, RECORD)                      \
+  X(fstatfs, RECORD)                     \
+  X(getpriority, IRREVOCABLE)            \
+  X(setpriority, IRREVOCABLE)            \
+  X(sched_setparam, IRREVOCABLE)         \
+  X(sched_getparam, IRREVOCABLE)         \
+  X(sched_setscheduler, IRREVOCABLE)     \
+  X(sched_getscheduler, IRREVOCABLE)     \
+  X(sched_get_priority_max, IRREVOCABLE) \
+  X(sched_get_priority_min, IRREVOCABLE) \
+  X(sched_rr_get_interval, IRREVOCABLE)  \
+  X(mlock, IRREVOCABLE)                  \
+  X(munlock, IRREVOCABLE)                \
+  X(mlockall, IRREVOCABLE)               \
+  X(munlockall, IRREVOCABLE)             \
+  X(vhangup, IRREVOCABLE)                \
+  X(sysctl, IRREVOCABLE)                 \
+  X(prctl, IRREVOCABLE)                  \
+  X(setrlimit, IRREVOCABLE)              \
+  X(chroot, IRREVOCABLE)                 \
+  X(acct, IRREVOCABLE)                   \
+  X(settimeofday, IRREVOCABLE)           \
+  X(mount, IRREVOCABLE)                  \
+  X(umount2, IRREVOCABLE)                \
+  X(swapon, IRREVOCABLE)                 \
+  X(swapoff, IRREVOCABLE)                \
+  X(reboot, IRREVOCABLE)                 \
+  X(sethostname, IRREVOCABLE)            \
+  X(setdomainname, IRREVOCABLE)          \
+  X(iopl, IRREVOCABLE)                   \
+  X(ioperm, IRREVOCABLE)                 \
+  X(setxattr, IRREVOCABLE)               \
+  X(lsetxattr, IRREVOCABLE)              \
+  X(fsetxattr, IRREVOCABLE)              \
+  X(getxattr, IRREVOCABLE)               \
+  X(lgetxattr, IRREVOCABLE)              \
+  X(fgetxattr, IRREVOCABLE)              \
+  X(listxattr, IRREVOCABLE)              \
+  X(llistxattr, IRREVOCABLE)             \
+  X(flistxattr, IRREVOCABLE)             \
+  X(removexattr, IRREVOCABLE)            \
+  X(lremovexattr, IRREVOCABLE)           \
+  X(fremovexattr, IRREVOCABLE)           \
+  X(sched_setaffinity, IRREVOCABLE)      \
+  X(sched_getaffinity, IRREVOCABLE)      \
+  X(epoll_create, IRREVOCABLE)           \
+  X(epoll_ctl, IRREVOCABLE)              \
+  X(epoll_wait, IRREVOCABLE)             \
+  X(remap_file_pages, IRREVOCABLE)       \
+  X(semtimedop, IRREVOCABLE)             \
+  X(posix_fadvise64, IRREVOCABLE)        \
+  X(timer_create, IRREVOCABLE)           \
+  X(timer_settime, IRREVOCABLE)          \
+  X(timer_gettime, IRREVOCABLE)          \
+  X(timer_getoverrun, IRREVOCABLE)       \
+  X(timer_delete, IRREVOCABLE)           \
+  X(clock_settime, IRREVOCABLE)          \
+  X(clock_gettime, RECORD)               \
+  X(clock_getres, RECORD)                \
+  X(clock_nanosleep, IRREVOCABLE)        \
+  X(utimes, IRREVOCABLE)                 \
+  X(mq_open, IRREVOCABLE)                \
+  X(mq_unlink, IRREVOCABLE)              \
+  X(mq_timedsend, IRREVOCABLE)           \
+  X(mq_timedreceive, IRREVOCABLE)        \
+  X(mq_notify, IRREVOCABLE)              \
+  X(waitid, IRREVOCABLE)                 \
+  X(inotify_init, IRREVOCABLE)           \
+  X(inotify_add_watch, IRREVOCABLE)      \
+  X(inotify_rm_watch, IRREVOCABLE)       \
+  X(openat, IRREVOCABLE)                 \
+  X(mkdirat, IRREVOCABLE)                \
+  X(mknodat, IRREVOCABLE)                \
+  X(fchownat, IRREVOCABLE)               \
+  X(futimesat, IRREVOCABLE)              \
+  X(unlinkat, IRREVOCABLE)               \
+  X(renameat, IRREVOCABLE)               \
+  X(linkat, IRREVOCABLE)                 \
+  X(symlinkat, IRREVOCABLE)              \
+  X(readlinkat, IRREVOCABLE)             \
+  X(fchmodat, IRREVOCABLE)               \
+  X(faccessat, IRREVOCABLE)              \
+  X(pselect, IRREVOCABLE)                \
+  X(ppoll, IRREVOCABLE)                  \
+  X(unshare, IRREVOCABLE)                \
+  X(splice, IRREVOCABLE)                 \
+  X(tee, IRREVOCABLE)                    \
+  X(sync_file_range, IRREVOCABLE)        \
+  X(vmsplice, IRREVOCABLE)
+
+typedef enum e_syscall {
+#define SYSCALL_POLICY_ID(name, policy) SC_##name,
+  SYSCALL_POLICY_TABLE(SYSCALL_POLICY_ID)
+#undef SYSCALL_POLICY_ID
+  SC_MAX
+} eSyscall;
+
+class syscallpolicy {
+public:
+  enum ePolicy { REVOCABLE = 0, RECORD, BUFFER, IRREVOCABLE, NUM_POLICIES };
+
+  syscallpolicy() : _stats(false) {
+    int i = 0;
+#define SYSCALL_POLICY_DEFAULT(name, policy) _policies[i++] = policy;
+    SYSCALL_POLICY_TABLE(SYSCALL_POLICY_DEFAULT)
+#undef SYSCALL_POLICY_DEFAULT
+    memset(_counts, 0, sizeof(_counts));
+  }
+
+  static syscallpolicy& getInstance() {
+    static char buf[sizeof(syscallpolicy)];
+    static syscallpolicy* theOneTrueObject = new (buf) syscallpolicy();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+    const char* overrides = getenv("DOUBLETAKE_SYSCALL_POLICY");
+    if(overrides != NULL) {
+      parse(overrides);
+    }
+    _stats = getenv("DOUBLETAKE_SYSCALL_STATS") != NULL;
+  }
+
+  inline ePolicy lookup(eSyscall sc) const { return _policies[sc]; }
+
+  /// Count a call of sc that was handled under policy.
+  inline void count(eSyscall sc, ePolicy policy) {
+    if(_stats) {
+      __atomic_add_fetch(&_counts[sc][policy], 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  /// Print the calls made under each policy, then those of every call that was made.
+  void dump() {
+    unsigned long totals[NUM_POLICIES];
+
+    if(!_stats) {
+      return;
+    }
+
+    memset(totals, 0, sizeof(totals));
+    for(int sc = 0; sc < SC_MAX; sc++) {
+      for(int policy = 0; policy < NUM_POLICIES; policy++) {
+        totals[policy] += _counts[sc][policy];
+      }
+    }
+
+    fprintf(stderr, "DoubleTake syscall policies:");
+    for(int policy = 0; policy < NUM_POLICIES; policy++) {
+      fprintf(stderr, " %s %lu", policyName(policy), totals[policy]);
+    }
+    fprintf(stderr, "\n");
+
+    for(int sc = 0; sc < SC_MAX; sc++) {
+      unsigned long* counts = _counts[sc];
+      if(counts[REVOCABLE] + counts[RECORD] + counts[BUFFER] + counts[IRREVOCABLE] == 0) {
+        continue;
+      }
+      fprintf(stderr, "  %-24s %-12s revocable %lu record %lu buffer %lu irrevocable %lu\n",
+              syscallName(sc), policyName(_policies[sc]), counts[REVOCABLE], counts[RECORD],
+              counts[BUFFER], counts[IRREVOCABLE]);
+    }
+  }
+
+  static const char* syscallName(int sc) {
+    static const char* names[] = {
+#define SYSCALL_POLICY_NAME(name, policy) #name,
+      SYSCALL_POLICY_TABLE(SYSCALL_POLICY_NAME)
+#undef SYSCALL_POLICY_NAME
+    };
+    return names[sc];
+  }
+
+private:
+  static const char* policyName(int policy) {
+    static const char* names[NUM_POLICIES] = { "revocable", "record", "buffer", "irrevocable" };
+    return names[policy];
+  }
+
+  // Apply a comma-separated list of name=policy.
+  void parse(const char* overrides) {
+    char entry[64];
+
+    while(*overrides != '\0') {
+      size_t len = strcspn(overrides, ",");
+      if(len < sizeof(entry)) {
+        memcpy(entry, overrides, len);
+        entry[len] = '\0';
+        apply(entry);
+      } else {
+        PRWRN("Ignoring syscall policy %.*s", (int)len, overrides);
+      }
+
+      overrides += len;
+      if(*overrides == ',') {
+        overrides++;
+      }
+    }
+  }
+
+  void apply(char* entry) {
+    char* value = strchr(entry, '=');
+    int policy = NUM_POLICIES;
+
+    if(value != NULL) {
+      *value++ = '\0';
+      for(policy = 0; policy < NUM_POLICIES; policy++) {
+        if(strcmp(value, policyName(policy)) == 0) {
+          break;
+        }
+      }
+    }
+    if(policy == NUM_POLICIES) {
+      PRWRN("Ignoring syscall policy %s", entry);
+      return;
+    }
+
+    bool all = strcmp(entry, "all") == 0;
+    bool found = false;
+    for(int sc = 0; sc < SC_MAX; sc++) {
+      if(all || strcmp(entry, syscallName(sc)) == 0) {
+        _policies[sc] = (ePolicy)policy;
+        found = true;
+      }
+    }
+    if(!found) {
+      PRWRN("No syscall policy for %s", entry);
+    }
+  }
+
+  bool _stats;
+  ePolicy _policies[SC_MAX];
+  unsigned long _counts[SC_MAX][NUM_POLICIES];
+};
+
+#endif
@@ -9,6 +9,8 @@
 
 #include <assert.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <mqueue.h>
 #include <poll.h>
 #include <sched.h>
@@ -20,6 +22,7 @@
 #include <sys/resource.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -28,13 +31,19 @@
 
 #include <new>
 
+#include "epochscheduler.hh"
+#include "epochstats.hh"
 #include "fops.hh"
 #include "globalinfo.hh"
+#include "inputrecord.hh"
 #include "log.hh"
+#include "outputcommit.hh"
 #include "real.hh"
+#include "syscallpolicy.hh"
 #include "sysrecord.hh"
 #include "threadstruct.hh"
 #include "xrun.hh"
+#include "xthread.hh"
 
 class syscalls {
 private:
@@ -48,7 +57,11 @@ public:
   }
 
   /// @brief Initialize the system.
-  void initialize() { _fops.initialize(); }
+  void initialize() {
+    _fops.initialize();
+    outputcommit::getInstance().initialize();
+    syscallpolicy::getInstance().initialize();
+  }
 
   // Currently, epochBegin() will call xrun::epochBegin().
   void epochBegin() { xrun::getInstance().epochBegin(); }
@@ -57,13 +70,45 @@ public:
     //    PRINF("$$$$$$epochEnd at line %d\n", __LINE__);
     //    PRINF("$$$$$$epochEnd at line %d$$$$$$$$$$$$$$$\n", __LINE__);
     //   printf("$$$$$$epochEnd at line %d$$$$$$$$$$$$$$$\n", __LINE__);
+    epochstats::getInstance().setTrigger("syscall");
     xrun::getInstance().epochEnd(false);
   }
 
+  // End a long epoch when the scheduler asks for it. Called before anything depends on
+  // the phase, since the replay resumes from here.
+  void checkEpoch() {
+    if(epochscheduler::getInstance().shouldEnd()) {
+      epochstats::getInstance().setTrigger("scheduled:syscall");
+      epochEnd();
+      epochBegin();
+    }
+  }
+
+  // End the epoch before an irrevocable call of sc.
+  void epochEnd(eSyscall sc) {
+    syscallpolicy::getInstance().count(sc, syscallpolicy::IRREVOCABLE);
+    epochstats::getInstance().setTrigger(syscallpolicy::syscallName(sc));
+    epochEnd();
+  }
+
+  // @return true if the policy table lets sc run under policy, and counts the call.
+  bool allows(eSyscall sc, syscallpolicy::ePolicy policy) {
+    syscallpolicy& table = syscallpolicy::getInstance();
+
+    if(table.lookup(sc) != policy) {
+      return false;
+    }
+    table.count(sc, policy);
+    return true;
+  }
+
   // Called by xrun::epochEnd when there is no overflow.
   // in the end of checking when an epoch ends.
   // Now, only one thread is active.
   void epochEndWell() {
+    // Release the output of this epoch.
+    outputcommit::getInstance().commit();
+
     // Cleanup all closed files so that we don't have to 
 		// update those files and directories. 
     _fops.cleanClosedFiles();
@@ -77,9 +122,12 @@ public:
     _fops.updateOpenedFiles();
   }
 
+  // Keep the files of a diagnosis child apart from those of its parent.
+  bool isolateFiles() { return _fops.isolate(); }
+
   // Prepare rollback for system calls
   void prepareRollback() {
-		fprintf(stderr, "syscalls: prepareRollback at thread\n");
+    PRINF("syscalls: prepareRollback at thread\n");
     // Handle all opened files
     _fops.prepareRollback();
   }
@@ -118,8 +166,179 @@ public:
     return;
   }
 
+  // @return true if a read on fd returns without blocking.
+  bool isReadable(int fd) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return Real::poll(&pfd, 1, 0) == 1;
+  }
+
+  // Run doCall inside the epoch and record its return value, errno, the bytes it
+  // returns in the buffers of data and all of extra (e.g. a source address). The
+  // replay gets them from the record instead of making the call again. If doCall sets
+  // wouldBlock, nothing is recorded and the call is made again after the epoch ends.
+  // @return false if the call has to end the epoch instead.
+  template <typename Call>
+  bool recordCall(const struct iovec* data, int count, const struct iovec* extra, int extras,
+                  ssize_t* ret, Call doCall, const bool* wouldBlock = NULL) {
+    size_t size = inputrecord::getSize(data, count);
+    size_t extraSize = inputrecord::getSize(extra, extras);
+    size_t length;
+    int error;
+    char* saved;
+
+    checkEpoch();
+
+    // The replay resumes after the epoch ends, and finds the record there.
+    if(!global_isRollback() && size + extraSize <= xdefines::MAX_INPUT_RECORD_SIZE &&
+       !_sysrecord.hasInputRoom(size + extraSize)) {
+      epochstats::getInstance().setTrigger("input_log");
+      epochEnd();
+      epochBegin();
+    }
+
+    if(global_isRollback()) {
+      // A read that ended the epoch was not recorded.
+      if(!_sysrecord.isNextRecord(E_SYS_INPUT)) {
+        return false;
+      }
+
+      _sysrecord.getInputOps(ret, &error, &saved);
+      length = inputrecord::getDataLength(*ret, count, size);
+      inputrecord::restore(saved, data, count, length, extra, extras);
+      errno = error;
+      return true;
+    }
+
+    if(size + extraSize > xdefines::MAX_INPUT_RECORD_SIZE) {
+      return false;
+    }
+
+    // Threads must not be stopped between the call and its record.
+    bool wasSafe = xthread::isThreadSafe(current);
+    xthread::setThreadUnsafe();
+    *ret = doCall();
+    error = errno;
+
+    if(wouldBlock != NULL && *wouldBlock) {
+      if(wasSafe) {
+        xthread::setThreadSafe();
+      }
+      return false;
+    }
+
+    // Only the return value of a read is a length, and never more than its buffers.
+    length = inputrecord::getDataLength(*ret, count, size);
+    saved = _sysrecord.recordInputOps(*ret, error, length + extraSize);
+    inputrecord::save(saved, data, count, length, extra, extras);
+    if(wasSafe) {
+      xthread::setThreadSafe();
+    }
+
+    errno = error;
+    return true;
+  }
+
+  // Inbound data that is already there is read inside the epoch and recorded. Reads
+  // that could block still end the epoch, which also releases pending output the
+  // other side may be waiting for.
+  // The thread can not be stopped during a recorded read, and another thread may take
+  // the data between the poll and the read, so the read never blocks, and if it would
+  // block it is made again after the epoch ends. A receive gets MSG_DONTWAIT from
+  // doRead(flags). A read of a blocking fd runs with O_NONBLOCK for a moment instead.
+  // That flag belongs to the open file, so another process sharing it, such as one that
+  // inherited the same stdin, may see a read of its own fail with EAGAIN meanwhile.
+  template <typename Read>
+  bool readRecorded(eSyscall sc, int fd, const struct iovec* data, int count,
+                    const struct iovec* extra, int extras, ssize_t* ret, Read doRead,
+                    bool isReceive = false) {
+    if(syscallpolicy::getInstance().lookup(sc) != syscallpolicy::RECORD ||
+       (!global_isRollback() && !isReadable(fd))) {
+      return false;
+    }
+
+    bool wouldBlock = false;
+    auto doNonBlockingRead = [&]() -> ssize_t {
+      int flags = Real::fcntl(fd, F_GETFL);
+      if(flags == -1 || (flags & O_NONBLOCK)) {
+        return doRead(0);
+      }
+
+      ssize_t bytes;
+      int error;
+      if(isReceive) {
+        bytes = doRead(MSG_DONTWAIT);
+        error = errno;
+      } else {
+        Real::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        bytes = doRead(0);
+        error = errno;
+        Real::fcntl(fd, F_SETFL, flags);
+      }
+
+      wouldBlock = (bytes < 0 && (error == EAGAIN || error == EWOULDBLOCK));
+      errno = error;
+      return bytes;
+    };
+
+    if(!recordCall(data, count, extra, extras, ret, doNonBlockingRead, &wouldBlock)) {
+      return false;
+    }
+    syscallpolicy::getInstance().count(sc, syscallpolicy::RECORD);
+    return true;
+  }
+
+  // System calls without side effects run inside the epoch, with their results in
+  // out recorded for the replay.
+  template <typename T, typename Call>
+  bool callRecorded(const struct iovec* out, int outs, T* ret, Call doCall) {
+    ssize_t result;
+
+    if(!recordCall(NULL, 0, out, outs, &result, [&]() { return (ssize_t)doCall(); })) {
+      return false;
+    }
+    *ret = (T)result;
+    return true;
+  }
+
+  // Run doCall as the policy table says for sc. out holds the outs buffers the call
+  // fills, which are recorded for the RECORD policy; outs is -1 if they are not known.
+  template <typename Call>
+  auto dispatch(eSyscall sc, const struct iovec* out, int outs, Call doCall)
+      -> decltype(doCall()) {
+    syscallpolicy& table = syscallpolicy::getInstance();
+    decltype(doCall()) ret;
+
+    checkEpoch();
+
+    switch(table.lookup(sc)) {
+    case syscallpolicy::REVOCABLE:
+      table.count(sc, syscallpolicy::REVOCABLE);
+      return doCall();
+
+    case syscallpolicy::RECORD:
+      if(outs >= 0 && callRecorded(out, outs, &ret, doCall)) {
+        table.count(sc, syscallpolicy::RECORD);
+        return ret;
+      }
+      break;
+
+    default:
+      break;
+    }
+
+    epochEnd(sc);
+    ret = doCall();
+    epochBegin();
+    return ret;
+  }
+
+  template <typename Call> inline auto dispatch(eSyscall sc, Call doCall) -> decltype(doCall()) {
+    return dispatch(sc, NULL, -1, doCall);
+  }
+
   ssize_t read(int fd, void* buf, size_t count) {
     ssize_t ret;
+    struct iovec vector = { buf, count };
 
     // Make those pages writable, otherwise, read may fail
     makeWritable(buf, count);
@@ -128,9 +347,12 @@ public:
     // Check whether this fd is not a socketid.
     if(_fops.checkPermission(fd)) {
       ret = Real::read(fd, buf, count);
+    } else if(readRecorded(SC_read, fd, &vector, 1, NULL, 0, &ret,
+                           [&](int) { return Real::read(fd, buf, count); })) {
+      return ret;
     } else {
       //      PRINF("Reading special file\n");
-      epochEnd();
+      epochEnd(SC_read);
       ret = Real::read(fd, buf, count);
       epochBegin();
     }
@@ -138,12 +360,106 @@ public:
     return ret;
   }
 
+  // @return the type and mode of the file of fd, 0 if fd is not valid.
+  mode_t fileMode(int fd) {
+    struct stat st;
+
+    if(fd < 0 || Real::fstat(fd, &st) != 0) {
+      return 0;
+    }
+    return st.st_mode;
+  }
+
+  // Keep output that can not be taken back until the epoch commits.
+  // @return false if the output has to be written right away.
+  bool deferOutput(eSyscall sc, int fd, mode_t mode, int flags, const struct iovec* vector,
+                   int count) {
+    outputcommit& output = outputcommit::getInstance();
+
+    if(!outputcommit::isDeferred(mode) ||
+       syscallpolicy::getInstance().lookup(sc) != syscallpolicy::BUFFER) {
+      return false;
+    }
+
+    // Threads must not be stopped in the middle of an update of their buffer. The output
+    // of the epoch being replayed has been released already, and is only counted.
+    bool wasSafe = xthread::isThreadSafe(current);
+    xthread::setThreadUnsafe();
+    bool deferred = global_isRollback() ? output.replay(vector, count)
+                                        : output.add(fd, flags, vector, count);
+    if(wasSafe) {
+      xthread::setThreadSafe();
+    }
+
+    if(deferred) {
+      if(!global_isRollback()) {
+        syscallpolicy::getInstance().count(sc, syscallpolicy::BUFFER);
+      }
+      if(output.isOverWatermark()) {
+        epochEnd();
+        epochBegin();
+      }
+    }
+    return deferred;
+  }
+
+  // Write to a regular file right away, once the undo log of fops has what the
+  // write changes. offset is -1 for a write at the file offset. Writes buffered by
+  // their policy are kept in the undo log as well.
+  // @return false if the write can not be undone and has to end the epoch instead.
+  template <typename Write>
+  bool writeUndoable(eSyscall sc, int fd, mode_t mode, off_t offset, size_t size, bool truncate,
+                     Write doWrite) {
+    syscallpolicy::ePolicy policy = syscallpolicy::getInstance().lookup(sc);
+
+    if(!S_ISREG(mode) || (policy != syscallpolicy::REVOCABLE && policy != syscallpolicy::BUFFER)) {
+      return false;
+    }
+
+    if(!global_isRollback() && _fops.isUndoLogFull()) {
+      epochEnd();
+      epochBegin();
+    }
+
+    // Nothing is undone after the replay.
+    if(global_isRollback()) {
+      doWrite();
+      return true;
+    }
+
+    // Threads must not be stopped between saving the old content and writing.
+    bool wasSafe = xthread::isThreadSafe(current);
+    xthread::setThreadUnsafe();
+    bool saved = truncate ? _fops.saveTruncate(fd, offset) : _fops.saveWrite(fd, offset, size);
+    if(saved) {
+      doWrite();
+    }
+    if(wasSafe) {
+      xthread::setThreadSafe();
+    }
+    if(saved) {
+      syscallpolicy::getInstance().count(sc, syscallpolicy::REVOCABLE);
+    }
+    return saved;
+  }
+
   ssize_t write(int fd, const void* buf, size_t count) {
     ssize_t ret;
+    mode_t mode = fileMode(fd);
+    struct iovec vector = { (void*)buf, count };
+
+    if(deferOutput(SC_write, fd, mode, outputcommit::WRITE, &vector, 1)) {
+      return count;
+    }
+
+    if(writeUndoable(SC_write, fd, mode, -1, count, false,
+                     [&]() { ret = Real::write(fd, buf, count); })) {
+      return ret;
+    }
 
-    // writes always need to end an epoch, otherwise we could end up
+    // Other writes always need to end an epoch, otherwise we could end up
     // with double-writes if we rollback.
-    epochEnd();
+    epochEnd(SC_write);
     ret = Real::write(fd, buf, count);
     epochBegin();
 
@@ -170,6 +486,8 @@ public:
   // Tongping
   void* mmap(void* start, size_t length, int prot, int flags, int fd, off_t offset) {
     void* ret = NULL;
+
+    checkEpoch();
     if(!global_isRollback()) {
       // We only record these mmap requests.
       ret = Real::mmap(start, length, prot, flags, fd, offset);
@@ -195,6 +513,8 @@ public:
   int open(const char* pathname, int flags, mode_t mode) {
     int ret;
 
+    checkEpoch();
+
     // In the rollback phase, we only call
     if(!global_isRollback()) {
       ret = Real::open(pathname, flags, mode);
@@ -345,35 +665,22 @@ public:
   }
 
   int stat(const char* path, struct stat* buf) {
-    int ret;
-    epochEnd();
-    ret = Real::stat(path, buf);
-    epochBegin();
-    return ret;
+    struct iovec out = { buf, sizeof(struct stat) };
+    return dispatch(SC_stat, &out, 1, [&]() { return Real::stat(path, buf); });
   }
 
   int fstat(int filedes, struct stat* buf) {
-    int ret;
-    epochEnd();
-    ret = Real::fstat(filedes, buf);
-    epochBegin();
-    return ret;
+    struct iovec out = { buf, sizeof(struct stat) };
+    return dispatch(SC_fstat, &out, 1, [&]() { return Real::fstat(filedes, buf); });
   }
 
   int lstat(const char* path, struct stat* buf) {
-    int ret;
-    epochEnd();
-    ret = Real::lstat(path, buf);
-    epochBegin();
-    return ret;
+    struct iovec out = { buf, sizeof(struct stat) };
+    return dispatch(SC_lstat, &out, 1, [&]() { return Real::lstat(path, buf); });
   }
 
   int poll(struct pollfd* fds, nfds_t nfds, int timeout) {
-    int ret;
-    epochEnd();
-    ret = Real::poll(fds, nfds, timeout);
-    epochBegin();
-    return ret;
+    return dispatch(SC_poll, [&]() { return Real::poll(fds, nfds, timeout); });
   }
 
   off_t lseek(int filedes, off_t offset, int whence) {
@@ -391,19 +698,13 @@ public:
   }
 
   int mprotect(void* addr, size_t len, int prot) {
-    int ret;
-
-    // FIXME: since pthread_create will call mprotect, we don't
-    // want to introduce some unnecessary checking here.
-    epochEnd();
-    ret = Real::mprotect(addr, len, prot);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mprotect, [&]() { return Real::mprotect(addr, len, prot); });
   }
 
   int munmap(void* start, size_t length) {
     int ret = 0;
 
+    checkEpoch();
     if(!global_isRollback()) {
       _sysrecord.recordMunmapOps(start, length);
     } else {
@@ -436,35 +737,19 @@ public:
 
   */
   int brk(void* end_data_segment) {
-    int ret;
-    epochEnd();
-    ret = Real::brk(end_data_segment);
-    epochBegin();
-    return ret;
+    return dispatch(SC_brk, [&]() { return Real::brk(end_data_segment); });
   }
 
   int sigaction(int signum, const struct sigaction* act, struct sigaction* oldact) {
-    int ret;
-    epochEnd();
-    ret = Real::sigaction(signum, act, oldact);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sigaction, [&]() { return Real::sigaction(signum, act, oldact); });
   }
 
   int sigprocmask(int how, const sigset_t* set, sigset_t* oldset) {
-    int ret;
-    epochEnd();
-    ret = Real::sigprocmask(how, set, oldset);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sigprocmask, [&]() { return Real::sigprocmask(how, set, oldset); });
   }
 
   int sigreturn(unsigned long __unused) {
-    int ret;
-    epochEnd();
-    ret = Real::sigreturn((struct sigcontext*)__unused);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sigreturn, [&]() { return Real::sigreturn((struct sigcontext*)__unused); });
   }
 
   ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
@@ -484,10 +769,15 @@ public:
   ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
     ssize_t ret;
 
+    if(writeUndoable(SC_pwrite, fd, fileMode(fd), offset, count, false,
+                     [&]() { ret = Real::pwrite(fd, buf, count, offset); })) {
+      return ret;
+    }
+
     if(_fops.checkPermission(fd)) {
       ret = Real::pwrite(fd, buf, count, offset);
     } else {
-      epochEnd();
+      epochEnd(SC_pwrite);
       ret = Real::pwrite(fd, buf, count, offset);
       epochBegin();
     }
@@ -497,21 +787,23 @@ public:
   ssize_t readv(int fd, const struct iovec* vector, int count) {
     ssize_t ret;
 
-    struct iovec** vec = (struct iovec**)vector;
     for(int i = 0; i < count; i++) {
-      checkOverflowBeforehand(vec[i]->iov_base, vec[i]->iov_len);
+      checkOverflowBeforehand(vector[i].iov_base, vector[i].iov_len);
     }
 
     if(_fops.checkPermission(fd)) {
       ret = Real::readv(fd, vector, count);
+    } else if(count >= 0 && readRecorded(SC_readv, fd, vector, count, NULL, 0, &ret,
+                                         [&](int) { return Real::readv(fd, vector, count); })) {
+      return ret;
     } else {
-      epochEnd();
+      epochEnd(SC_readv);
       // No need to call aotmicBegin() since this system call
       // won't cause overflow.
       ret = Real::readv(fd, vector, count);
 
       for(int i = 0; i < count; i++) {
-        atomicCommit(vec[i]->iov_base, vec[i]->iov_len);
+        atomicCommit(vector[i].iov_base, vector[i].iov_len);
       }
       epochBegin();
     }
@@ -520,103 +812,78 @@ public:
 
   ssize_t writev(int fd, const struct iovec* vector, int count) {
     ssize_t ret;
+    mode_t mode = fileMode(fd);
+    size_t size = 0;
+
+    for(int i = 0; i < count; i++) {
+      size += vector[i].iov_len;
+    }
+
+    if(count >= 0 && deferOutput(SC_writev, fd, mode, outputcommit::WRITE, vector, count)) {
+      return size;
+    }
+
+    if(writeUndoable(SC_writev, fd, mode, -1, size, false,
+                     [&]() { ret = Real::writev(fd, vector, count); })) {
+      return ret;
+    }
 
     // Check whether this fd is not a socketid.
     if(_fops.checkPermission(fd)) {
       ret = Real::writev(fd, vector, count);
     } else {
-      epochEnd();
+      epochEnd(SC_writev);
       ret = Real::writev(fd, vector, count);
       epochBegin();
     }
     return ret;
   }
 
-  /*
-    int access(const char *pathname, int mode){
-      int ret;
-      epochEnd();
-      ret = Real::access(pathname, mode);
-      epochBegin();
-      return ret;
-    }
-  */
+  int access(const char* pathname, int mode) {
+    return dispatch(SC_access, NULL, 0, [&]() { return Real::access(pathname, mode); });
+  }
 
   int pipe(int filedes[2]) {
-    int ret;
-    epochEnd();
-    ret = Real::pipe(filedes);
-    epochBegin();
-    return ret;
+    return dispatch(SC_pipe, [&]() { return Real::pipe(filedes); });
   }
 
   int select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds,
              struct timeval* timeout) {
-    int ret;
-    epochEnd();
-    ret = Real::select(nfds, readfds, writefds, exceptfds, timeout);
-    epochBegin();
-    return ret;
+    return dispatch(SC_select, [&]() {
+      return Real::select(nfds, readfds, writefds, exceptfds, timeout);
+    });
   }
 
   void* mremap(void* old_address, size_t old_size, size_t new_size, int flags) {
-    void* ret;
-    epochEnd();
-    ret = Real::mremap(old_address, old_size, new_size, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mremap, [&]() {
+      return Real::mremap(old_address, old_size, new_size, flags);
+    });
   }
 
   int msync(void* start, size_t length, int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::msync(start, length, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_msync, [&]() { return Real::msync(start, length, flags); });
   }
 
   int mincore(void* start, size_t length, unsigned char* vec) {
-    int ret;
-    epochEnd();
-    ret = Real::mincore(start, length, vec);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mincore, [&]() { return Real::mincore(start, length, vec); });
   }
 
   int madvise(void* start, size_t length, int advice) {
-    int ret;
-    epochEnd();
-    ret = Real::madvise(start, length, advice);
-    epochBegin();
-    return ret;
+    return dispatch(SC_madvise, [&]() { return Real::madvise(start, length, advice); });
   }
 
   // Tongping, FIXME, we should record this.
   int shmget(key_t key, size_t size, int shmflg) {
-    int ret;
-    epochEnd();
-
-    ret = Real::shmget(key, size, shmflg);
-    epochBegin();
-    return ret;
+    return dispatch(SC_shmget, [&]() { return Real::shmget(key, size, shmflg); });
   }
 
   // Tongping, FIXME, we should record this.
   void* shmat(int shmid, const void* shmaddr, int shmflg) {
-    void* ret;
-    epochEnd();
-    ret = Real::shmat(shmid, shmaddr, shmflg);
-    epochBegin();
-    return ret;
+    return dispatch(SC_shmat, [&]() { return Real::shmat(shmid, shmaddr, shmflg); });
   }
 
   int shmctl(int shmid, int cmd, struct shmid_ds* buf) {
-    int ret;
-    epochEnd();
-
-    ret = Real::shmctl(shmid, cmd, buf);
-    epochBegin();
-    return ret;
+    return dispatch(SC_shmctl, [&]() { return Real::shmctl(shmid, cmd, buf); });
   }
 
   /*
@@ -689,37 +956,26 @@ public:
   }
 
   int pause() {
-    int ret;
-    epochEnd();
-    ret = Real::pause();
-    epochBegin();
-    return ret;
+    return dispatch(SC_pause, [&]() { return Real::pause(); });
   }
 
   int nanosleep(const struct timespec* req, struct timespec* rem) {
-    int ret;
-    epochEnd();
-    ret = Real::nanosleep(req, rem);
-    epochBegin();
-    return ret;
+    struct iovec out = { rem, rem ? sizeof(struct timespec) : 0 };
+
+    // Other threads can not end the epoch while this one sleeps, so only short sleeps
+    // are recorded. The replay does not sleep again.
+    bool isShort =
+        req != NULL && req->tv_sec == 0 && req->tv_nsec <= xdefines::MAX_RECORDED_SLEEP_NS;
+    return dispatch(SC_nanosleep, &out, isShort ? 1 : -1,
+                    [&]() { return Real::nanosleep(req, rem); });
   }
 
   int getitimer(int which, struct itimerval* value) {
-    int ret;
-    epochEnd();
-
-    ret = Real::getitimer(which, value);
-    epochBegin();
-    return ret;
+    return dispatch(SC_getitimer, [&]() { return Real::getitimer(which, value); });
   }
 
   unsigned int alarm(unsigned int seconds) {
-    int ret;
-    epochEnd();
-
-    ret = Real::alarm(seconds);
-    epochBegin();
-    return ret;
+    return dispatch(SC_alarm, [&]() { return Real::alarm(seconds); });
   }
 
   int setitimer(int which, const struct itimerval* value, struct itimerval* ovalue) {
@@ -737,28 +993,15 @@ public:
   // pid_t getpid()
 
   ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
-    ssize_t ret;
-    epochEnd();
-
-    ret = Real::sendfile(out_fd, in_fd, offset, count);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sendfile, [&]() { return Real::sendfile(out_fd, in_fd, offset, count); });
   }
 
   int socket(int domain, int type, int protocol) {
-    int ret;
-    epochEnd();
-    ret = Real::socket(domain, type, protocol);
-    epochBegin();
-    return ret;
+    return dispatch(SC_socket, [&]() { return Real::socket(domain, type, protocol); });
   }
 
   int connect(int sockfd, const struct sockaddr* serv_addr, socklen_t addrlen) {
-    int ret;
-    epochEnd();
-    ret = Real::connect(sockfd, serv_addr, addrlen);
-    epochBegin();
-    return ret;
+    return dispatch(SC_connect, [&]() { return Real::connect(sockfd, serv_addr, addrlen); });
   }
 
   int accept(int sockfd, struct sockaddr* addr, socklen_t* addrlen) {
@@ -778,7 +1021,14 @@ public:
   ssize_t sendto(int s, const void* buf, size_t len, int flags, const struct sockaddr* to,
                  socklen_t tolen) {
     ssize_t ret;
-    epochEnd();
+    struct iovec vector = { (void*)buf, len };
+
+    if(to == NULL && outputcommit::isDeferredFlags(flags) &&
+       deferOutput(SC_sendto, s, fileMode(s), flags, &vector, 1)) {
+      return len;
+    }
+
+    epochEnd(SC_sendto);
     ret = Real::sendto(s, buf, len, flags, to, tolen);
     epochBegin();
     return ret;
@@ -787,12 +1037,29 @@ public:
   ssize_t recvfrom(int s, void* buf, size_t len, int flags, struct sockaddr* from,
                    socklen_t* fromlen) {
     ssize_t ret;
-    epochEnd();
+    struct iovec vector = { buf, len };
+    struct iovec extra[2] = { { fromlen, sizeof(socklen_t) }, { from, 0 } };
 
-    checkOverflowBeforehand(from, len);
+    // The address is written up to the length given by the caller.
+    if(from != NULL && fromlen != NULL) {
+      extra[1].iov_len = *fromlen;
+    }
+
+    // A receive that waits for all of len would return short without blocking.
+    checkOverflowBeforehand(buf, len);
+    if(!(flags & MSG_WAITALL) &&
+       readRecorded(SC_recvfrom, s, &vector, 1, extra, fromlen != NULL ? 2 : 0, &ret,
+                    [&](int more) {
+                      return Real::recvfrom(s, buf, len, flags | more, from, fromlen);
+                    },
+                    true)) {
+      return ret;
+    }
+
+    epochEnd(SC_recvfrom);
     ret = Real::recvfrom(s, buf, len, flags, from, fromlen);
     if(ret > 0) {
-      atomicCommit(from, ret);
+      atomicCommit(buf, ret);
     }
     epochBegin();
     return ret;
@@ -800,7 +1067,17 @@ public:
 
   ssize_t sendmsg(int s, const struct msghdr* msg, int flags) {
     ssize_t ret;
-    epochEnd();
+
+    if(msg->msg_name == NULL && msg->msg_controllen == 0 && outputcommit::isDeferredFlags(flags) &&
+       deferOutput(SC_sendmsg, s, fileMode(s), flags, msg->msg_iov, msg->msg_iovlen)) {
+      ret = 0;
+      for(size_t i = 0; i < msg->msg_iovlen; i++) {
+        ret += msg->msg_iov[i].iov_len;
+      }
+      return ret;
+    }
+
+    epochEnd(SC_sendmsg);
 
     ret = Real::sendmsg(s, msg, flags);
     epochBegin();
@@ -809,7 +1086,19 @@ public:
 
   ssize_t recvmsg(int s, struct msghdr* msg, int flags) {
     ssize_t ret;
-    epochEnd();
+    struct iovec extra[3] = { { &msg->msg_namelen, sizeof(socklen_t) },
+                              { &msg->msg_flags, sizeof(int) },
+                              { msg->msg_name, msg->msg_name ? msg->msg_namelen : 0 } };
+
+    // Control data may carry file descriptors, which can not be replayed, and
+    // MSG_WAITALL can not be kept without blocking.
+    if(msg->msg_controllen == 0 && !(flags & MSG_WAITALL) &&
+       readRecorded(SC_recvmsg, s, msg->msg_iov, msg->msg_iovlen, extra, 3, &ret,
+                    [&](int more) { return Real::recvmsg(s, msg, flags | more); }, true)) {
+      return ret;
+    }
+
+    epochEnd(SC_recvmsg);
 
     ret = Real::recvmsg(s, msg, flags);
     epochBegin();
@@ -818,24 +1107,14 @@ public:
 
   //  int shutdown(int s, int how){
   int bind(int sockfd, const struct sockaddr* my_addr, socklen_t addrlen) {
-    int ret;
-    epochEnd();
-
-    ret = Real::bind(sockfd, my_addr, addrlen);
-    epochBegin();
-    return ret;
+    return dispatch(SC_bind, [&]() { return Real::bind(sockfd, my_addr, addrlen); });
   }
 
   int listen(int sockfd, int backlog) {
-    int ret;
-    epochEnd();
-
-    ret = Real::listen(sockfd, backlog);
-    epochBegin();
-    return ret;
-  }
-
-  int getsockname(int s, struct sockaddr* name, socklen_t* namelen) {
+    return dispatch(SC_listen, [&]() { return Real::listen(sockfd, backlog); });
+  }
+
+  int getsockname(int s, struct sockaddr* name, socklen_t* namelen) {
     int ret;
     epochEnd();
 
@@ -875,12 +1154,9 @@ public:
   }
 
   int setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen) {
-
-    int ret;
-    epochEnd();
-    ret = Real::setsockopt(s, level, optname, optval, optlen);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setsockopt, [&]() {
+      return Real::setsockopt(s, level, optname, optval, optlen);
+    });
   }
 
   int getsockopt(int s, int level, int optname, void* optval, socklen_t* optlen) {
@@ -904,41 +1180,22 @@ public:
   // FIXME
 
   int execve(const char* filename, char* const argv[], char* const envp[]) {
-
-    int ret;
-    epochEnd();
-    ret = Real::execve(filename, argv, envp);
-    epochBegin();
-    return ret;
+    return dispatch(SC_execve, [&]() { return Real::execve(filename, argv, envp); });
   }
 
   //  void exit(int status){
 
   pid_t wait4(pid_t pid, void* status, int options, struct rusage* rusage) {
-
-    pid_t ret;
-    epochEnd();
-    ret = Real::wait4(pid, status, options, rusage);
-    epochBegin();
-    return ret;
+    return dispatch(SC_wait4, [&]() { return Real::wait4(pid, status, options, rusage); });
   }
 
   int kill(pid_t pid, int sig) {
-    // FIXME
-    int ret;
-    epochEnd();
-    ret = Real::kill(pid, sig);
-    epochBegin();
-    return ret;
+    return dispatch(SC_kill, [&]() { return Real::kill(pid, sig); });
   }
 
   int uname(struct utsname* buf) {
-
-    int ret;
-    epochEnd();
-    ret = Real::uname(buf);
-    epochBegin();
-    return ret;
+    struct iovec out = { buf, sizeof(struct utsname) };
+    return dispatch(SC_uname, &out, 1, [&]() { return Real::uname(buf); });
   }
 
   /*
@@ -964,29 +1221,15 @@ public:
   */
 
   int semget(key_t key, int nsems, int semflg) {
-    int ret;
-    epochEnd();
-
-    ret = Real::semget(key, nsems, semflg);
-    epochBegin();
-    return ret;
+    return dispatch(SC_semget, [&]() { return Real::semget(key, nsems, semflg); });
   }
 
   int semop(int semid, struct sembuf* sops, size_t nsops) {
-
-    int ret;
-    epochEnd();
-    ret = Real::semop(semid, sops, nsops);
-    epochBegin();
-    return ret;
+    return dispatch(SC_semop, [&]() { return Real::semop(semid, sops, nsops); });
   }
 
   int semctl(int semid, int semnum, int cmd, ...) {
-    int ret;
-    epochEnd();
-    ret = Real::semctl(semid, semnum, cmd);
-    epochBegin();
-    return ret;
+    return dispatch(SC_semctl, [&]() { return Real::semctl(semid, semnum, cmd); });
   }
 
   int fcntl(int fd, int cmd, long arg) {
@@ -1038,44 +1281,30 @@ public:
   }
 
   int flock(int fd, int operation) {
-
-    int ret;
-    epochEnd();
-    ret = Real::flock(fd, operation);
-    epochBegin();
-    return ret;
+    return dispatch(SC_flock, [&]() { return Real::flock(fd, operation); });
   }
 
   int fsync(int fd) {
-
-    int ret;
-    epochEnd();
-    ret = Real::fsync(fd);
-    epochBegin();
-    return ret;
+    return dispatch(SC_fsync, [&]() { return Real::fsync(fd); });
   }
 
   int fdatasync(int fd) {
-
-    int ret;
-    epochEnd();
-    ret = Real::fdatasync(fd);
-    epochBegin();
-    return ret;
+    return dispatch(SC_fdatasync, [&]() { return Real::fdatasync(fd); });
   }
 
   int truncate(const char* path, off_t length) {
-
-    int ret;
-    epochEnd();
-    ret = Real::truncate(path, length);
-    epochBegin();
-    return ret;
+    return dispatch(SC_truncate, [&]() { return Real::truncate(path, length); });
   }
 
   int ftruncate(int fd, off_t length) {
     int ret;
-    epochEnd();
+
+    if(writeUndoable(SC_ftruncate, fd, fileMode(fd), length, 0, true,
+                     [&]() { ret = Real::ftruncate(fd, length); })) {
+      return ret;
+    }
+
+    epochEnd(SC_ftruncate);
 
     ret = Real::ftruncate(fd, length);
     epochBegin();
@@ -1096,7 +1325,14 @@ public:
 
   char* getcwd(char* buf, size_t size) {
     char* ret;
-    epochEnd();
+    struct iovec out = { buf, size };
+
+    // Without a buffer, getcwd allocates one, which the replay could not reuse.
+    if(buf != NULL) {
+      return dispatch(SC_getcwd, &out, 1, [&]() { return Real::getcwd(buf, size); });
+    }
+
+    epochEnd(SC_getcwd);
     checkOverflowBeforehand(buf, size);
     ret = Real::getcwd(buf, size);
     atomicCommit(buf, size);
@@ -1105,21 +1341,11 @@ public:
   }
 
   int chdir(const char* path) {
-    int ret;
-    epochEnd();
-
-    ret = Real::chdir(path);
-    epochBegin();
-    return ret;
+    return dispatch(SC_chdir, [&]() { return Real::chdir(path); });
   }
 
   int fchdir(int fd) {
-    int ret;
-    epochEnd();
-
-    ret = Real::fchdir(fd);
-    epochBegin();
-    return ret;
+    return dispatch(SC_fchdir, [&]() { return Real::fchdir(fd); });
   }
 
   /*
@@ -1149,64 +1375,31 @@ public:
   */
 
   int rename(const char* oldpath, const char* newpath) {
-    int ret;
-    epochEnd();
-    ret = Real::rename(oldpath, newpath);
-    epochBegin();
-    return ret;
+    return dispatch(SC_rename, [&]() { return Real::rename(oldpath, newpath); });
   }
 
   int mkdir(const char* pathname, mode_t mode) {
-    int ret;
-    epochEnd();
-    ret = Real::mkdir(pathname, mode);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mkdir, [&]() { return Real::mkdir(pathname, mode); });
   }
 
   int rmdir(const char* pathname) {
-
-    int ret;
-    epochEnd();
-    ret = Real::rmdir(pathname);
-    epochBegin();
-    return ret;
+    return dispatch(SC_rmdir, [&]() { return Real::rmdir(pathname); });
   }
 
   int creat(const char* pathname, mode_t mode) {
-    int ret;
-    epochEnd();
-
-    ret = Real::creat(pathname, mode);
-    epochBegin();
-    return ret;
+    return dispatch(SC_creat, [&]() { return Real::creat(pathname, mode); });
   }
 
   int link(const char* oldpath, const char* newpath) {
-
-    int ret;
-    epochEnd();
-    ret = Real::link(oldpath, newpath);
-    epochBegin();
-    return ret;
+    return dispatch(SC_link, [&]() { return Real::link(oldpath, newpath); });
   }
 
   int unlink(const char* pathname) {
-
-    int ret;
-    epochEnd();
-    ret = Real::unlink(pathname);
-    epochBegin();
-    return ret;
+    return dispatch(SC_unlink, [&]() { return Real::unlink(pathname); });
   }
 
   int symlink(const char* oldpath, const char* newpath) {
-
-    int ret;
-    epochEnd();
-    ret = Real::symlink(oldpath, newpath);
-    epochBegin();
-    return ret;
+    return dispatch(SC_symlink, [&]() { return Real::symlink(oldpath, newpath); });
   }
 
   ssize_t readlink(const char* path, char* buf, size_t bufsize) {
@@ -1222,61 +1415,34 @@ public:
   }
 
   int chmod(const char* path, mode_t mode) {
-    int ret;
-    epochEnd();
-
-    ret = Real::chmod(path, mode);
-    epochBegin();
-    return ret;
+    return dispatch(SC_chmod, [&]() { return Real::chmod(path, mode); });
   }
 
   int fchmod(int fildes, mode_t mode) {
-
-    int ret;
-    epochEnd();
-    ret = Real::fchmod(fildes, mode);
-    epochBegin();
-    return ret;
+    return dispatch(SC_fchmod, [&]() { return Real::fchmod(fildes, mode); });
   }
 
   int chown(const char* path, uid_t owner, gid_t group) {
-
-    int ret;
-    epochEnd();
-    ret = Real::chown(path, owner, group);
-    epochBegin();
-    return ret;
+    return dispatch(SC_chown, [&]() { return Real::chown(path, owner, group); });
   }
 
   int fchown(int fd, uid_t owner, gid_t group) {
-    int ret;
-    epochEnd();
-    ret = Real::fchown(fd, owner, group);
-    epochBegin();
-    return ret;
+    return dispatch(SC_fchown, [&]() { return Real::fchown(fd, owner, group); });
   }
 
   int lchown(const char* path, uid_t owner, gid_t group) {
-
-    int ret;
-    epochEnd();
-    ret = Real::lchown(path, owner, group);
-    epochBegin();
-    return ret;
+    return dispatch(SC_lchown, [&]() { return Real::lchown(path, owner, group); });
   }
 
   mode_t umask(mode_t mask) {
-
-    mode_t ret;
-    epochEnd();
-    ret = Real::umask(mask);
-    epochBegin();
-    return ret;
+    return dispatch(SC_umask, [&]() { return Real::umask(mask); });
   }
 
   // We can record this also. Tongping
   int gettimeofday(struct timeval* tv, struct timezone* tz) {
     int ret = 0;
+
+    checkEpoch();
     if(!global_isRollback()) {
       ret = Real::gettimeofday(tv, tz);
       // Add this to the record list.
@@ -1290,34 +1456,24 @@ public:
   }
 
   int getrlimit(int resource, struct rlimit* rlim) {
-    int ret;
-    epochEnd();
-
-    ret = Real::getrlimit(resource, rlim);
-    epochBegin();
-    return ret;
+    struct iovec out = { rlim, rlim ? sizeof(struct rlimit) : 0 };
+    return dispatch(SC_getrlimit, &out, 1, [&]() { return Real::getrlimit(resource, rlim); });
   }
 
   int getrusage(int who, struct rusage* usage) {
-    int ret;
-    epochEnd();
-
-    ret = Real::getrusage(who, usage);
-    epochBegin();
-    return ret;
+    struct iovec out = { usage, sizeof(struct rusage) };
+    return dispatch(SC_getrusage, &out, 1, [&]() { return Real::getrusage(who, usage); });
   }
 
   int sysinfo(struct sysinfo* info) {
-    int ret;
-    epochEnd();
-    ret = Real::sysinfo(info);
-    epochBegin();
-    return ret;
+    struct iovec out = { info, sizeof(struct sysinfo) };
+    return dispatch(SC_sysinfo, &out, 1, [&]() { return Real::sysinfo(info); });
   }
 
   clock_t times(struct tms* buf) {
     clock_t ret;
 
+    checkEpoch();
     if(!global_isRollback()) {
       ret = Real::times(buf);
       // Add this to the record list.
@@ -1335,11 +1491,7 @@ public:
   // FIXME
 
   uid_t getuid() {
-    uid_t ret;
-    epochEnd();
-    ret = Real::getuid();
-    epochBegin();
-    return ret;
+    return dispatch(SC_getuid, NULL, 0, [&]() { return Real::getuid(); });
   }
 
   void vsyslog(int pri, const char* fmt, va_list args) {
@@ -1375,102 +1527,47 @@ public:
   */
 
   gid_t getgid() {
-
-    gid_t ret;
-    epochEnd();
-    ret = Real::getgid();
-    epochBegin();
-    return ret;
+    return dispatch(SC_getgid, NULL, 0, [&]() { return Real::getgid(); });
   }
 
   int setuid(uid_t uid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setuid(uid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setuid, [&]() { return Real::setuid(uid); });
   }
 
   int setgid(gid_t gid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setgid(gid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setgid, [&]() { return Real::setgid(gid); });
   }
 
   uid_t geteuid() {
-    uid_t ret;
-    epochEnd();
-
-    ret = Real::geteuid();
-    epochBegin();
-    return ret;
+    return dispatch(SC_geteuid, NULL, 0, [&]() { return Real::geteuid(); });
   }
 
   gid_t getegid() {
-    gid_t ret;
-    epochEnd();
-
-    ret = Real::getegid();
-    epochBegin();
-    return ret;
+    return dispatch(SC_getegid, NULL, 0, [&]() { return Real::getegid(); });
   }
 
   int setpgid(pid_t pid, pid_t pgid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setpgid(pid, pgid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setpgid, [&]() { return Real::setpgid(pid, pgid); });
   }
 
   pid_t getppid() {
-    pid_t ret;
-    epochEnd();
-
-    ret = Real::getppid();
-    epochBegin();
-    return ret;
+    return dispatch(SC_getppid, NULL, 0, [&]() { return Real::getppid(); });
   }
 
   pid_t getpgrp() {
-    pid_t ret;
-    epochEnd();
-
-    ret = Real::getpgrp();
-    epochBegin();
-    return ret;
+    return dispatch(SC_getpgrp, NULL, 0, [&]() { return Real::getpgrp(); });
   }
 
   pid_t setsid() {
-    pid_t ret;
-    epochEnd();
-
-    ret = Real::setsid();
-    epochBegin();
-    return ret;
+    return dispatch(SC_setsid, [&]() { return Real::setsid(); });
   }
 
   int setreuid(uid_t ruid, uid_t euid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setreuid(ruid, euid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setreuid, [&]() { return Real::setreuid(ruid, euid); });
   }
 
   int setregid(gid_t rgid, gid_t egid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setregid(rgid, egid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setregid, [&]() { return Real::setregid(rgid, egid); });
   }
 
   int getgroups(int size, gid_t list[]) {
@@ -1483,75 +1580,35 @@ public:
   }
 
   int setgroups(size_t size, const gid_t* list) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setgroups(size, list);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setgroups, [&]() { return Real::setgroups(size, list); });
   }
 
   int setresuid(uid_t ruid, uid_t euid, uid_t suid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setresuid(ruid, euid, suid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setresuid, [&]() { return Real::setresuid(ruid, euid, suid); });
   }
 
   int getresuid(uid_t* ruid, uid_t* euid, uid_t* suid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::getresuid(ruid, euid, suid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_getresuid, [&]() { return Real::getresuid(ruid, euid, suid); });
   }
 
   int setresgid(gid_t rgid, gid_t egid, gid_t sgid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setresgid(rgid, egid, sgid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setresgid, [&]() { return Real::setresgid(rgid, egid, sgid); });
   }
 
   int getresgid(gid_t* rgid, gid_t* egid, gid_t* sgid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::getresgid(rgid, egid, sgid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_getresgid, [&]() { return Real::getresgid(rgid, egid, sgid); });
   }
 
   pid_t getpgid(pid_t pid) {
-    pid_t ret;
-    epochEnd();
-
-    ret = Real::getpgid(pid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_getpgid, NULL, 0, [&]() { return Real::getpgid(pid); });
   }
 
   int setfsuid(uid_t fsuid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setfsuid(fsuid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setfsuid, [&]() { return Real::setfsuid(fsuid); });
   }
 
   int setfsgid(uid_t fsgid) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setfsgid(fsgid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setfsgid, [&]() { return Real::setfsgid(fsgid); });
   }
 
   /*
@@ -1574,65 +1631,31 @@ public:
   */
 
   pid_t getsid(pid_t pid) {
-    pid_t ret;
-    epochEnd();
-    ret = Real::getsid(pid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_getsid, NULL, 0, [&]() { return Real::getsid(pid); });
   }
 
   int sigpending(sigset_t* set) {
-    int ret;
-    epochEnd();
-
-    ret = Real::sigpending(set);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sigpending, [&]() { return Real::sigpending(set); });
   }
 
   int sigtimedwait(const sigset_t* set, siginfo_t* info, const struct timespec* timeout) {
-    int ret;
-    epochEnd();
-
-    ret = Real::sigtimedwait(set, info, timeout);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sigtimedwait, [&]() { return Real::sigtimedwait(set, info, timeout); });
   }
 
   int sigsuspend(const sigset_t* mask) {
-    int ret;
-    epochEnd();
-
-    ret = Real::sigsuspend(mask);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sigsuspend, [&]() { return Real::sigsuspend(mask); });
   }
 
   int sigaltstack(const stack_t* ss, stack_t* oss) {
-    int ret;
-    epochEnd();
-
-    ret = Real::sigaltstack(ss, oss);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sigaltstack, [&]() { return Real::sigaltstack(ss, oss); });
   }
 
   int utime(const char* filename, const struct utimbuf* buf) {
-    int ret;
-    epochEnd();
-
-    ret = Real::utime(filename, buf);
-    epochBegin();
-    return ret;
+    return dispatch(SC_utime, [&]() { return Real::utime(filename, buf); });
   }
 
   int mknod(const char* pathname, mode_t mode, dev_t dev) {
-    int ret;
-    epochEnd();
-
-    ret = Real::mknod(pathname, mode, dev);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mknod, [&]() { return Real::mknod(pathname, mode, dev); });
   }
 
   // uselib is not defined
@@ -1647,39 +1670,21 @@ public:
   */
 
   int personality(unsigned long persona) {
-
-    int ret;
-    epochEnd();
-    ret = Real::personality(persona);
-    epochBegin();
-    return ret;
+    return dispatch(SC_personality, [&]() { return Real::personality(persona); });
   }
 
   int ustat(dev_t dev, struct ustat* ubuf) {
-
-    int ret;
-    epochEnd();
-    ret = Real::ustat(dev, ubuf);
-    epochBegin();
-    return ret;
+    return dispatch(SC_ustat, [&]() { return Real::ustat(dev, ubuf); });
   }
 
   int statfs(const char* path, struct statfs* buf) {
-
-    int ret;
-    epochEnd();
-    ret = Real::statfs(path, buf);
-    epochBegin();
-    return ret;
+    struct iovec out = { buf, sizeof(struct statfs) };
+    return dispatch(SC_statfs, &out, 1, [&]() { return Real::statfs(path, buf); });
   }
 
   int fstatfs(int fd, struct statfs* buf) {
-
-    int ret;
-    epochEnd();
-    ret = Real::fstatfs(fd, buf);
-    epochBegin();
-    return ret;
+    struct iovec out = { buf, sizeof(struct statfs) };
+    return dispatch(SC_fstatfs, &out, 1, [&]() { return Real::fstatfs(fd, buf); });
   }
 
   // sysfs isn't defined anywhere
@@ -1720,120 +1725,67 @@ public:
   */
 
   int getpriority(int which, int who) {
-    int ret;
-    epochEnd();
-
-    ret = Real::getpriority(which, who);
-    epochBegin();
-    return ret;
+    return dispatch(SC_getpriority, [&]() { return Real::getpriority(which, who); });
   }
 
   int setpriority(__priority_which_t which, id_t who, int prio) {
-    int ret;
-    epochEnd();
-
-    ret = Real::setpriority(which, who, prio);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setpriority, [&]() { return Real::setpriority(which, who, prio); });
   }
 
   int sched_setparam(pid_t pid, const struct sched_param* param) {
-
-    int ret;
-    epochEnd();
-    ret = Real::sched_setparam(pid, param);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sched_setparam, [&]() { return Real::sched_setparam(pid, param); });
   }
 
   int sched_getparam(pid_t pid, struct sched_param* param) {
-
-    int ret;
-    epochEnd();
-    ret = Real::sched_getparam(pid, param);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sched_getparam, [&]() { return Real::sched_getparam(pid, param); });
   }
 
   int sched_setscheduler(pid_t pid, int policy, const struct sched_param* param) {
-    int ret;
-    epochEnd();
-    ret = Real::sched_setscheduler(pid, policy, param);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sched_setscheduler, [&]() {
+      return Real::sched_setscheduler(pid, policy, param);
+    });
   }
 
   int sched_getscheduler(pid_t pid) {
-    int ret;
-    epochEnd();
-    ret = Real::sched_getscheduler(pid);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sched_getscheduler, [&]() { return Real::sched_getscheduler(pid); });
   }
 
   int sched_get_priority_max(int policy) {
-    int ret;
-    epochEnd();
-    ret = Real::sched_get_priority_max(policy);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sched_get_priority_max, [&]() {
+      return Real::sched_get_priority_max(policy);
+    });
   }
 
   int sched_get_priority_min(int policy) {
-    int ret;
-    epochEnd();
-    ret = Real::sched_get_priority_min(policy);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sched_get_priority_min, [&]() {
+      return Real::sched_get_priority_min(policy);
+    });
   }
 
   int sched_rr_get_interval(pid_t pid, struct timespec* tp) {
-    int ret;
-    epochEnd();
-    ret = Real::sched_rr_get_interval(pid, tp);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sched_rr_get_interval, [&]() {
+      return Real::sched_rr_get_interval(pid, tp);
+    });
   }
 
   int mlock(const void* addr, size_t len) {
-    int ret;
-    epochEnd();
-    ret = Real::mlock(addr, len);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mlock, [&]() { return Real::mlock(addr, len); });
   }
 
   int munlock(const void* addr, size_t len) {
-    int ret;
-    epochEnd();
-
-    ret = Real::munlock(addr, len);
-    epochBegin();
-    return ret;
+    return dispatch(SC_munlock, [&]() { return Real::munlock(addr, len); });
   }
 
   int mlockall(int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::mlockall(flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mlockall, [&]() { return Real::mlockall(flags); });
   }
 
   int munlockall() {
-    int ret;
-    epochEnd();
-    ret = Real::munlockall();
-    epochBegin();
-    return ret;
+    return dispatch(SC_munlockall, [&]() { return Real::munlockall(); });
   }
 
   int vhangup() {
-    int ret;
-    epochEnd();
-    ret = Real::vhangup();
-    epochBegin();
-    return ret;
+    return dispatch(SC_vhangup, [&]() { return Real::vhangup(); });
   }
 
   //  int modify_ldt(int func, void *ptr, unsigned long bytecount){
@@ -1851,20 +1803,14 @@ public:
   }*/
 
   int sysctl(int* name, int nlen, void* oldval, size_t* oldlenp, void* newval, size_t newlen) {
-    int ret;
-    epochEnd();
-    ret = Real::sysctl(name, nlen, oldval, oldlenp, newval, newlen);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sysctl, [&]() {
+      return Real::sysctl(name, nlen, oldval, oldlenp, newval, newlen);
+    });
   }
 
   int prctl(int option, unsigned long arg2, unsigned long arg3, unsigned long arg4,
             unsigned long arg5) {
-    int ret;
-    epochEnd();
-    ret = Real::prctl(option, arg2, arg3, arg4, arg5);
-    epochBegin();
-    return ret;
+    return dispatch(SC_prctl, [&]() { return Real::prctl(option, arg2, arg3, arg4, arg5); });
   }
 
   // arch_prct isn't defined
@@ -1885,20 +1831,12 @@ public:
   }
 
   int setrlimit(int resource, const struct rlimit* rlim) {
-    int ret;
-    epochEnd();
-    ret = Real::setrlimit(resource, rlim);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setrlimit, [&]() { return Real::setrlimit(resource, rlim); });
   }
 
   // FIXME
   int chroot(const char* path) {
-    int ret;
-    epochEnd();
-    ret = Real::chroot(path);
-    epochBegin();
-    return ret;
+    return dispatch(SC_chroot, [&]() { return Real::chroot(path); });
   }
 
   void sync() {
@@ -1909,11 +1847,7 @@ public:
   }
 
   int acct(const char* filename) {
-    int ret;
-    epochEnd();
-    ret = Real::acct(filename);
-    epochBegin();
-    return ret;
+    return dispatch(SC_acct, [&]() { return Real::acct(filename); });
   }
 
   /*
@@ -1944,93 +1878,46 @@ public:
   */
 
   int settimeofday(const struct timeval* tv, const struct timezone* tz) {
-
-    int ret;
-    epochEnd();
-    ret = Real::settimeofday(tv, tz);
-    epochBegin();
-    return ret;
+    return dispatch(SC_settimeofday, [&]() { return Real::settimeofday(tv, tz); });
   }
 
   int mount(const char* source, const char* target, const char* filesystemtype,
             unsigned long mountflags, const void* data) {
-    // FIXME
-    int ret;
-    epochEnd();
-    ret = Real::mount(source, target, filesystemtype, mountflags, data);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mount, [&]() {
+      return Real::mount(source, target, filesystemtype, mountflags, data);
+    });
   }
 
   int umount2(const char* target, int flags) {
-    // FIXME
-    int ret;
-    epochEnd();
-    ret = Real::umount2(target, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_umount2, [&]() { return Real::umount2(target, flags); });
   }
 
   int swapon(const char* path, int swapflags) {
-
-    int ret;
-    epochEnd();
-    ret = Real::swapon(path, swapflags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_swapon, [&]() { return Real::swapon(path, swapflags); });
   }
 
   int swapoff(const char* path) {
-
-    int ret;
-    epochEnd();
-    ret = Real::swapoff(path);
-    epochBegin();
-    return ret;
+    return dispatch(SC_swapoff, [&]() { return Real::swapoff(path); });
   }
 
   int reboot(int cmd) {
-    int ret;
-    epochEnd();
-    ret = Real::reboot(cmd);
-    epochBegin();
-    return ret;
+    return dispatch(SC_reboot, [&]() { return Real::reboot(cmd); });
   }
-
-  int sethostname(const char* name, size_t len) {
-    int ret;
-    epochEnd();
-
-    ret = Real::sethostname(name, len);
-    epochBegin();
-    return ret;
+
+  int sethostname(const char* name, size_t len) {
+    return dispatch(SC_sethostname, [&]() { return Real::sethostname(name, len); });
   }
 
   int setdomainname(const char* name, size_t len) {
-
-    int ret;
-    epochEnd();
-    ret = Real::setdomainname(name, len);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setdomainname, [&]() { return Real::setdomainname(name, len); });
   }
 
   int iopl(int level) {
-
-    int ret;
-    epochEnd();
-    ret = Real::iopl(level);
-    epochBegin();
-    return ret;
+    return dispatch(SC_iopl, [&]() { return Real::iopl(level); });
   }
 
   int ioperm(unsigned long from, unsigned long num, int turn_on) {
-
-    int ret;
-    epochEnd();
-    ret = Real::ioperm(from, num, turn_on);
-    epochBegin();
-    return ret;
+    return dispatch(SC_ioperm, [&]() { return Real::ioperm(from, num, turn_on); });
   }
 
   // gettid is not a libc function
@@ -2077,99 +1964,55 @@ public:
   }
 
   int setxattr(const char* path, const char* name, const void* value, size_t size, int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::setxattr(path, name, value, size, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_setxattr, [&]() { return Real::setxattr(path, name, value, size, flags); });
   }
 
   int lsetxattr(const char* path, const char* name, const void* value, size_t size, int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::lsetxattr(path, name, value, size, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_lsetxattr, [&]() {
+      return Real::lsetxattr(path, name, value, size, flags);
+    });
   }
 
   int fsetxattr(int filedes, const char* name, const void* value, size_t size, int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::fsetxattr(filedes, name, value, size, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_fsetxattr, [&]() {
+      return Real::fsetxattr(filedes, name, value, size, flags);
+    });
   }
 
   ssize_t getxattr(const char* path, const char* name, void* value, size_t size) {
-    ssize_t ret;
-    epochEnd();
-    ret = Real::getxattr(path, name, value, size);
-    epochBegin();
-    return ret;
+    return dispatch(SC_getxattr, [&]() { return Real::getxattr(path, name, value, size); });
   }
 
   ssize_t lgetxattr(const char* path, const char* name, void* value, size_t size) {
-    ssize_t ret;
-    epochEnd();
-    ret = Real::lgetxattr(path, name, value, size);
-    epochBegin();
-    return ret;
+    return dispatch(SC_lgetxattr, [&]() { return Real::lgetxattr(path, name, value, size); });
   }
 
   ssize_t fgetxattr(int filedes, const char* name, void* value, size_t size) {
-    ssize_t ret;
-    epochEnd();
-    ret = Real::fgetxattr(filedes, name, value, size);
-    epochBegin();
-    return ret;
+    return dispatch(SC_fgetxattr, [&]() { return Real::fgetxattr(filedes, name, value, size); });
   }
 
   ssize_t listxattr(const char* path, char* list, size_t size) {
-    ssize_t ret;
-    epochEnd();
-    ret = Real::listxattr(path, list, size);
-    epochBegin();
-    return ret;
+    return dispatch(SC_listxattr, [&]() { return Real::listxattr(path, list, size); });
   }
 
   ssize_t llistxattr(const char* path, char* list, size_t size) {
-    ssize_t ret;
-    epochEnd();
-    ret = Real::llistxattr(path, list, size);
-    epochBegin();
-    return ret;
+    return dispatch(SC_llistxattr, [&]() { return Real::llistxattr(path, list, size); });
   }
 
   ssize_t flistxattr(int filedes, char* list, size_t size) {
-    ssize_t ret;
-    epochEnd();
-    ret = Real::flistxattr(filedes, list, size);
-    epochBegin();
-    return ret;
+    return dispatch(SC_flistxattr, [&]() { return Real::flistxattr(filedes, list, size); });
   }
 
   int removexattr(const char* path, const char* name) {
-    int ret;
-    epochEnd();
-    ret = Real::removexattr(path, name);
-    epochBegin();
-    return ret;
+    return dispatch(SC_removexattr, [&]() { return Real::removexattr(path, name); });
   }
 
   int lremovexattr(const char* path, const char* name) {
-    int ret;
-    epochEnd();
-    ret = Real::lremovexattr(path, name);
-    epochBegin();
-    return ret;
+    return dispatch(SC_lremovexattr, [&]() { return Real::lremovexattr(path, name); });
   }
 
   int fremovexattr(int filedes, const char* name) {
-    int ret;
-    epochEnd();
-    ret = Real::fremovexattr(filedes, name);
-    epochBegin();
-    return ret;
+    return dispatch(SC_fremovexattr, [&]() { return Real::fremovexattr(filedes, name); });
   }
 
   int tkill(int /* tid */, int /* sig */) { return 0; }
@@ -2178,6 +2021,7 @@ public:
   time_t time(time_t* t) {
     time_t ret;
 
+    checkEpoch();
     if(!global_isRollback()) {
       ret = Real::time(t);
       // Add this to the record list.
@@ -2200,19 +2044,15 @@ public:
   }*/
 
   int sched_setaffinity(__pid_t pid, size_t cpusetsize, const cpu_set_t* mask) {
-    int ret;
-    epochEnd();
-    ret = Real::sched_setaffinity(pid, cpusetsize, mask);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sched_setaffinity, [&]() {
+      return Real::sched_setaffinity(pid, cpusetsize, mask);
+    });
   }
 
   ssize_t sched_getaffinity(__pid_t pid, size_t cpusetsize, cpu_set_t* mask) {
-    ssize_t ret;
-    epochEnd();
-    ret = Real::sched_getaffinity(pid, cpusetsize, mask);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sched_getaffinity, [&]() {
+      return Real::sched_getaffinity(pid, cpusetsize, mask);
+    });
   }
 
   // set_thread_area isn't a libc function
@@ -2286,38 +2126,24 @@ public:
   //  }
 
   int epoll_create(int size) {
-
-    int ret;
-    epochEnd();
-    ret = Real::epoll_create(size);
-    epochBegin();
-    return ret;
+    return dispatch(SC_epoll_create, [&]() { return Real::epoll_create(size); });
   }
 
   int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
-
-    int ret;
-    epochEnd();
-    ret = Real::epoll_ctl(epfd, op, fd, event);
-    epochBegin();
-    return ret;
+    return dispatch(SC_epoll_ctl, [&]() { return Real::epoll_ctl(epfd, op, fd, event); });
   }
 
   int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
-    int ret;
-    epochEnd();
-    ret = Real::epoll_wait(epfd, events, maxevents, timeout);
-    epochBegin();
-    return ret;
+    return dispatch(SC_epoll_wait, [&]() {
+      return Real::epoll_wait(epfd, events, maxevents, timeout);
+    });
   }
 
   // Record it in the future.
   int remap_file_pages(void* start, size_t size, int prot, size_t pgoff, int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::remap_file_pages(start, size, prot, pgoff, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_remap_file_pages, [&]() {
+      return Real::remap_file_pages(start, size, prot, pgoff, flags);
+    });
   }
 
   // sys_set_tid_address is not defined
@@ -2339,99 +2165,64 @@ public:
   }*/
 
   int semtimedop(int semid, struct sembuf* sops, size_t nsops, const struct timespec* timeout) {
-    int ret;
-    epochEnd();
-
-    ret = Real::semtimedop(semid, sops, nsops, timeout);
-    epochBegin();
-    return ret;
+    return dispatch(SC_semtimedop, [&]() { return Real::semtimedop(semid, sops, nsops, timeout); });
   }
 
   long posix_fadvise64(int fs, loff_t offset, loff_t len, int advice) {
-    long ret;
-    epochEnd();
-    ret = Real::posix_fadvise64(fs, offset, len, advice);
-    epochBegin();
-    return ret;
+    return dispatch(SC_posix_fadvise64, [&]() {
+      return Real::posix_fadvise64(fs, offset, len, advice);
+    });
   }
 
   long timer_create(clockid_t which_clock, struct sigevent* timer_event_spec,
                     timer_t* created_timer_id) {
-    long ret;
-    epochEnd();
-
-    ret = Real::timer_create(which_clock, timer_event_spec, created_timer_id);
-    epochBegin();
-    return ret;
+    return dispatch(SC_timer_create, [&]() {
+      return Real::timer_create(which_clock, timer_event_spec, created_timer_id);
+    });
   }
 
   long timer_settime(timer_t timer_id, int flags, const struct itimerspec* new_setting,
                      struct itimerspec* old_setting) {
-
-    long ret;
-    epochEnd();
-    ret = Real::timer_settime(timer_id, flags, new_setting, old_setting);
-    epochBegin();
-    return ret;
+    return dispatch(SC_timer_settime, [&]() {
+      return Real::timer_settime(timer_id, flags, new_setting, old_setting);
+    });
   }
 
   long timer_gettime(timer_t timer_id, struct itimerspec* setting) {
-    long ret;
-    epochEnd();
-
-    ret = Real::timer_gettime(timer_id, setting);
-    epochBegin();
-    return ret;
+    return dispatch(SC_timer_gettime, [&]() { return Real::timer_gettime(timer_id, setting); });
   }
 
   long timer_getoverrun(timer_t timer_id) {
-    long ret;
-    epochEnd();
-    ret = Real::timer_getoverrun(timer_id);
-    epochBegin();
-    return ret;
+    return dispatch(SC_timer_getoverrun, [&]() { return Real::timer_getoverrun(timer_id); });
   }
 
   long timer_delete(timer_t timer_id) {
-
-    long ret;
-    epochEnd();
-    ret = Real::timer_delete(timer_id);
-    epochBegin();
-    return ret;
+    return dispatch(SC_timer_delete, [&]() { return Real::timer_delete(timer_id); });
   }
 
   long clock_settime(clockid_t which_clock, const struct timespec* tp) {
-    long ret;
-    epochEnd();
-    ret = Real::clock_settime(which_clock, tp);
-    epochBegin();
-    return ret;
+    return dispatch(SC_clock_settime, [&]() { return Real::clock_settime(which_clock, tp); });
   }
 
   long clock_gettime(clockid_t which_clock, struct timespec* tp) {
-    long ret;
-    epochEnd();
-    ret = Real::clock_gettime(which_clock, tp);
-    epochBegin();
-    return ret;
+    struct iovec out = { tp, tp ? sizeof(struct timespec) : 0 };
+    return dispatch(SC_clock_gettime, &out, 1, [&]() {
+      return Real::clock_gettime(which_clock, tp);
+    });
   }
 
   long clock_getres(clockid_t which_clock, struct timespec* tp) {
-    long ret;
-    epochEnd();
-    ret = Real::clock_getres(which_clock, tp);
-    epochBegin();
-    return ret;
+    struct iovec out = { tp, tp ? sizeof(struct timespec) : 0 };
+    return dispatch(SC_clock_getres, &out, 1, [&]() {
+      return Real::clock_getres(which_clock, tp);
+    });
   }
 
   long clock_nanosleep(clockid_t which_clock, int flags, const struct timespec* rqtp,
                        struct timespec* rmtp) {
-    long ret;
-    epochEnd();
-    ret = Real::clock_nanosleep(which_clock, flags, rqtp, rmtp);
-    epochBegin();
-    return ret;
+    return dispatch(SC_clock_nanosleep, [&]() {
+      return Real::clock_nanosleep(which_clock, flags, rqtp, rmtp);
+    });
   }
 
   // exit_group is not defined
@@ -2477,53 +2268,33 @@ public:
   #define _SYS_mkdirat    258
   */
   int utimes(const char* filename, const struct timeval times[2]) {
-    int ret;
-    epochEnd();
-    ret = Real::utimes(filename, times);
-    epochBegin();
-    return ret;
+    return dispatch(SC_utimes, [&]() { return Real::utimes(filename, times); });
   }
 
   mqd_t mq_open(const char* name, int oflag, mode_t mode, struct mq_attr* attr) {
-    mqd_t ret;
-    epochEnd();
-    ret = Real::mq_open(name, oflag, mode, attr);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mq_open, [&]() { return Real::mq_open(name, oflag, mode, attr); });
   }
 
   mqd_t mq_unlink(const char* name) {
-    mqd_t ret;
-    epochEnd();
-    ret = Real::mq_unlink(name);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mq_unlink, [&]() { return Real::mq_unlink(name); });
   }
 
   mqd_t mq_timedsend(mqd_t mqdes, const char* msg_ptr, size_t msg_len, unsigned msg_prio,
                      const struct timespec* abs_timeout) {
-    mqd_t ret;
-    epochEnd();
-    ret = Real::mq_timedsend(mqdes, msg_ptr, msg_len, msg_prio, abs_timeout);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mq_timedsend, [&]() {
+      return Real::mq_timedsend(mqdes, msg_ptr, msg_len, msg_prio, abs_timeout);
+    });
   }
 
   mqd_t mq_timedreceive(mqd_t mqdes, char* msg_ptr, size_t msg_len, unsigned* msg_prio,
                         const struct timespec* abs_timeout) {
-    mqd_t ret;
-    epochEnd();
-    ret = Real::mq_timedreceive(mqdes, msg_ptr, msg_len, msg_prio, abs_timeout);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mq_timedreceive, [&]() {
+      return Real::mq_timedreceive(mqdes, msg_ptr, msg_len, msg_prio, abs_timeout);
+    });
   }
 
   mqd_t mq_notify(mqd_t mqdes, const struct sigevent* notification) {
-    mqd_t ret;
-    epochEnd();
-    ret = Real::mq_notify(mqdes, notification);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mq_notify, [&]() { return Real::mq_notify(mqdes, notification); });
   }
 
   // mq_getsetattr is not a libc function
@@ -2547,11 +2318,7 @@ public:
 */
 
   int waitid(idtype_t idtype, id_t id, siginfo_t* infop, int options) {
-    int ret;
-    epochEnd();
-    ret = Real::waitid(idtype, id, infop, options);
-    epochBegin();
-    return ret;
+    return dispatch(SC_waitid, [&]() { return Real::waitid(idtype, id, infop, options); });
   }
 
   // key functions do not seem to exist
@@ -2595,27 +2362,17 @@ public:
   }*/
 
   int inotify_init() {
-    int ret;
-    epochEnd();
-    ret = Real::inotify_init();
-    epochBegin();
-    return ret;
+    return dispatch(SC_inotify_init, [&]() { return Real::inotify_init(); });
   }
 
   int inotify_add_watch(int fd, const char* pathname, uint32_t mask) {
-    int ret;
-    epochEnd();
-    ret = Real::inotify_add_watch(fd, pathname, mask);
-    epochBegin();
-    return ret;
+    return dispatch(SC_inotify_add_watch, [&]() {
+      return Real::inotify_add_watch(fd, pathname, mask);
+    });
   }
 
   int inotify_rm_watch(int fd, uint32_t wd) {
-    int ret;
-    epochEnd();
-    ret = Real::inotify_rm_watch(fd, wd);
-    epochBegin();
-    return ret;
+    return dispatch(SC_inotify_rm_watch, [&]() { return Real::inotify_rm_watch(fd, wd); });
   }
 
   /*
@@ -2648,125 +2405,73 @@ public:
   // int openat(int dirfd, const char *pathname, int flags){
 
   int openat(int dirfd, const char* pathname, int flags, mode_t mode) {
-    int ret;
-    epochEnd();
-    ret = Real::openat(dirfd, pathname, flags, mode);
-    epochBegin();
-    return ret;
+    return dispatch(SC_openat, [&]() { return Real::openat(dirfd, pathname, flags, mode); });
   }
 
   int mkdirat(int dirfd, const char* pathname, mode_t mode) {
-    int ret;
-    epochEnd();
-    ret = Real::mkdirat(dirfd, pathname, mode);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mkdirat, [&]() { return Real::mkdirat(dirfd, pathname, mode); });
   }
 
   int mknodat(int dirfd, const char* pathname, mode_t mode, dev_t dev) {
-    int ret;
-    epochEnd();
-    ret = Real::mknodat(dirfd, pathname, mode, dev);
-    epochBegin();
-    return ret;
+    return dispatch(SC_mknodat, [&]() { return Real::mknodat(dirfd, pathname, mode, dev); });
   }
 
   int fchownat(int dirfd, const char* path, uid_t owner, gid_t group, int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::fchownat(dirfd, path, owner, group, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_fchownat, [&]() {
+      return Real::fchownat(dirfd, path, owner, group, flags);
+    });
   }
 
   int futimesat(int dirfd, const char* path, const struct timeval times[2]) {
-    int ret;
-    epochEnd();
-    ret = Real::futimesat(dirfd, path, times);
-    epochBegin();
-    return ret;
+    return dispatch(SC_futimesat, [&]() { return Real::futimesat(dirfd, path, times); });
   }
 
   int unlinkat(int dirfd, const char* pathname, int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::unlinkat(dirfd, pathname, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_unlinkat, [&]() { return Real::unlinkat(dirfd, pathname, flags); });
   }
 
   int renameat(int olddirfd, const char* oldpath, int newdirfd, const char* newpath) {
-    int ret;
-    epochEnd();
-    ret = Real::renameat(olddirfd, oldpath, newdirfd, newpath);
-    epochBegin();
-    return ret;
+    return dispatch(SC_renameat, [&]() {
+      return Real::renameat(olddirfd, oldpath, newdirfd, newpath);
+    });
   }
 
   int linkat(int olddirfd, const char* oldpath, int newdirfd, const char* newpath, int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::linkat(olddirfd, oldpath, newdirfd, newpath, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_linkat, [&]() {
+      return Real::linkat(olddirfd, oldpath, newdirfd, newpath, flags);
+    });
   }
 
   int symlinkat(const char* oldpath, int newdirfd, const char* newpath) {
-    int ret;
-    epochEnd();
-    ret = Real::symlinkat(oldpath, newdirfd, newpath);
-    epochBegin();
-    return ret;
+    return dispatch(SC_symlinkat, [&]() { return Real::symlinkat(oldpath, newdirfd, newpath); });
   }
 
   int readlinkat(int dirfd, const char* path, char* buf, size_t bufsiz) {
-    int ret;
-    epochEnd();
-    ret = Real::readlinkat(dirfd, path, buf, bufsiz);
-    epochBegin();
-    return ret;
+    return dispatch(SC_readlinkat, [&]() { return Real::readlinkat(dirfd, path, buf, bufsiz); });
   }
 
   int fchmodat(int dirfd, const char* path, mode_t mode, int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::fchmodat(dirfd, path, mode, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_fchmodat, [&]() { return Real::fchmodat(dirfd, path, mode, flags); });
   }
 
   int faccessat(int dirfd, const char* path, int mode, int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::faccessat(dirfd, path, mode, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_faccessat, [&]() { return Real::faccessat(dirfd, path, mode, flags); });
   }
 
   int pselect(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds,
               const struct timespec* timeout, const sigset_t* sigmask) {
-    int ret;
-    epochEnd();
-    ret = Real::pselect(nfds, readfds, writefds, exceptfds, timeout, sigmask);
-    epochBegin();
-    return ret;
+    return dispatch(SC_pselect, [&]() {
+      return Real::pselect(nfds, readfds, writefds, exceptfds, timeout, sigmask);
+    });
   }
 
   int ppoll(struct pollfd* fds, nfds_t nfds, const struct timespec* timeout,
             const sigset_t* sigmask) {
-    int ret;
-    epochEnd();
-    ret = Real::ppoll(fds, nfds, timeout, sigmask);
-    epochBegin();
-    return ret;
+    return dispatch(SC_ppoll, [&]() { return Real::ppoll(fds, nfds, timeout, sigmask); });
   }
 
   int unshare(int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::unshare(flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_unshare, [&]() { return Real::unshare(flags); });
   }
 
   // get/set_robust_list functions are not in libc
@@ -2788,35 +2493,23 @@ public:
 
   int splice(int fd_in, __off64_t* off_in, int fd_out, __off64_t* off_out, size_t len,
              unsigned int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::splice(fd_in, off_in, fd_out, off_out, len, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_splice, [&]() {
+      return Real::splice(fd_in, off_in, fd_out, off_out, len, flags);
+    });
   }
 
   int tee(int fd_in, int fd_out, size_t len, unsigned int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::tee(fd_in, fd_out, len, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_tee, [&]() { return Real::tee(fd_in, fd_out, len, flags); });
   }
 
   int sync_file_range(int fd, __off64_t offset, __off64_t nbytes, unsigned int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::sync_file_range(fd, offset, nbytes, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_sync_file_range, [&]() {
+      return Real::sync_file_range(fd, offset, nbytes, flags);
+    });
   }
 
   int vmsplice(int fd, const struct iovec* iov, size_t nr_segs, unsigned int flags) {
-    int ret;
-    epochEnd();
-    ret = Real::vmsplice(fd, iov, nr_segs, flags);
-    epochBegin();
-    return ret;
+    return dispatch(SC_vmsplice, [&]() { return Real::vmsplice(fd, iov, nr_segs, flags); });
   }
 
   // move_pages isn't defined in any headers
@@ -76,6 +76,13 @@ private:
     DIR* dir;
   };
 
+  // The data itself is kept in the inputs of the thread.
+  struct recordInput {
+    ssize_t ret;
+    int error;
+    char* data;
+  };
+
 public:
 
   // Record a file syscall according to given sc.
@@ -306,6 +313,39 @@ public:
     return isFound;
   }
 
+  /// @return true if size bytes of inbound data can still be recorded in this epoch.
+  bool hasInputRoom(size_t size) { return current->inputs.getFreeEntries() >= size; }
+
+  // Record an inbound read. The caller copies size bytes of data into the returned buffer.
+  char* recordInputOps(ssize_t ret, int error, size_t size) {
+    struct recordInput* record = (struct recordInput*)allocEntry(E_SYS_INPUT);
+    record->ret = ret;
+    record->error = error;
+    record->data = current->inputs.alloc(size);
+    return record->data;
+  }
+
+  // Get the first inbound read.
+  bool getInputOps(ssize_t* ret, int* error, char** data) {
+    struct recordInput* record = (struct recordInput*)retrieveEntry(E_SYS_INPUT);
+    bool isFound = false;
+
+    if(record) {
+      *ret = record->ret;
+      *error = record->error;
+      *data = record->data;
+      isFound = true;
+    }
+
+    return isFound;
+  }
+
+  // Check whether the next record of the replay is for sc, without consuming it.
+  bool isNextRecord(eRecordSyscall sc) {
+    struct SyscallEntry* entry = current->syscalls.getEntry();
+    return entry != NULL && entry->syscall == sc;
+  }
+
   // For some list, we donot need to search one by one.
   // We can clear the whole list.
   static void epochBegin(thread_t * thread) {
@@ -325,6 +365,7 @@ public:
 
 		// Cleanup all record entries and all list of system calls;
 		thread->syscalls.cleanup();
+		thread->inputs.cleanup();
 		for(int i = 0; i< E_SYS_MAX; i++) {
 			listInit(&thread->syslist[i]);
 		}
@@ -96,6 +96,7 @@ public:
 	void threadInitialize(thread_t * thread) {
       // Initialize the system call entries.
       thread->syscalls.initialize(xdefines::MAX_SYSCALL_ENTRIES);
+      thread->inputs.initialize(xdefines::MAX_INPUT_RECORD_SIZE);
 
 			// Initilize the list of system calls.
 			for(int i = 0; i < E_SYS_MAX; i++) {
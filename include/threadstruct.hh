@@ -36,6 +36,18 @@ typedef enum e_thrstatus {
   E_THREAD_WAITFOR_REAPING,
 } thrStatus;
 
+// Whether a thread can be stopped at the end of an epoch, kept in thread->safety.
+// A thread blocked in a lock counts as stopped: the committer parks it instead of
+// signaling it, and unparks it when the next epoch begins. E_THREAD_WAITED is added
+// to an unsafe thread by a committer sleeping until it becomes safe or blocks.
+typedef enum e_thrsafety {
+  E_THREAD_UNSAFE = 0,
+  E_THREAD_SAFE,
+  E_THREAD_BLOCKED,
+  E_THREAD_PARKED,
+  E_THREAD_WAITED = 4,
+} thrSafety;
+
 // System calls that will be recorded.
 typedef enum e_recordSyscall {
   E_SYS_FILE_OPEN = 0,
@@ -49,6 +61,7 @@ typedef enum e_recordSyscall {
   E_SYS_GETTIMEOFDAY,
   E_SYS_TIMES,
   E_SYS_CLONE, // 10
+  E_SYS_INPUT,
   E_SYS_MAX
 } eRecordSyscall;
 
@@ -69,7 +82,9 @@ typedef struct thread {
   // If the thread has not been joined, then we can't reap this thread.
   // Otherwise, pthread_join may crash since the thread has exited/released.
   bool hasJoined;
-  bool isSafe;   // whether a thread is safe to be interrupted
+  int safety;    // whether a thread is safe to be interrupted, see thrSafety
+  // The thread was still blocked when an epoch began, so its saved context is older.
+  bool staleContext;
   int index;
   pid_t tid;      // Current process id of this thread.
   pthread_t self; // Results of pthread_self
@@ -104,6 +119,9 @@ typedef struct thread {
 	list_t syslist[E_SYS_MAX]; 
 	RecordEntries<struct SyscallEntry> syscalls;
 
+  // Data returned by recorded system calls in this epoch, replayed on rollback.
+  RecordEntries<char> inputs;
+
   // Synchronization events happens on this thread.
   RecordEntries<struct syncEvent> syncevents;
 
@@ -0,0 +1,109 @@
+#if !defined(DOUBLETAKE_UNDOLOG_H)
+#define DOUBLETAKE_UNDOLOG_H
+
+/*
+ * @file   undolog.h
+ * @brief  Undo log for writes to regular files.
+ *         Before a write or a truncation, the bytes it overwrites or cuts off are saved
+ *         together with the file length and offset, so that the write can go to the file
+ *         right away without ending the epoch. A rollback undoes the entries from the
+ *         newest to the oldest; a commit simply forgets them. Once the log holds
+ *         UNDO_LOG_WATERMARK bytes, the next write ends the epoch first.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "internalheap.hh"
+#include "log.hh"
+#include "real.hh"
+#include "spinlock.hh"
+#include "xdefines.hh"
+
+class undolog {
+  // What to undo for one write, followed by the saved bytes.
+  struct entry {
+    size_t prev;     // Offset of the previous entry plus one, 0 for the first one.
+    int fd;
+    off_t position;  // File offset before the write, -1 if the write did not move it.
+    off_t offset;    // Where the saved bytes go back.
+    off_t length;    // File length before the write.
+    size_t size;
+  };
+
+public:
+  undolog() : _data(NULL), _used(0), _capacity(0), _last(0) { _lock.init(); }
+
+  /// @return true if the log is too large to take another entry in this epoch.
+  inline bool isFull() const { return _used >= xdefines::UNDO_LOG_WATERMARK; }
+
+  /// Save the bytes of [offset, offset + size) of a file of the given length before they
+  /// are written, truncated or moved by a write starting at position.
+  /// @return false if there are too many bytes to save.
+  bool save(int fd, off_t position, off_t offset, size_t size, off_t length) {
+    size_t saved = 0;
+    if(offset < length) {
+      saved = (size_t)(length - offset) < size ? (size_t)(length - offset) : size;
+    }
+    if(saved > xdefines::UNDO_LOG_WATERMARK) {
+      return false;
+    }
+
+    _lock.lock();
+    size_t needed = sizeof(entry) + alignup(saved, sizeof(entry));
+    if(_used + needed > _capacity) {
+      _data = InternalHeap::getInstance().grow(_data, _used, &_capacity, _used + needed);
+    }
+
+    entry* e = (entry*)(_data + _used);
+    e->prev = _last;
+    e->fd = fd;
+    e->position = position;
+    e->offset = offset;
+    e->length = length;
+    e->size = saved;
+
+    if(saved > 0 && Real::pread(fd, e + 1, saved, offset) != (ssize_t)saved) {
+      _lock.unlock();
+      return false;
+    }
+
+    _last = _used + 1;
+    _used += needed;
+    _lock.unlock();
+    return true;
+  }
+
+  /// Undo all writes of this epoch. Only one thread is active.
+  void rollback() {
+    for(size_t last = _last; last != 0;) {
+      entry* e = (entry*)(_data + last - 1);
+
+      if(e->size > 0) {
+        Real::pwrite(e->fd, e + 1, e->size, e->offset);
+      }
+      Real::ftruncate(e->fd, e->length);
+      if(e->position != -1) {
+        Real::lseek(e->fd, e->position, SEEK_SET);
+      }
+      last = e->prev;
+    }
+    clear();
+  }
+
+  /// Forget the writes of this epoch.
+  void clear() {
+    _used = 0;
+    _last = 0;
+  }
+
+private:
+  spinlock _lock;
+  char* _data;
+  size_t _used;
+  size_t _capacity;
+  size_t _last;
+};
+
+#endif
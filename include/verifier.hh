@@ -0,0 +1,110 @@
+#if !defined(DOUBLETAKE_VERIFIER_H)
+#define DOUBLETAKE_VERIFIER_H
+
+/*
+ * @file   verifier.h
+ * @brief  Checks the heap of an epoch in the background while the application goes on.
+ *         An epoch end used to keep every thread stopped while the heap was scanned for
+ *         overflows and leaks. When an epoch only ends because its time slice is over,
+ *         the scan can wait: a verifier process is cloned with a copy-on-write snapshot
+ *         of the heap, runs the checks on it and exits with their verdict, while the
+ *         application continues the same epoch. The checkpoint, the logs and the output
+ *         kept by outputcommit stay as they are, so the last verified checkpoint remains
+ *         the one to roll back to, and output is only released by a committed epoch.
+ *         A failed verdict makes the next epoch end a committing one, whose checks find
+ *         the error again and roll back. A committing epoch end supersedes a running
+ *         verifier. Selected at startup with DOUBLETAKE_VERIFY=background.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "log.hh"
+
+class verifier {
+public:
+  enum verdict { IDLE, RUNNING, PASSED, FAILED };
+
+  verifier() : _enabled(false), _pid(-1) {}
+
+  static verifier& getInstance() {
+    static char buf[sizeof(verifier)];
+    static verifier* theOneTrueObject = new (buf) verifier();
+    return *theOneTrueObject;
+  }
+
+  void initialize() {
+    const char* mode = getenv("DOUBLETAKE_VERIFY");
+    _enabled = (mode != NULL && strcmp(mode, "background") == 0);
+  }
+
+  void finalize() { cancel(); }
+
+  inline bool isEnabled() const { return _enabled; }
+
+  /// Clone a verifier process running check on the current state. All other threads are stopped.
+  /// @return false if no verifier could be started.
+  bool start(bool (*check)()) {
+    // Like the snapshot process, a clone without an exit signal is invisible to the application.
+    pid_t pid = (pid_t)syscall(SYS_clone, 0UL, NULL, NULL, NULL, NULL);
+    if(pid == 0) {
+      // Reports are made again by the checks of the committing epoch end.
+      int null = (int)syscall(SYS_open, "/dev/null", O_WRONLY);
+      if(null >= 0) {
+        syscall(SYS_dup2, null, STDOUT_FILENO);
+        syscall(SYS_dup2, null, STDERR_FILENO);
+      }
+      syscall(SYS_exit_group, check() ? 1 : 0);
+    }
+
+    if(pid < 0) {
+      PRWRN("Failed to clone a verifier process (%s)", strerror(errno));
+      return false;
+    }
+
+    _pid = pid;
+    return true;
+  }
+
+  /// @return the verdict of the last verifier, without waiting for it.
+  verdict poll() {
+    if(_pid <= 0) {
+      return IDLE;
+    }
+
+    int status;
+    pid_t pid = waitpid(_pid, &status, __WALL | WNOHANG);
+    if(pid == 0 || (pid < 0 && errno == EINTR)) {
+      return RUNNING;
+    }
+
+    // A verifier that can not be waited for is taken as failed, so the epoch end checks again.
+    bool passed = (pid == _pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    _pid = -1;
+    return passed ? PASSED : FAILED;
+  }
+
+  /// Stop the running verifier, if any.
+  void cancel() {
+    if(_pid > 0) {
+      kill(_pid, SIGKILL);
+      while(waitpid(_pid, NULL, __WALL) < 0 && errno == EINTR)
+        ;
+      _pid = -1;
+    }
+  }
+
+private:
+  bool _enabled;
+  pid_t _pid;
+};
+
+#endif
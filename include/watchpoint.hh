@@ -47,6 +47,9 @@ public:
   // Set all watch points before rollback.
   void installWatchpoints();
 
+  // Go on after the errors found so far, which are diagnosed elsewhere.
+  void forgetWatchpoints();
+
   // Use perf_event_open to install a particular watch points.
   int install_watchpoint(uintptr_t address, int sig, int group);
 
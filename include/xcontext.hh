@@ -41,14 +41,16 @@ public:
 
   void* getStackTop() { return _privateTop; }
 
+  /// Where the stack of the last checkpoint is kept.
+  void* getBackupStart() { return _backup; }
+  size_t getBackupSize() { return _backupSize; }
+
 private:
   ucontext_t* getContext() { return &_context; }
 
   void* getPrivateStart() { return _privateStart; }
   void* getPrivateTop() { return _privateTop; }
-  size_t getBackupSize() { return _backupSize; }
   size_t getStackSize() { return _stackSize; }
-  void* getBackupStart() { return _backup; }
 
   /// Saved registers, including the IP, SP, general purpose and floating point.
   ucontext_t _context;
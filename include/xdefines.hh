@@ -130,6 +130,7 @@ public:
   enum { MAX_WATCHPOINTS = 4 };
   enum { PageSize = 4096UL };
   enum { PAGE_SIZE_MASK = (PageSize - 1) };
+  enum { HugePageSize = 1048576UL * 2 };
 
   // This is a experimental results. When we are using a larger number, rollback may fail.
   // Don't know why, although maximum number of semaphore is close to 128.
@@ -147,6 +148,50 @@ public:
   // enum { MAX_GLOBALS_SIZE = 1048576UL * 10 };
   enum { CACHE_LINE_SIZE = 64 };
 
+  // Checkpoint copies larger than this are split among the copy threads.
+  enum { PARALLEL_COPY_THRESHOLD = 1048576 * 8 };
+  enum { MAX_COPY_WORKERS = 32 };
+
+  // A thread with more deferred output than this ends the epoch to release it.
+  enum { OUTPUT_COMMIT_WATERMARK = 1048576 };
+
+  // Once the undo log of file writes holds this much, the next write ends the epoch.
+  enum { UNDO_LOG_WATERMARK = 1048576 * 16 };
+
+  // The epoch scheduler ends an epoch that has run this long, has consumed this much
+  // heap, or has filled a record log of a thread to this percentage.
+  enum { EPOCH_SLICE_MS = 1000 };
+  enum { EPOCH_HEAP_LIMIT = 1048576 * 256 };
+  enum { EPOCH_LOG_WATERMARK = 75 };
+
+  // Threads only look at the clock and logs every EPOCH_CHECK_INTERVAL checks.
+  enum { EPOCH_CHECK_INTERVAL = 64 };
+
+  // Scheduled epochs are stretched, up to EPOCH_MAX_STRETCH times, while ending one
+  // takes more than 1/EPOCH_OVERHEAD_RATIO of its length.
+  enum { EPOCH_MAX_STRETCH = 16 };
+  enum { EPOCH_OVERHEAD_RATIO = 10 };
+
+  // Epoch statistics keep counts for this many kinds of epoch ends, and histograms of
+  // durations in EPOCH_STATS_BUCKETS powers of two of microseconds.
+  enum { EPOCH_STATS_TRIGGERS = 64 };
+  enum { EPOCH_STATS_BUCKETS = 32 };
+
+  // The epoch profile tells apart this many call sites ending epochs, and reports
+  // the EPOCH_PROFILE_TOP most costly ones by default.
+  enum { EPOCH_PROFILE_SITES = 1024 };
+  enum { EPOCH_PROFILE_TOP = 20 };
+
+  // Each thread keeps up to MAGAZINE_SLOTS freed objects of every size up to
+  // MAGAZINE_MAX_SIZE, in steps of 16 bytes, to reuse without going through its heap.
+  enum { MAGAZINE_MAX_SIZE = 256 };
+  enum { MAGAZINE_SLOTS = 8 };
+
+  // Objects above LARGE_OBJECT_THRESHOLD bytes get pages of their own instead of a size
+  // class, see largeheap.h, which keeps up to LARGE_HEAP_SPANS free spans of pages.
+  enum { LARGE_OBJECT_THRESHOLD = 1024 * 256 };
+  enum { LARGE_HEAP_SPANS = 1024 };
+
   /**
    * Definition of sentinel information.
    */
@@ -168,6 +213,8 @@ public:
 
   //  enum { MAX_RECORD_ENTRIES = 0x1000 };
   enum { MAX_SYSCALL_ENTRIES = 0x100000 };
+  enum { MAX_INPUT_RECORD_SIZE = 1048576 * 16 };
+  enum { MAX_RECORDED_SLEEP_NS = 1000000 };
   enum { MAX_SYNCEVENT_ENTRIES = 0x1000000 };
   enum { MAX_SYNCVARIABLE_ENTRIES = 0x10000 };
 
@@ -67,10 +67,14 @@ public:
   }
 
   // Commit all regions in the end of each transaction.
-  void backup() {
+  /// @return the bytes copied.
+  size_t backup() {
+    size_t copied = 0;
+
     for(int i = 0; i < _numbRegions; i++) {
-      _maps[i].backup(NULL);
+      copied += _maps[i].backup(NULL);
     }
+    return copied;
   }
 
   void commit(void* start, size_t size, int index) { _maps[index].commit(start, size); }
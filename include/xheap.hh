@@ -8,7 +8,6 @@
  * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
  */
 
-#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -30,8 +29,8 @@ public:
   // performance greately and also can affect the correctness: we
   // don't want different threads end up getting the same memory from
   // the private mapping.  It is possible that we don't need
-  // sanityCheck any more, but we definitely need a lock to avoid the
-  // race on "metadata".
+  // sanityCheck any more. Threads only race on the bump pointer,
+  // which an atomic add moves without a lock.
 
   void* initialize(void*, size_t startsize, size_t metasize) {
     void* ptr;
@@ -40,23 +39,18 @@ public:
     void* startHeap = (void*)((unsigned long)xdefines::USER_HEAP_BASE - (unsigned long)metasize);
 
     //    PRINF("heap size %lx metasize %lx, startHeap %p\n", startsize, metasize, startHeap);
-    ptr = MM::mmapAllocatePrivate(startsize + metasize, startHeap);
-
-    // Initialize the lock.
-    pthread_mutex_init(&_lock, NULL);
+    ptr = MM::mmapAllocateLarge(startsize + metasize, startHeap);
 
     // Initialize the following content according the values of xpersist class.
     _start = (char*)((intptr_t)ptr + metasize);
     _end = (char*)((intptr_t)_start + startsize);
     _position = (char*)_start;
-    _remaining = startsize;
     _magic = 0xCAFEBABE;
 
     // Register this heap so that they can be recoved later.
     parent::initialize(ptr, startsize + metasize, (void*)_start);
 
-    PRINF("XHEAP %p - %p, position: %p, remaining: %#zx",
-          (void *)_start, (void *)_end, (void *)_position, _remaining);
+    PRINF("XHEAP %p - %p, position: %p", (void *)_start, (void *)_end, (void *)_position);
 
     return (void*)ptr;
   }
@@ -74,16 +68,14 @@ public:
   /// We will save those pointers to the backup ones.
   inline void saveHeapMetadata() {
     _positionBackup = _position;
-    _remainingBackup = _remaining;
-    PRINF("save heap metadata, _position %p remaining %#zx\n", (void *)_position, _remaining);
+    PRINF("save heap metadata, _position %p\n", (void *)_position);
   }
 
   /// We will overlap the metadata with the saved ones
   /// when we need to backup
   inline void recoverHeapMetadata() {
     _position = _positionBackup;
-    _remaining = _remainingBackup;
-    PRINF("in recover, now _position %p remaining 0x%zx\n", (void *)_position, _remaining);
+    PRINF("in recover, now _position %p\n", (void *)_position);
   }
 
   inline void* getHeapStart() { return (void*)_start; }
@@ -94,7 +86,7 @@ public:
   // We only need to do the sanity check until current position.
   inline void* getHeapPosition() {
     // PRINF("GetHeapPosition %p\n", _position);
-    return _position;
+    return __atomic_load_n(&_position, __ATOMIC_RELAXED);
   }
 
   // We need to page-aligned size, we don't want that
@@ -103,26 +95,20 @@ public:
     // Roud up the size to page aligned.
     sz = xdefines::PageSize * ((sz + xdefines::PageSize - 1) / xdefines::PageSize);
 
-    void* p;
-
-    lock();
+    // Increment the bump pointer. Threads that run out of heap exit anyway,
+    // so the pointer may go past the end.
+    char* p = __atomic_fetch_add(&_position, sz, __ATOMIC_RELAXED);
 
-    if(_remaining < sz) {
+    if(p > (char*)_end || (size_t)((char*)_end - p) < sz) {
       fprintf(stderr, "Fatal error: out of memory for heap.\n");
-      fprintf(stderr, "Fatal error: remaining %zx sz %zx\n", _remaining, sz);
+      fprintf(stderr, "Fatal error: position %p end %p sz %zx\n", (void*)p, (void*)_end, sz);
       exit(-1);
     }
 
-    _remaining -= sz;
-    p = _position;
-    // Increment the bump pointer and drop the amount of memory.
-    _position += sz;
-
-    unlock();
-
-		//fprintf(stderr, "malloc sz %zx returnptr %p : _position %p remaining %zx\n", sz, p, _position, _remaining);
+		//fprintf(stderr, "malloc sz %zx returnptr %p : _position %p\n", sz, p, _position);
 #if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
-    // We must cleanup corresponding bitmap
+    // We must cleanup corresponding bitmap. The pages are ours alone, so this
+    // needs no lock either.
     sentinelmap::getInstance().cleanup(p, sz);
 #endif
     // Now we cleanup the corresponding
@@ -131,6 +117,49 @@ public:
     return p;
   }
 
+  // Like malloc, but the pages returned start lead bytes before an address aligned to
+  // boundary, which must be a multiple of the page size, as lead is. The pages skipped
+  // to get there, skipped bytes right before them, are the caller's too.
+  inline void* memalign(size_t boundary, size_t lead, size_t sz, size_t* skipped) {
+    sz = alignup(sz, xdefines::PageSize);
+
+    char* p = __atomic_load_n(&_position, __ATOMIC_RELAXED);
+    char* start;
+    do {
+      start = (char*)(alignup((uintptr_t)p + lead, boundary) - lead);
+      if(start > (char*)_end || (size_t)((char*)_end - start) < sz) {
+        fprintf(stderr, "Fatal error: out of memory for heap.\n");
+        fprintf(stderr, "Fatal error: position %p end %p sz %zx\n", (void*)p, (void*)_end, sz);
+        exit(-1);
+      }
+    } while(!__atomic_compare_exchange_n(&_position, &p, start + sz, true, __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED));
+
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    sentinelmap::getInstance().cleanup(p, start + sz - p);
+#endif
+    *skipped = start - p;
+    return start;
+  }
+
+  // Grow the pages that end at end by sz bytes, if nothing was handed out after them.
+  inline bool extend(void* end, size_t sz) {
+    char* p = (char*)end;
+
+    if(p > (char*)_end || (size_t)((char*)_end - p) < sz) {
+      return false;
+    }
+    if(!__atomic_compare_exchange_n(&_position, &p, p + sz, false, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+      return false;
+    }
+
+#if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
+    sentinelmap::getInstance().cleanup(end, sz);
+#endif
+    return true;
+  }
+
   // These should never be used.
   inline void free(void*) { sanityCheck(); abort(); }
   inline size_t getSize(void*) {
@@ -140,10 +169,6 @@ public:
   }
 
 private:
-  void lock() { pthread_mutex_lock(&_lock); }
-
-  void unlock() { pthread_mutex_unlock(&_lock); }
-
   void sanityCheck() { REQUIRE(_magic == 0xCAFEBABE, "Sanity check failed for xheap"); }
 
   /// The start of the heap area.
@@ -152,24 +177,15 @@ private:
   /// The end of the heap area.
   volatile char* _end;
 
-  /// Pointer to the current bump pointer.
+  /// Pointer to the current bump pointer, moved atomically.
   char* _position;
 
-  /// Pointer to the amount of memory remaining.
-  size_t _remaining;
-
   /// For single thread program, we are simply adding
-  /// two backup pointers to backup the metadata.
+  /// a backup pointer to backup the metadata.
   char* _positionBackup;
 
-  /// Pointer to the amount of memory remaining.
-  size_t _remainingBackup;
-
   /// A magic number, used for sanity checking only.
   size_t _magic;
-
-  // This lock guards allocation requests from different threads.
-  pthread_mutex_t _lock;
 };
 
 #endif
@@ -13,13 +13,17 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "copyworkers.hh"
 #include "log.hh"
 #include "mm.hh"
+#include "pagestore.hh"
+#include "snapshot.hh"
+#include "softdirty.hh"
 #include "xdefines.hh"
 
 class xmapping {
 public:
-  xmapping() : _startaddr(NULL), _startsize(0) {}
+  xmapping() : _startaddr(NULL), _startsize(0), _hasBackup(false) {}
 
   // Initialize the map and corresponding part.
   void initialize(void* startaddr = 0, size_t size = 0, void* heapstart = NULL) {
@@ -28,7 +32,12 @@ public:
 
     // Establish two maps to the backing file.
     // The persistent map is shared.
-    _backupMemory = (char*)MM::mmapAllocatePrivate(size);
+    if(pagestore::isEnabled()) {
+      _backupMemory = NULL;
+      _store.initialize(startaddr, size);
+    } else {
+      _backupMemory = (char*)MM::mmapAllocateLarge(size, NULL, startaddr);
+    }
 
     // If we specified a start address (globals), copy the contents into the
     // persistent area now because the transient memory mmap call is going
@@ -67,8 +76,10 @@ public:
   }
 
   // For the page
-  void backup(void* end) {
+  /// @return the bytes copied or encoded.
+  size_t backup(void* end) {
     size_t sz;
+    size_t copied = 0;
 
     if(_heapStart) {
       sz = (intptr_t)end - (intptr_t)base();
@@ -77,12 +88,41 @@ public:
       sz = size();
     }
 
-    // Copy everything to _backupMemory From _userMemory
-    memcpy(_backupMemory, _userMemory, sz);
+    // The snapshot process keeps the image of this epoch for us. Since
+    // _backupMemory is not updated, the next memcpy backup must be a full one.
+    if(snapshot::getInstance().isActive()) {
+      _hasBackup = false;
+      return 0;
+    }
+
+    if(pagestore::isEnabled()) {
+      copied = _store.backup(sz, !_hasBackup);
+      _hasBackup = true;
+      return copied;
+    }
+
+    // After the first full copy, only those pages written since the last epoch
+    // differ from _backupMemory.
+    if(!_hasBackup || !softdirty::getInstance().isEnabled() ||
+       !softdirty::getInstance().copyDirtyPages(_userMemory, sz, _backupMemory, _userMemory,
+                                                 copykernels::getInstance().backupKernel(),
+                                                 &copied)) {
+      // Copy everything to _backupMemory From _userMemory
+      copyworkers::getInstance().backup(_backupMemory, _userMemory, sz);
+      copied = sz;
+    }
+
+    _hasBackup = true;
+    return copied;
   }
 
   // How to commit some memory
   void commit(void* start, size_t size) {
+    if(pagestore::isEnabled()) {
+      _store.commit(start, size);
+      return;
+    }
+
     size_t offset = (intptr_t)start - (intptr_t)base();
 
     void* dest = (void*)((intptr_t)_backupMemory + offset);
@@ -101,7 +141,16 @@ public:
     }
 
     // PRINF("Recover memory %p end %p size %lx\n", _userMemory, end, sz);
-    memcpy(_userMemory, _backupMemory, sz);
+    if(snapshot::getInstance().isActive()) {
+      snapshot::getInstance().restore(_userMemory, sz);
+    } else if(pagestore::isEnabled()) {
+      _store.recover(sz);
+    } else if(!softdirty::getInstance().isEnabled() ||
+              !softdirty::getInstance().copyDirtyPages(
+                  _userMemory, sz, _userMemory, _backupMemory,
+                  copykernels::getInstance().restoreKernel())) {
+      copyworkers::getInstance().restore(_userMemory, _backupMemory, sz);
+    }
   }
 
 private:
@@ -121,6 +170,12 @@ private:
 
   /// The persistent (backed to disk) memory.
   char* _backupMemory;
+
+  /// Compressed pages, used instead of _backupMemory with DOUBLETAKE_CHECKPOINT=compress.
+  pagestore _store;
+
+  /// Whether _backupMemory holds a full copy, so that later backups can be incremental.
+  bool _hasBackup;
 };
 
 #endif
@@ -19,6 +19,10 @@
 
 #include <new>
 
+#include "copykernels.hh"
+#include "copyworkers.hh"
+#include "epochscheduler.hh"
+#include "epochstats.hh"
 #include "globalinfo.hh"
 #include "internalheap.hh"
 #include "log.hh"
@@ -26,6 +30,8 @@
 #include "objectheader.hh"
 #include "real.hh"
 #include "selfmap.hh"
+#include "snapshot.hh"
+#include "softdirty.hh"
 #include "threadstruct.hh"
 #include "watchpoint.hh"
 #include "xdefines.hh"
@@ -34,6 +40,7 @@
 #include "xoneheap.hh"
 #include "xpheap.hh"
 #include "xthread.hh"
+#include "zeroalloc.hh"
 
 // Include all of heaplayers
 #include "heaplayers.h"
@@ -59,6 +66,12 @@ public:
     // writes to pages).
     installSignalHandler();
 
+    // Check whether checkpoints can be incremental before anything is backed up.
+    softdirty::getInstance().initialize();
+    snapshot::getInstance().initialize();
+    copykernels::getInstance().initialize();
+    copyworkers::getInstance().initialize();
+
     // Call _pheap so that xheap.h can be initialized at first and then can work normally.
     _heapBegin =
         (intptr_t)_pheap.initialize((void*)xdefines::USER_HEAP_BASE, xdefines::USER_HEAP_SIZE);
@@ -68,6 +81,7 @@ public:
   }
 
   void finalize() {
+    snapshot::getInstance().finalize();
     _globals.finalize();
     _pheap.finalize();
   }
@@ -90,9 +104,14 @@ public:
     return ptr;
   }
 
+  // Only blocks that were used before are cleared, see zeroalloc.h.
   inline void* calloc(size_t nmemb, size_t sz) {
-    void* ptr = malloc(nmemb * sz);
-    return ptr;
+    return zeroalloc::calloc(nmemb, sz, [this](size_t total, bool* isZero) -> void* {
+      if(current->internalheap == true) {
+        return InternalHeap::getInstance().malloc(total);
+      }
+      return realmalloc(total, isZero);
+    });
   }
 
 	inline void setSentinels(void * ptr, size_t blockSize, size_t sz) {
@@ -160,15 +179,21 @@ public:
 
     // Get the block size
 		size_t objSize = o->getObjectSize();
+		size_t blockSize = o->getSize();
+
+    // A large object grows in place when the pages after it are free, see largeheap.h.
+    if(blockSize < sz && _pheap.grow(ptr, getAlignedSize(sz))) {
+      blockSize = o->getSize();
+    }
 
 #ifdef DETECT_OVERFLOW
-		size_t blockSize = o->getSize();
 		if(blockSize >= sz) {
 			if(!global_isRollback()) {
 				// Check the object overflow.
       	if(checkOverflowAndCleanSentinels(ptr)) {
 	#ifndef EVALUATING_PERF
       		PRWRN("DoubleTake: Caught non-aligned buffer overflow error. ptr %p\n", ptr);
+        	epochstats::getInstance().setTrigger("overflow");
         	xthread::invokeCommit();
 	#endif
 				}
@@ -180,6 +205,11 @@ public:
 			setSentinels(ptr, blockSize, sz);
 			return ptr;
 		}
+#else
+		if(blockSize >= sz) {
+			o->setObjectSize(sz);
+			return ptr;
+		}
 #endif
 		
   	void * buf = malloc(sz);
@@ -198,21 +228,41 @@ public:
   }
 
   // Actual allocations
-  inline void* realmalloc(size_t sz) {
+  // isZero tells whether the block was never used before, and is still zero.
+  // A boundary of a page or more asks for an object aligned to it, see xpheap::memalign.
+  inline void* realmalloc(size_t sz, bool* isZero = NULL, size_t boundary = 0) {
     unsigned char* ptr = NULL;
-   	size_t mysize = sz;
+   	size_t mysize;
+
+    // A long epoch ends here, before anything depends on the phase.
+    if(epochscheduler::getInstance().shouldEnd(getHeapEnd()) && xthread::isThreadSafe(current)) {
+      epochstats::getInstance().setTrigger("scheduled:malloc");
+      xthread::invokeCheck();
+    }
 
     if(sz == 0) {
 			sz = 1;
     }
 		
 		// Align the object size, which should be multiple of 16 bytes.
-    if(sz < 16) {
-      mysize = 16;
-    }
-		mysize = (mysize + 15) & ~15;
+    mysize = getAlignedSize(sz);
 
-    ptr = (unsigned char*)_pheap.malloc(mysize);
+    // Small objects freed by this thread come first, see magazine.h.
+    size_t armed = 0;
+    if(boundary != 0) {
+      ptr = (unsigned char*)_pheap.memalign(boundary, mysize);
+    } else {
+      if(magazine::fits(mysize)) {
+        ptr = (unsigned char*)_pheap.getMagazine().pop(mysize, &armed);
+      }
+      if(ptr == NULL) {
+        ptr = (unsigned char*)_pheap.malloc(mysize);
+      }
+    }
+    bool zero = zeroalloc::takeZero(ptr);
+    if(isZero != NULL) {
+      *isZero = zero;
+    }
     objectHeader* o = getObject(ptr);
 
     // Set actual size there.
@@ -226,9 +276,14 @@ public:
     // Add another guard zone if block size is larger than actual size
     // in order to capture the 1 byte overflow.
 //    PRINT("realmalloc at line %d size %ld sz %ld mysize %ld\n", __LINE__, size, sz, mysize);
-    // Set actual size there.
-    if(size > sz) {
-			setSentinels(ptr, size, sz);
+    // An object from the magazine may still have the sentinels of the same size.
+    if(armed != sz) {
+      if(armed != 0) {
+        sentinelmap::getInstance().checkObjectOverflow(ptr, size, armed, true);
+      }
+      if(size > sz) {
+			  setSentinels(ptr, size, sz);
+      }
     }
 #endif
 
@@ -253,6 +308,16 @@ public:
   }
 
   inline void* memalign(size_t boundary, size_t sz) {
+    // Every object is aligned to 16 bytes already.
+    if(boundary <= 16) {
+      return malloc(sz);
+    }
+
+    // Pages of its own for the object, instead of boundary more bytes.
+    if(boundary >= xdefines::PageSize && current->internalheap == false) {
+      return realmalloc(sz, NULL, boundary);
+    }
+
     // Actually, malloc is easy. Just have more memory at first.
     void* ptr = malloc(boundary + sz);
 
@@ -282,7 +347,7 @@ public:
   }
 
 #ifdef DETECT_OVERFLOW
-  bool checkOverflowAndCleanSentinels(void* ptr) {
+  bool checkOverflowAndCleanSentinels(void* ptr, bool cleanSentinels = true) {
     // Check overflows for this object
     objectHeader* o = getObject(ptr);
 
@@ -299,7 +364,7 @@ public:
 #endif
     }
 
-    return sentinelmap::getInstance().checkObjectOverflow(ptr, blockSize, sz, true);
+    return sentinelmap::getInstance().checkObjectOverflow(ptr, blockSize, sz, cleanSentinels);
   }
 #endif
 
@@ -339,6 +404,15 @@ public:
     origptr = getObjectPtrAtFree(ptr);
     objectHeader* o = getObject(origptr);
 
+    // A small object of this thread goes to its magazine with its sentinels set, unless
+    // it has to be quarantined first. See magazine.h.
+    bool cached = false;
+#ifndef DETECT_USAGE_AFTER_FREE
+    size_t mysize = getAlignedSize(o->getObjectSize());
+    cached = magazine::fits(mysize) && !o->isObjectSpan() && _pheap.isOwnObject(origptr) &&
+             _pheap.getMagazine().hasRoom(mysize);
+#endif
+
 #ifndef EVALUATING_PERF
     // Check for double free
     if(!o->isGoodObject()) {
@@ -350,9 +424,10 @@ public:
 #ifdef DETECT_OVERFLOW
     // If this object has a overflow, we donot need to free this object
     if(!global_isRollback()) {
-      if(checkOverflowAndCleanSentinels(origptr)) {
+      if(checkOverflowAndCleanSentinels(origptr, !cached)) {
 #ifndef EVALUATING_PERF
       	PRWRN("DoubleTake: Caught buffer overflow error. ptr %p\n", origptr);
+        epochstats::getInstance().setTrigger("overflow");
         xthread::invokeCommit();
 #endif
         return;
@@ -366,6 +441,20 @@ public:
       memtrack::getInstance().check(ptr, o->getObjectSize(), MEM_TRACK_FREE);
     }
 
+#ifndef DETECT_USAGE_AFTER_FREE
+    if(cached) {
+      size_t armed = 0;
+#ifdef DETECT_OVERFLOW
+      if(o->getSize() > o->getObjectSize()) {
+        armed = o->getObjectSize();
+      }
+#endif
+      _pheap.getMagazine().push(mysize, origptr, armed);
+      o->setObjectFree();
+      return;
+    }
+#endif
+
     _pheap.free(origptr);
 
     // We remove the actual size of this object to set free on an object.
@@ -429,9 +518,16 @@ public:
   inline void epochBegin() {
     _pheap.saveHeapMetadata();
 
+    // Clone the snapshot process first, so that backup() can skip copying.
+    snapshot::getInstance().take();
+
     // Backup all existing data.
-    _pheap.backup();
-    _globals.backup();
+    epochstats& stats = epochstats::getInstance();
+    stats.addBackup(epochstats::REGION_HEAP, _pheap.backup());
+    stats.addBackup(epochstats::REGION_GLOBALS, _globals.backup());
+
+    // Pages written from now on are those to be backed up or recovered next time.
+    softdirty::getInstance().clearRefs();
   }
 
   inline void* getHeapEnd() { return _pheap.getHeapEnd(); }
@@ -486,6 +582,14 @@ public:
     return hasOverflow;
   }
 
+  // Objects are allocated in multiples of 16 bytes.
+  static inline size_t getAlignedSize(size_t sz) {
+    if(sz < 16) {
+      return 16;
+    }
+    return (sz + 15) & ~15;
+  }
+
   objectHeader* getObjectHeader(void* ptr) {
     objectHeader* o = (objectHeader*)ptr;
     return (o - 1);
@@ -25,7 +25,7 @@ public:
   void finalize() { getHeap()->finalize(); }
 
   void recoverMemory(void* ptr) { getHeap()->recoverMemory(ptr); }
-  void backup(void* end) { getHeap()->backup(end); }
+  size_t backup(void* end) { return getHeap()->backup(end); }
 
   /// Check the buffer overflow.
   bool checkHeapOverflow(void* end) { return getHeap()->checkHeapOverflow(end); }
@@ -42,6 +42,10 @@ public:
   void* getHeapPosition() { return getHeap()->getHeapPosition(); }
 
   void* malloc(size_t sz) { return getHeap()->malloc(sz); }
+  void* memalign(size_t boundary, size_t lead, size_t sz, size_t* skipped) {
+    return getHeap()->memalign(boundary, lead, sz, skipped);
+  }
+  bool extend(void* end, size_t sz) { return getHeap()->extend(end, sz); }
   void free(void* ptr) { getHeap()->free(ptr); }
   size_t getSize(void* ptr) { return getHeap()->getSize(ptr); }
 
@@ -13,7 +13,10 @@
 #include <new>
 
 #include "compat.hh"
+#include "heapowners.hh"
+#include "largeheap.hh"
 #include "log.hh"
+#include "magazine.hh"
 #include "objectheader.hh"
 #include "sentinelmap.hh"
 #include "xdefines.hh"
@@ -40,8 +43,9 @@ public:
     }
 
 //	  fprintf(stderr, "AdaptAppHeap malloc sz %lx ptr %p\n", sz, ptr);
-    // Set the objectHeader.
+    // Set the objectHeader. The block comes from memory that was never used.
     objectHeader* o = new (ptr) objectHeader(sz);
+    o->markObjectZero();
     void* newptr = getPointer(o);
 
 // Now we are adding two sentinels and mark them on the shared bitmap.
@@ -78,17 +82,31 @@ private:
   static void* getPointer(objectHeader* o) { return (void*)(o + 1); }
 };
 
+// Records the heap of the calling thread as the owner of each chunk it takes, so that
+// objects freed by other threads can go back to it.
+template <class SourceHeap> class OwnedChunkHeap : public SourceHeap {
+public:
+  void* malloc(size_t sz) {
+    void* ptr = SourceHeap::malloc(sz);
+    if(ptr != NULL) {
+      heapowners::getInstance().setOwner(ptr, sz, getThreadIndex());
+    }
+    return ptr;
+  }
+};
+
 template <class SourceHeap, int Chunky>
 class KingsleyStyleHeap
     : public HL::ANSIWrapper<
           HL::StrictSegHeap<Kingsley::NUMBINS, Kingsley::size2Class, Kingsley::class2Size,
                             HL::AdaptHeap<HL::SLList, AdaptAppHeap<SourceHeap>>,
-                            AdaptAppHeap<HL::ZoneHeap<SourceHeap, Chunky>>>> {
+                            AdaptAppHeap<HL::ZoneHeap<OwnedChunkHeap<SourceHeap>, Chunky>>>> {
 private:
   typedef HL::ANSIWrapper<
       HL::StrictSegHeap<Kingsley::NUMBINS, Kingsley::size2Class, Kingsley::class2Size,
                         HL::AdaptHeap<HL::SLList, AdaptAppHeap<SourceHeap>>,
-                        AdaptAppHeap<HL::ZoneHeap<SourceHeap, Chunky>>>> SuperHeap;
+                        AdaptAppHeap<HL::ZoneHeap<OwnedChunkHeap<SourceHeap>, Chunky>>>>
+      SuperHeap;
 
 public:
   KingsleyStyleHeap() {}
@@ -99,16 +117,36 @@ private:
   //  char buf[4096 - (sizeof(SuperHeap) % 4096)];
 };
 
+// The same heap with four size classes per power of two instead of one, which
+// leaves less of each block unused; selected by QUARTER_SIZE_CLASSES.
+template <class SourceHeap, int Chunky>
+class QuarterStyleHeap
+    : public HL::ANSIWrapper<
+          HL::StrictSegHeap<Quarter::NUMBINS, Quarter::size2Class, Quarter::class2Size,
+                            HL::AdaptHeap<HL::SLList, AdaptAppHeap<SourceHeap>>,
+                            AdaptAppHeap<HL::ZoneHeap<OwnedChunkHeap<SourceHeap>, Chunky>>>> {
+public:
+  QuarterStyleHeap() {}
+};
+
 // Different processes will have a different heap.
 // class PerThreadHeap : public TheHeapType {
 template <int NumHeaps, class TheHeapType> class PerThreadHeap {
 public:
   PerThreadHeap() {
     //  PRINF("TheHeapType size is %ld\n", sizeof(TheHeapType));
+    for(int i = 0; i < NumHeaps; i++) {
+      _remote[i].head = NULL;
+    }
   }
 
   void* malloc(int ind, size_t sz) {
     //    PRINF("PerThreadheap malloc ind %d sz %d _heap[ind] %p\n", ind, sz, &_heap[ind]);
+    // Take back what other threads have freed first.
+    if(__atomic_load_n(&_remote[ind].head, __ATOMIC_RELAXED) != NULL) {
+      drainRemote(ind);
+    }
+
     // Try to get memory from the local heap first.
     void* ptr = _heap[ind].malloc(sz);
     return ptr;
@@ -121,6 +159,24 @@ public:
     // PRINF("now first word is %lx\n", *((unsigned long*)ptr));
   }
 
+  // Heap ind frees a block of heap owner. A block of another heap is pushed onto the
+  // remote list of its owner, which puts it back on its own next malloc. Otherwise,
+  // memory freed by the consumers of a pipeline would only ever be reused by them.
+  void free(int ind, int owner, void* ptr) {
+    REQUIRE(ind < NumHeaps && owner < NumHeaps, "Invalid free status");
+    if(owner == ind) {
+      _heap[ind].free(ptr);
+      return;
+    }
+
+    // The list is linked through the first word of the blocks, like the free lists.
+    void* head = __atomic_load_n(&_remote[owner].head, __ATOMIC_RELAXED);
+    do {
+      *((void**)ptr) = head;
+    } while(!__atomic_compare_exchange_n(&_remote[owner].head, &head, ptr, true,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+
   // For getSize, it doesn't matter which heap is used
   // since they are the same
   size_t getSize(void* ptr) {
@@ -129,34 +185,69 @@ public:
 	}
 
 private:
+  // Only the owner takes from its list, and always all of it, so the pointer
+  // popped can not have been reused in between.
+  void drainRemote(int ind) {
+    void* ptr = __atomic_exchange_n(&_remote[ind].head, NULL, __ATOMIC_ACQUIRE);
+
+    while(ptr != NULL) {
+      void* next = *((void**)ptr);
+      _heap[ind].free(ptr);
+      ptr = next;
+    }
+  }
+
+  // Blocks freed by other threads, one cache line per heap.
+  struct remoteList {
+    void* head;
+    char padding[xdefines::CACHE_LINE_SIZE - sizeof(void*)];
+  };
+
   TheHeapType _heap[NumHeaps];
+  remoteList _remote[NumHeaps];
 };
 
 // Protect heap
 template <class SourceHeap> class xpheap : public SourceHeap {
+#if defined(QUARTER_SIZE_CLASSES)
+  typedef PerThreadHeap<xdefines::NUM_HEAPS,
+                        QuarterStyleHeap<SourceHeap, xdefines::USER_HEAP_CHUNK>> SuperHeap;
+#else
   typedef PerThreadHeap<xdefines::NUM_HEAPS,
                         KingsleyStyleHeap<SourceHeap, xdefines::USER_HEAP_CHUNK>> SuperHeap;
+#endif
   // typedef PerThreadHeap<xdefines::NUM_HEAPS, KingsleyStyleHeap<SourceHeap,
   // AdaptAppHeap<SourceHeap>, xdefines::USER_HEAP_CHUNK> >
+  typedef largeheap<SourceHeap> LargeHeap;
 
 public:
   xpheap() {}
 
   void* initialize(void* start, size_t heapsize) {
 
-    int metasize = alignup(sizeof(SuperHeap), xdefines::PageSize);
+    // The magazines of the threads and the large heap follow the heaps, so they are
+    // checkpointed with them.
+    int metasize = alignup(sizeof(SuperHeap) + xdefines::NUM_HEAPS * sizeof(magazine) +
+                               sizeof(LargeHeap),
+                           xdefines::PageSize);
 
     // Initialize the SourceHeap before malloc from there.
     char* base = (char*)SourceHeap::initialize(start, heapsize, metasize);
     REQUIRE(base != NULL, "Failed to allocate memory for heap metadata");
 
     _heap = new (base) SuperHeap;
+    _magazines = (magazine*)(base + sizeof(SuperHeap));
+    for(int i = 0; i < xdefines::NUM_HEAPS; i++) {
+      new (&_magazines[i]) magazine();
+    }
+    _large = new (base + sizeof(SuperHeap) + xdefines::NUM_HEAPS * sizeof(magazine)) LargeHeap;
     // PRINF("xpheap calling sourceHeap::malloc size %lx base %p metasize %lx\n", metasize, base,
     // metasize);
 
     // Get the heap start and heap end;
     _heapStart = SourceHeap::getHeapStart();
     _heapEnd = SourceHeap::getHeapEnd();
+    heapowners::getInstance().initialize(_heapStart, (char*)_heapEnd - (char*)_heapStart);
 
 // Sanity check related information
 #if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
@@ -186,7 +277,7 @@ public:
     SourceHeap::recoverMemory(heapEnd);
   }
 
-  void backup() {
+  size_t backup() {
     void* heapEnd = (void*)SourceHeap::getHeapPosition();
     return SourceHeap::backup(heapEnd);
   }
@@ -195,25 +286,53 @@ public:
 
   void* malloc(size_t size) {
     // printf("malloc in xpheap with size %d\n", size);
+    if(LargeHeap::isLarge(size)) {
+      return _large->malloc(size);
+    }
     return _heap->malloc(getThreadIndex(), size);
   }
 
-  void free(void* ptr) {
-    int tid = getThreadIndex();
+  /// Grow the block of ptr in place to hold size bytes, which only large objects do.
+  bool grow(void* ptr, size_t size) {
+    if(!LargeHeap::isSpanObject(ptr)) {
+      return false;
+    }
+    return _large->grow(ptr, size);
+  }
+
+  // An object aligned to a page or more gets pages of its own from the large heap,
+  // instead of boundary bytes more of a size class, and goes back there when freed.
+  void* memalign(size_t boundary, size_t size) { return _large->memalign(boundary, size); }
 
+  void free(void* ptr) {
 #ifndef DETECT_USAGE_AFTER_FREE
-    _heap->free(tid, ptr);
+    realfree(ptr);
 #else
     size_t size = getSize(ptr);
     // Adding this to the quarantine list
     if(addThreadQuarantineList(ptr, size) == false) {
       // If an object is too large, we simply freed this object.
-      _heap->free(tid, ptr);
+      realfree(ptr);
     }
 #endif
   }
 
-  void realfree(void* ptr) { _heap->free(getThreadIndex(), ptr); }
+  // The object goes back to the heap it came from.
+  void realfree(void* ptr) {
+    if(LargeHeap::isSpanObject(ptr)) {
+      _large->free(ptr);
+      return;
+    }
+    _heap->free(getThreadIndex(), heapowners::getInstance().getOwner(ptr), ptr);
+  }
+
+  /// The magazine of the current thread.
+  magazine& getMagazine() { return _magazines[getThreadIndex()]; }
+
+  /// Whether ptr came from the heap of the current thread.
+  bool isOwnObject(void* ptr) {
+    return heapowners::getInstance().getOwner(ptr) == getThreadIndex();
+  }
 
   size_t getSize(void* ptr) { 
 		//fprintf(stderr, "xheap getSize ptr %p\n", ptr);
@@ -224,6 +343,8 @@ public:
 
 private:
   SuperHeap* _heap;
+  magazine* _magazines;
+  LargeHeap* _large;
   void* _heapStart;
   void* _heapEnd;
 };
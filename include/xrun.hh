@@ -17,11 +17,19 @@
 
 #include <new>
 
+#include "checkpointimage.hh"
+#include "diagnosis.hh"
+#include "epochprofile.hh"
+#include "epochscheduler.hh"
+#include "epochstats.hh"
 #include "globalinfo.hh"
 #include "internalheap.hh"
 #include "log.hh"
 #include "mm.hh"
+#include "outputcommit.hh"
 #include "real.hh"
+#include "syscallpolicy.hh"
+#include "verifier.hh"
 #include "watchpoint.hh"
 #include "xdefines.hh"
 #include "xmemory.hh"
@@ -94,6 +102,13 @@ public:
     _memory.initialize();
 
     syscallsInitialize();
+
+    epochscheduler::getInstance().initialize();
+    verifier::getInstance().initialize();
+    diagnosis::getInstance().initialize();
+    checkpointimage::getInstance().initialize();
+    epochstats::getInstance().initialize();
+    epochprofile::getInstance().initialize();
   }
 
   void finalize() {
@@ -103,11 +118,19 @@ public:
     // If we are not in rollback phase, then we should check buffer overflow.
     if(!global_isRollback()) {
 #ifdef DETECT_USAGE_AFTER_FREE
+      unsigned long start = epochstats::getInstance().start();
       finalUAFCheck();
+      epochstats::getInstance().addCheck(epochstats::CHECK_UAF, start);
 #endif
 
+      epochstats::getInstance().setTrigger("exit");
       epochEnd(true);
+      outputcommit::getInstance().releaseTail();
+      syscallpolicy::getInstance().dump();
     }
+    verifier::getInstance().finalize();
+    epochstats::getInstance().finalize();
+    epochprofile::getInstance().finalize();
 
     //    PRINF("%d: finalize now !!!!!\n", getpid());
     // Now we have to cleanup all semaphores.
@@ -123,7 +146,8 @@ public:
   /* Transaction-related functions. */
   void saveContext() { _thread.saveContext(); }
 
-  /// Rollback to previous saved point
+  /// Rollback to previous saved point, or only diagnose the error in a child process
+  /// and return (see diagnosis.h).
   void rollback();
 
   /// Rollback to previous
@@ -132,12 +156,25 @@ public:
   void epochBegin();
   void epochEnd(bool endOfProgram);
 
+  /// End the current slice of an epoch, verifying it in the background when it does not
+  /// have to commit.
+  void epochCheck();
+
+  /// Restore the checkpoint image named by DOUBLETAKE_IMAGE=load:<file> and replay its
+  /// epoch (see checkpointimage.h). Does not return.
+  void replayImage();
+
   int getThreadIndex() const { return _thread.getThreadIndex(); }
   char *getCurrentThreadBuffer() { return _thread.getCurrentThreadBuffer(); }
 
 private:
   void syscallsInitialize();
   void stopAllThreads();
+  void resumeAllThreads();
+  bool hasOtherThreads();
+  void saveImage();
+  void getImageLayout(uint64_t* layout);
+  static bool verifySnapshot();
 
   // Handling the signal SIGUSR2
   static void sigusr2Handler(int signum, siginfo_t* siginfo, void* context);
@@ -20,6 +20,8 @@
 
 #include <new>
 
+#include "epochscheduler.hh"
+#include "epochstats.hh"
 #include "globalinfo.hh"
 #include "internalheap.hh"
 #include "internalsyncs.hh"
@@ -73,7 +75,7 @@ public:
 
     // Register the first thread
     registerInitialThread();
-    current->isSafe = true;
+    current->safety = E_THREAD_SAFE;
     PRINF("Done with thread initialization");
   }
 
@@ -171,7 +173,8 @@ public:
       children->startArg = arg;
       children->status = E_THREAD_STARTING;
       children->hasJoined = false;
-      children->isSafe = false;
+      children->safety = E_THREAD_UNSAFE;
+      children->staleContext = false;
 
       // Now we set the joiner to NULL before creation.
       // It is impossible to let newly spawned child to set this correctly since
@@ -307,6 +310,7 @@ public:
 		if(deferSync((void *)thread, E_SYNCVAR_THREAD)) {
 			PRINF("Before reap dead threads!!!!\n");
 			// deferSync may return TRUE if we have to reapDeadThreads now.
+			epochstats::getInstance().setTrigger("pthread_join");
     	invokeCommit();
 			PRINF("After reap dead threads!!!!\n");
 		}
@@ -333,6 +337,7 @@ public:
   /// @brief Do a pthread_cancel
   inline int thread_cancel(pthread_t thread) {
     int retval;
+    epochstats::getInstance().setTrigger("pthread_cancel");
     invokeCommit();
     retval = Real::pthread_cancel(thread);
     if(retval == 0) {
@@ -378,6 +383,12 @@ public:
     int ret = 0;
     SyncEventList* list = NULL;
     pthread_mutex_t* realMutex = NULL;
+
+    // End a long epoch before this lock adds to the sync log.
+    if(epochscheduler::getInstance().shouldEnd()) {
+      epochstats::getInstance().setTrigger("scheduled:pthread_mutex_lock");
+      invokeCheck();
+    }
     realMutex = (pthread_mutex_t*)getSyncEntry(mutex);
     if(isInvalidSyncVar(realMutex)) {
       mutex_init((pthread_mutex_t*)mutex, NULL);
@@ -392,7 +403,16 @@ public:
   		setThreadUnsafe();
       switch(synccmd) {
       case E_SYNC_MUTEX_LOCK:
+        enterBlocking();
         ret = Real::pthread_mutex_lock(realMutex);
+        if(!leaveBlocking()) {
+          // The epoch ended while this thread was waiting: take the lock again in the new one.
+          if(ret == 0) {
+            Real::pthread_mutex_unlock(realMutex);
+          }
+          rejoinEpoch();
+          return do_mutex_lock(mutex, synccmd);
+        }
         break;
 
       case E_SYNC_MUTEX_TRY_LOCK:
@@ -849,6 +869,7 @@ public:
 	void initThreadSemaphore(thread_t* thread);
 	void destroyThreadSemaphore(thread_t* thread);
 	void wakeupOldWaitingThreads();
+	void wakeupParkedThreads();
 
   static void epochBegin(thread_t * thread);
 
@@ -906,8 +927,18 @@ public:
   inline static pid_t gettid() { return syscall(SYS_gettid); }
 
   static void invokeCommit();
+  static void invokeCheck();
+  static void resumeParked(thread_t* thread);
   bool addQuarantineList(void* ptr, size_t sz);
   static bool isThreadSafe(thread_t * thread);
+  static void setThreadSafe();
+  static void setThreadUnsafe();
+
+  // A thread inside a blocking call is counted as stopped without being signaled.
+  static void enterBlocking();
+  static bool leaveBlocking();
+  static void rejoinEpoch();
+  static bool waitThreadStoppable(thread_t* thread);
 
 private:
   inline void* getSyncEntry(void* entry) {
@@ -1119,9 +1150,6 @@ private:
 		}
   }
 
-  static void setThreadSafe();
-  static void setThreadUnsafe();
-
   // @Global entry of all entry function.
   static void* startThread(void* arg) {
     void* result = NULL;
@@ -0,0 +1,49 @@
+#if !defined(DOUBLETAKE_ZEROALLOC_H)
+#define DOUBLETAKE_ZEROALLOC_H
+
+/*
+ * @file   zeroalloc.h
+ * @brief  calloc that clears only blocks that were used before. A block carved out of
+ *         memory that was never used is marked zero in its header, see objectheader.h,
+ *         and its first allocation consumes the mark. Blocks that come back from a free
+ *         list, a magazine or the free spans of the large heap are cleared. Fresh pages
+ *         stay clean, so the next checkpoint and heap check do not have to walk them.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "objectheader.hh"
+
+class zeroalloc {
+public:
+  /// @return whether the block of the object at ptr, just allocated, is still zero.
+  static bool takeZero(void* ptr) {
+    objectHeader* o = (objectHeader*)ptr - 1;
+    bool isZero = o->isObjectZero();
+
+    o->cleanObjectZero();
+    return isZero;
+  }
+
+  /// @return nmemb objects of sz from alloc(size, &isZero), all zero, or NULL with
+  /// errno set to ENOMEM if their total size overflows.
+  template <class Alloc> static void* calloc(size_t nmemb, size_t sz, Alloc alloc) {
+    size_t total;
+    bool isZero = false;
+
+    if(__builtin_mul_overflow(nmemb, sz, &total)) {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+    void* ptr = alloc(total, &isZero);
+    if(ptr != NULL && !isZero) {
+      memset(ptr, 0, total);
+    }
+    return ptr;
+  }
+};
+
+#endif
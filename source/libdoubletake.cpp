@@ -40,12 +40,10 @@ bool g_isRollback;
 bool g_hasRollbacked;
 int g_numOfEnds;
 enum SystemPhase g_phase;
-pthread_cond_t g_condCommitter;
-pthread_cond_t g_condWaiters;
 pthread_mutex_t g_mutex;
-pthread_mutex_t g_mutexSignalhandler;
 int g_waiters;
 int g_waitersTotal;
+int g_resumes;
 #ifdef GET_CHARECTERISTICS
 unsigned long count_epochs = 0;
 #endif
@@ -91,6 +89,11 @@ int doubletake_main(int argc, char** argv, char** envp) {
 //	printf("doubletake_main initializer\n");
 	initializer();
 
+  // Replay a checkpoint saved by another run instead of the program (see checkpointimage.h).
+  if(checkpointimage::getInstance().isLoading()) {
+    xrun::getInstance().replayImage();
+  }
+
 	// Now start the first epoch
 	xrun::getInstance().epochBegin();
 
@@ -182,6 +185,23 @@ extern "C" {
     return ptr;
   }
 
+  void* xxcalloc(size_t nmemb, size_t sz) {
+    // The buffer of tempmalloc is never reused, so it is still zero.
+    if(!initialized) {
+      return xxmalloc(nmemb * sz);
+    }
+    return xmemory::getInstance().calloc(nmemb, sz);
+  }
+
+  void* xxmemalign(size_t boundary, size_t sz) {
+    // The buffer of tempmalloc is never reused, so the space skipped is lost either way.
+    if(!initialized) {
+      char* ptr = (char*)xxmalloc(sz + boundary);
+      return (void*)(((intptr_t)ptr + boundary - 1) & ~(boundary - 1));
+    }
+    return xmemory::getInstance().memalign(boundary, sz);
+  }
+
   void xxfree(void* ptr) {
     if(initialized && ptr) {
       xmemory::getInstance().free(ptr);
@@ -817,6 +837,10 @@ extern "C" {
     return syscalls::getInstance().accept(sockfd, addr, addrlen);
   }
 
+  ssize_t send(int s, const void* buf, size_t len, int flags) {
+    return syscalls::getInstance().sendto(s, buf, len, flags, NULL, 0);
+  }
+
   ssize_t sendto(int s, const void* buf, size_t len, int flags, const struct sockaddr* to,
 		 socklen_t tolen) {
   //fprintf(stderr, " in doubletake at %d\n", __LINE__);
@@ -824,6 +848,10 @@ extern "C" {
     return syscalls::getInstance().sendto(s, buf, len, flags, to, tolen);
   }
 
+  ssize_t recv(int s, void* buf, size_t len, int flags) {
+    return syscalls::getInstance().recvfrom(s, buf, len, flags, NULL, NULL);
+  }
+
   ssize_t recvfrom(int s, void* buf, size_t len, int flags, struct sockaddr* from,
 		   socklen_t* fromlen) {
 
@@ -837,11 +865,8 @@ extern "C" {
     return syscalls::getInstance().sendmsg(s, msg, flags);
   }
 
-  // Complicated, unsupported now FIXME
-  ssize_t recvmsg(int /* s */, struct msghdr* /* msg */, int /* flags */) {
-  //fprintf(stderr, "recvmsg is not supported now\n");
-    return 0;
-    //    return syscalls::getInstance().recvmsg(s, msg, flags);
+  ssize_t recvmsg(int s, struct msghdr* msg, int flags) {
+    return syscalls::getInstance().recvmsg(s, msg, flags);
   }
 
   int shutdown(int /* s */, int /* how */) {
@@ -76,12 +76,16 @@ void selfmap::printCallStack(int frames, void** array) {
 // Print out the code information about an eipaddress
 // Also try to print out stack trace of given pcaddr.
 int selfmap::getCallStack(void** array) {
+  return getCallStack(array, xdefines::CALLSITE_MAXIMUM_LENGTH);
+}
+
+int selfmap::getCallStack(void** array, int frames) {
   int size;
 
   PRINF("Try to get backtrace with array %p\n", (void *)array);
   // get void*'s for all entries on the stack
   xthread::disableCheck();
-  size = backtrace(array, xdefines::CALLSITE_MAXIMUM_LENGTH);
+  size = backtrace(array, frames);
   xthread::enableCheck();
   PRINF("After get backtrace with array %p\n", (void *)array);
 
@@ -25,6 +25,7 @@
 #include "memtrack.hh"
 #include "real.hh"
 #include "selfmap.hh"
+#include "sentinelmap.hh"
 #include "xdefines.hh"
 
 long perf_event_open(struct perf_event_attr* hw_event, pid_t pid, int cpu, int group_fd,
@@ -102,6 +103,17 @@ bool watchpoint::findFaultyObject(faultyObject** object) {
 
 bool watchpoint::hasToRollback() { return _numWatchpoints > 0; }
 
+void watchpoint::forgetWatchpoints() {
+  // A corrupted sentinel would be found again at every epoch end, so stop checking it.
+  for(int i = 0; i < _numWatchpoints; i++) {
+    if(_wp[i].objtype == OBJECT_TYPE_OVERFLOW) {
+      intptr_t sentinel = (intptr_t)_wp[i].faultyaddr & ~(intptr_t)(sizeof(size_t) - 1);
+      sentinelmap::getInstance().clear((void*)sentinel);
+    }
+  }
+  _numWatchpoints = 0;
+}
+
 void watchpoint::installWatchpoints() {
   struct sigaction trap_action;
 
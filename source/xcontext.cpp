@@ -7,6 +7,8 @@
 
 #include "xcontext.hh"
 
+#include "copykernels.hh"
+
 // these functions are defined in assembly so that they can safely
 // swap the stack underneath themselves
 extern "C" {
@@ -40,7 +42,7 @@ void xcontext::save(ucontext_t *uctx) {
 
   // EDB: do we need this protection here? FIXME
   Real::mprotect(_backup, size, PROT_WRITE);
-  memcpy(_backup, _privateStart, size);
+  copykernels::backup(_backup, _privateStart, size);
   Real::mprotect(_backup, size, PROT_NONE);
 
   // We are trying to save context at first
@@ -77,7 +79,7 @@ void xcontext::saveCurrent() {
           _privateTop, (void *)sp, (void *)stackBottom, size);
 
   Real::mprotect(_backup, size, PROT_WRITE);
-  memcpy(_backup, _privateStart, size);
+  copykernels::backup(_backup, _privateStart, size);
   getcontext(&_context);
   // doing the mprotect here (after getcontext), so that whenever we
   // restore a context from xcontext::rollback this PROT_NONE pairs
@@ -99,6 +101,6 @@ void xcontext::rollback() {
 // handler is running so we don't have to worry about receiving a
 // signal in the middle of this method.
 void xcontext::rollbackInHandler(ucontext_t* kctx) {
-  memcpy(_privateStart, _backup, _backupSize);
+  copykernels::restore(_privateStart, _backup, _backupSize);
   memcpy(kctx, &_context, sizeof(_context));
 }
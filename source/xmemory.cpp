@@ -31,9 +31,23 @@ void xmemory::handleSegFault() {
   }
     
 	xrun::getInstance().rollback();
+
+  // The parent can not go on from a segmentation fault, so it waits for the diagnosis.
+  diagnosis::getInstance().waitForChild();
+  abort();
 }
 
-void xmemory::realfree(void* ptr) { _pheap.realfree(ptr); }
+// Objects leaving the quarantine lost their sentinels on free. They are kept by the size
+// of their block, which fits any allocation of that size rounded down to 16 bytes.
+void xmemory::realfree(void* ptr) {
+  size_t size = _pheap.getSize(ptr) & ~15UL;
+
+  if(magazine::fits(size) && _pheap.isOwnObject(ptr) &&
+     _pheap.getMagazine().push(size, ptr, 0)) {
+    return;
+  }
+  _pheap.realfree(ptr);
+}
 
 void* InternalHeapAllocator::malloc(size_t sz) { return InternalHeap::getInstance().malloc(sz); }
 
@@ -13,6 +13,7 @@
 #include "globalinfo.hh"
 #include "internalsyncs.hh"
 #include "leakcheck.hh"
+#include "selfmap.hh"
 #include "syscalls.hh"
 #include "threadmap.hh"
 #include "threadstruct.hh"
@@ -37,6 +38,31 @@ void xrun::rollback() {
     abort();
   }
 
+  epochstats::getInstance().epochDone(epochstats::ROLLBACK);
+
+  // What the program wrote before the error was found is released as it is,
+  // and the same output is dropped during the replay.
+  outputcommit::getInstance().commit();
+
+  // Leave the diagnosis to a child, so that the parent goes on as if there was no error.
+  if(diagnosis::getInstance().isEnabled()) {
+    if(hasOtherThreads()) {
+      PRWRN("DoubleTake: Other threads are alive, rolling back in place.");
+    } else if(diagnosis::getInstance().fork()) {
+      watchpoint::getInstance().forgetWatchpoints();
+      syscalls::getInstance().epochEndWell();
+      _thread.epochEndWell();
+      return;
+    } else if(diagnosis::getInstance().isChild() && !syscalls::getInstance().isolateFiles()) {
+      // The undo would change the files of the parent.
+      PRWRN("DoubleTake: Failed to isolate the files of the diagnosis, giving it up.");
+      _exit(1);
+    }
+  }
+
+  // Undo the writes to files and restore their offsets.
+  syscalls::getInstance().prepareRollback();
+
   // Rollback all memory before rolling back the context.
   _memory.rollback();
 
@@ -48,6 +74,11 @@ void xrun::rollback() {
   _thread.prepareRollback();
   //   PRINF("_thread rollback and actual rollback\n");
 
+  // Memory is back to the checkpoint now, so keep it for an offline replay.
+  if(checkpointimage::getInstance().isSaving()) {
+    saveImage();
+  }
+
   // Now we are going to rollback
    //  PRINF("\n\nSTARTING ROLLBACK!!!\n\n\n");
 
@@ -61,6 +92,9 @@ void xrun::rollback() {
 void xrun::epochBegin() {
 
   threadmap::aliveThreadIterator i;
+  epochstats& stats = epochstats::getInstance();
+
+  stats.epochBegin();
  
   PRINF("xrun epochBegin, joinning every thread.\n");
   for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
@@ -83,6 +117,7 @@ void xrun::epochBegin() {
 
     // cleanup the threads's qlist, pendingSyncevents, syncevents
     xthread::epochBegin(thread);
+    stats.addBackup(epochstats::REGION_QUARANTINE, thread->qlist.getBackupSize());
 
     unlock_thread(thread);
   }
@@ -92,6 +127,8 @@ void xrun::epochBegin() {
 
   PRINF("xrun epochBegin, run deferred synchronizations done.\n");
 
+  epochscheduler::getInstance().epochBegin(_memory.getHeapEnd());
+
   // Now waken up all other threads then threads can do its cleanup.
   PRINF("getpid %d: xrun::epochBegin, wakeup others. \n", getpid());
   global_epochBegin();
@@ -101,8 +138,13 @@ void xrun::epochBegin() {
 	// Saving the context of the memory.
   _memory.epochBegin();
 
+  epochprofile::getInstance().epochBegin();
+
   // Save the context of this thread
   saveContext();
+
+  // The other threads run again, so output that would have blocked can go out now.
+  outputcommit::getInstance().releaseTail();
 }
 
 /// @brief End a transaction, aborting it if necessary.
@@ -111,26 +153,52 @@ void xrun::epochEnd(bool endOfProgram) {
 #ifdef GET_CHARECTERISTICS
    count_epochs++;
 #endif
+  epochscheduler::getInstance().epochEnd();
+  epochstats& stats = epochstats::getInstance();
+  stats.epochEnd();
 //	fprintf(stderr, "xrun epochEnd\n");
 	//while(1) { ; }
 //	selfmap::getInstance().printCallStack();
   // Tell other threads to stop and save context.
+  unsigned long profileStart = epochprofile::getInstance().start();
+  unsigned long start = stats.start();
   stopAllThreads();
+  stats.addStop(start);
+
+  // Every thread saved its stack when the epoch began.
+  if(stats.isEnabled()) {
+    threadmap::aliveThreadIterator i;
+    for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+      stats.addBackup(epochstats::REGION_STACKS, i.getThread()->context.getBackupSize());
+    }
+  }
+
+  // The checks below supersede a verifier still running on an earlier slice.
+  verifier::getInstance().cancel();
 
   // To avoid endless rollback
   if(global_isRollback()) {
+    // A diagnosis child has nothing left to do after its replay.
+    if(diagnosis::getInstance().isChild()) {
+      _exit(0);
+    }
     // PRINF("in the end of an epoch, endOfProgram %d. global_isRollback true\n", endOfProgram);
     while(1)
       ;
   }
 
+  epochprofile::getInstance().epochEnd(stats.getTrigger(), profileStart);
+
 #if defined(DETECT_OVERFLOW)
   bool hasOverflow = false;
+  start = stats.start();
   hasOverflow = _memory.checkHeapOverflow();
+  stats.addCheck(epochstats::CHECK_OVERFLOW, start);
 #endif
 
 #if defined(DETECT_MEMORY_LEAKS)
   bool hasMemoryLeak = false;
+  start = stats.start();
   if(endOfProgram) {
     //  PRINF("DETECTING MEMORY LEAKAGE in the end of program!!!!\n");
     hasMemoryLeak =
@@ -140,6 +208,7 @@ void xrun::epochEnd(bool endOfProgram) {
     hasMemoryLeak =
       leakcheck::getInstance().doSlowLeakCheck(_memory.getHeapBegin(), _memory.getHeapEnd());
   }
+  stats.addCheck(epochstats::CHECK_LEAK, start);
 #endif
 
 #ifndef EVALUATING_PERF
@@ -168,6 +237,8 @@ void xrun::epochEnd(bool endOfProgram) {
 
 		xthread::getInstance().epochEndWell();
 
+    stats.epochDone(endOfProgram ? epochstats::EXIT : epochstats::COMMIT);
+
 #ifndef EVALUATING_PERF
 #if defined(DETECT_OVERFLOW) || defined(DETECT_MEMORY_LEAKS)
   }
@@ -176,6 +247,162 @@ void xrun::epochEnd(bool endOfProgram) {
   //PRINF("in the end of an epoch, hasOverflow %d hasMemoryLeak %d\n", hasOverflow, hasMemoryLeak);
 }
 
+bool xrun::hasOtherThreads() {
+  threadmap::aliveThreadIterator i;
+
+  for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+    if(i.getThread() != current) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void xrun::getImageLayout(uint64_t* layout) {
+  unsigned long begin, end;
+
+  _memory.getGlobalRegion(0, &begin, &end);
+
+  layout[LAYOUT_LIBRARY] = (uintptr_t)this;
+  layout[LAYOUT_GLOBALS] = begin;
+  layout[LAYOUT_HEAP] = (uintptr_t)_memory.getHeapBegin();
+  layout[LAYOUT_STACK] = (uintptr_t)current->context.getStackTop();
+}
+
+void xrun::saveImage() {
+  checkpointimage& image = checkpointimage::getInstance();
+  threadmap::aliveThreadIterator i;
+  uint64_t layout[LAYOUT_WORDS];
+  uint32_t threads = 0;
+
+  for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+    threads++;
+  }
+
+  getImageLayout(layout);
+  if(!image.create(layout, threads)) {
+    return;
+  }
+
+  for(int index = 0; index < _memory.getGlobalRegionsNumb(); index++) {
+    unsigned long begin, end;
+    _memory.getGlobalRegion(index, &begin, &end);
+    image.add(IMAGE_GLOBALS, 0, (void*)begin, end - begin, true);
+  }
+
+  // Threads, contexts, watchpoints and the state of every module of DoubleTake.
+  regioninfo regions[xdefines::NUM_GLOBALS];
+  int regionNumb;
+  selfmap::getInstance().getDoubleTakeRegions(regions, &regionNumb);
+  for(int index = 0; index < regionNumb; index++) {
+    image.add(IMAGE_LIBRARY, 0, regions[index].start,
+              (intptr_t)regions[index].end - (intptr_t)regions[index].start, true);
+  }
+
+  void* heapBegin = (void*)xdefines::USER_HEAP_BASE;
+  image.add(IMAGE_HEAP, 0, heapBegin, (intptr_t)_memory.getHeapEnd() - (intptr_t)heapBegin, true);
+
+  void* internalBegin = (void*)xdefines::INTERNAL_HEAP_BASE;
+  void* internalEnd = InternalHeap::getInstance().getHeapPosition();
+  image.add(IMAGE_INTERNAL_HEAP, 0, internalBegin,
+            (intptr_t)internalEnd - (intptr_t)internalBegin, true);
+
+  for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+    thread_t* thread = i.getThread();
+    void* start;
+    size_t size;
+
+    // The stack the thread is restored to, kept inaccessible between epochs.
+    start = thread->context.getBackupStart();
+    size = thread->context.getBackupSize();
+    Real::mprotect(start, size, PROT_READ);
+    image.add(IMAGE_STACK, thread->index, start, size, false);
+    Real::mprotect(start, size, PROT_NONE);
+
+    image.add(IMAGE_LOG, thread->index, thread->syncevents.getEntry(0),
+              thread->syncevents.getEntriesNumb() * sizeof(struct syncEvent), false);
+    image.add(IMAGE_LOG, thread->index, thread->syscalls.getEntry(0),
+              thread->syscalls.getEntriesNumb() * sizeof(struct SyscallEntry), false);
+    image.add(IMAGE_LOG, thread->index, thread->inputs.getEntry(0),
+              thread->inputs.getEntriesNumb(), false);
+
+    thread->qlist.getBuffers(&start, &size);
+    image.add(IMAGE_QUARANTINE, thread->index, start, size, true);
+  }
+
+  if(image.finish()) {
+    PRINT("DoubleTake: Saved the checkpoint to %s.\n", image.getPath());
+  }
+}
+
+void xrun::replayImage() {
+  uint64_t layout[LAYOUT_WORDS];
+  pid_t tid = current->tid;
+  pthread_t self = current->self;
+
+  getImageLayout(layout);
+  REQUIRE(checkpointimage::getInstance().load(layout), "Failed to load the checkpoint image");
+
+  // The image has the thread of another process.
+  current->tid = tid;
+  current->self = self;
+
+  PRINT("DoubleTake: Replaying the checkpoint image.\n");
+  watchpoint::getInstance().installWatchpoints();
+  _thread.checkRollbackCurrent();
+}
+
+void xrun::epochCheck() {
+  verifier& checker = verifier::getInstance();
+
+  if(!checker.isEnabled() || epochscheduler::getInstance().mustCommit()) {
+    epochEnd(false);
+    epochBegin();
+    return;
+  }
+
+  unsigned long start = epochstats::getInstance().start();
+  stopAllThreads();
+  epochstats::getInstance().addStop(start);
+
+  // A failed verdict is found again by the checks of a committing epoch end.
+  verifier::verdict verdict = checker.poll();
+  if(verdict == verifier::FAILED) {
+    PRINF("Background verification failed, ending the epoch\n");
+    resumeAllThreads();
+    epochEnd(false);
+    epochBegin();
+    return;
+  }
+
+  // One verifier at a time: a slice ending while it runs is covered by the next one.
+  if(verdict != verifier::RUNNING) {
+    checker.start(verifySnapshot);
+  }
+
+  epochscheduler::getInstance().epochContinue();
+  epochstats::getInstance().epochContinue();
+  resumeAllThreads();
+}
+
+// The checks of epochEnd, run by a verifier process on its snapshot of the heap.
+bool xrun::verifySnapshot() {
+  bool hasError = false;
+
+#if defined(DETECT_OVERFLOW)
+  hasError = xmemory::getInstance().checkHeapOverflow();
+#endif
+
+#if defined(DETECT_MEMORY_LEAKS)
+  if(leakcheck::getInstance().doSlowLeakCheck(xmemory::getInstance().getHeapBegin(),
+                                              xmemory::getInstance().getHeapEnd())) {
+    hasError = true;
+  }
+#endif
+
+  return hasError;
+}
+
 #ifdef DETECT_USAGE_AFTER_FREE
 void xrun::finalUAFCheck() {
   threadmap::aliveThreadIterator i;
@@ -190,11 +417,6 @@ void xrun::finalUAFCheck() {
 }
 #endif
 
-void waitThreadSafe(void) {
-	int i = 0; 
-	while(i++ < 0x10000) ; 
-}
-
 void xrun::stopAllThreads() {
   threadmap::aliveThreadIterator i;
   int waiters = 0;
@@ -225,10 +447,12 @@ void xrun::stopAllThreads() {
     if(thread != current) {
 		  lock_thread(thread);
       	
-			while(!xthread::isThreadSafe(thread)) {
-				// wait the thread to be safe.
-        waitThreadSafe();
+      // Wait for the thread to be safe. A thread blocked inside a call is stopped already.
+      if(!xthread::waitThreadStoppable(thread)) {
+        unlock_thread(thread);
+        continue;
       }
+
       // If the thread's status is already at E_THREAD_WAITFOR_REAPING
 			// or E_THREAD_JOINING, thus waiting on internal lock, do nothing since they have stopped.
      if((thread->status != E_THREAD_WAITFOR_REAPING) && (thread->status != E_THREAD_JOINING) && (thread->status != E_THREAD_COND_WAITING)) {
@@ -247,6 +471,21 @@ void xrun::stopAllThreads() {
   global_unlock();
 }
 
+// Let the threads stopped by stopAllThreads go on with the current epoch.
+void xrun::resumeAllThreads() {
+  threadmap::aliveThreadIterator i;
+
+  for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+    thread_t* thread = i.getThread();
+
+    if(thread != current) {
+      xthread::resumeParked(thread);
+    }
+  }
+
+  global_epochResume();
+}
+
 bool isNewThread() { return current->isNewlySpawned; }
 
 void jumpToFunction(ucontext_t* cxt, unsigned long funcaddr) {
@@ -265,11 +504,21 @@ void jumpToFunction(ucontext_t* cxt, unsigned long funcaddr) {
   // current thread is going to stop execution in order to commit or rollback.
   assert(global_isEpochEnd() == true);
 
+  // A thread parked inside a blocking call is only interrupted to rollback.
+  if(__atomic_load_n(&current->safety, __ATOMIC_SEQ_CST) == E_THREAD_PARKED) {
+    __atomic_store_n(&current->safety, E_THREAD_UNSAFE, __ATOMIC_SEQ_CST);
+    xthread::getInstance().rollbackInsideSignalHandler((ucontext_t*)context);
+    return;
+  }
+
   // Wait for notification from the commiter
   global_waitForNotification();
 
   // Check what is the current phase
-  if(global_isEpochBegin()) {
+  if(global_isEpochResume()) {
+    // The epoch goes on, so the saved context is still the one to roll back to.
+    return;
+  } else if(global_isEpochBegin()) {
     // Current thread is going to enter a new phase
     xthread::getInstance().saveContext((ucontext_t*)context);
     // NOTE: we do not need to reset contexts if we are still inside the signal handleer
@@ -49,6 +49,10 @@ void xthread::invokeCommit() {
   xrun::getInstance().epochBegin();
 }
 
+void xthread::invokeCheck() {
+  xrun::getInstance().epochCheck();
+}
+
 // Each thread should 
 void xthread::epochBegin(thread_t * thread) {
 	
@@ -64,9 +68,23 @@ void xthread::epochBegin(thread_t * thread) {
 
 	// We should cleanup the syscall events for this thread.
 	SysRecord::epochBegin(thread);	
+
+	// A thread parked inside a blocking call keeps its old context until it leaves the call.
+	int expected = E_THREAD_PARKED;
+	if(__atomic_compare_exchange_n(&thread->safety, &expected, E_THREAD_BLOCKED, false,
+	                               __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+	  thread->staleContext = true;
+	}
 	//PRINF("Cleanup all synchronization events for this thread done\n");
 }
 
+void xthread::resumeParked(thread_t* thread) {
+  // The epoch goes on, so the context of the thread is still the one to roll back to.
+  int expected = E_THREAD_PARKED;
+  __atomic_compare_exchange_n(&thread->safety, &expected, E_THREAD_BLOCKED, false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
 void xthread::prepareRollbackAlivethreads() {
 	threadmap::aliveThreadIterator i;
 
@@ -135,10 +153,26 @@ void xthread::prepareRollback() {
 	// if they are not newly spawned in this epoch.
 	wakeupOldWaitingThreads();
 
+	// Interrupt the threads parked inside a blocking call of this epoch, so that they rollback too.
+	wakeupParkedThreads();
+
 	// Wakeup those threads that are waiting on the global waiters.
 	global_wakeup();	
 }
 
+void xthread::wakeupParkedThreads() {
+	threadmap::aliveThreadIterator i;
+
+	for(i = threadmap::getInstance().begin(); i != threadmap::getInstance().end(); i++) {
+    thread_t* thread = i.getThread();
+
+    if(thread != current && !thread->staleContext &&
+       __atomic_load_n(&thread->safety, __ATOMIC_SEQ_CST) == E_THREAD_PARKED) {
+      Real::pthread_kill(thread->self, SIGUSR2);
+    }
+  }
+}
+
 void xthread::wakeupOldWaitingThreads() {
 	threadmap::aliveThreadIterator i;
 
@@ -164,16 +198,92 @@ void xthread::wakeupOldWaitingThreads() {
 }
 
 void xthread::setThreadSafe() {
-  __atomic_store_n(&current->isSafe, true, __ATOMIC_SEQ_CST);
-//  signal_thread(current);
+  // Wake up the committer if it is waiting for this thread.
+  if(__atomic_exchange_n(&current->safety, E_THREAD_SAFE, __ATOMIC_SEQ_CST) & E_THREAD_WAITED) {
+    global_futexWake(&current->safety, 1);
+  }
 }
 
 void xthread::setThreadUnsafe() {
-  __atomic_store_n(&current->isSafe, false, __ATOMIC_SEQ_CST);
+  int expected = E_THREAD_SAFE;
+  __atomic_compare_exchange_n(&current->safety, &expected, E_THREAD_UNSAFE, false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
 }
 
 bool xthread::isThreadSafe(thread_t * thread) {
-	return __atomic_load_n(&thread->isSafe, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&thread->safety, __ATOMIC_SEQ_CST) == E_THREAD_SAFE;
+}
+
+void xthread::enterBlocking() {
+  if(__atomic_exchange_n(&current->safety, E_THREAD_BLOCKED, __ATOMIC_SEQ_CST) & E_THREAD_WAITED) {
+    global_futexWake(&current->safety, 1);
+  }
+}
+
+bool xthread::leaveBlocking() {
+  int expected = E_THREAD_BLOCKED;
+
+  return __atomic_compare_exchange_n(&current->safety, &expected, E_THREAD_UNSAFE, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) &&
+         !current->staleContext;
+}
+
+void xthread::rejoinEpoch() {
+  // Stay parked until the committer unparks this thread or starts a rollback.
+  while(!global_isRollback()) {
+    int safety = __atomic_load_n(&current->safety, __ATOMIC_SEQ_CST);
+    int expected = E_THREAD_BLOCKED;
+
+    if((safety & ~E_THREAD_WAITED) == E_THREAD_UNSAFE ||
+       __atomic_compare_exchange_n(&current->safety, &expected, E_THREAD_UNSAFE, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      break;
+    }
+    global_waitForResume();
+  }
+
+  if(global_isRollback()) {
+    // Parked in the epoch being rolled back: go back to where it began.
+    if(!current->staleContext) {
+      getInstance().checkRollbackCurrent();
+    }
+    // Otherwise this thread has been blocked since before the epoch began.
+    current->staleContext = false;
+    __atomic_store_n(&current->safety, E_THREAD_UNSAFE, __ATOMIC_SEQ_CST);
+    return;
+  }
+
+  // Nothing has changed for this thread since the epoch began, so it begins here.
+  if(current->staleContext) {
+    current->staleContext = false;
+    saveContext();
+  }
+}
+
+bool xthread::waitThreadStoppable(thread_t* thread) {
+  while(true) {
+    int safety = __atomic_load_n(&thread->safety, __ATOMIC_SEQ_CST);
+
+    if(safety == E_THREAD_SAFE) {
+      return true;
+    }
+
+    if(safety == E_THREAD_BLOCKED) {
+      if(__atomic_compare_exchange_n(&thread->safety, &safety, E_THREAD_PARKED, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        return false;
+      }
+      continue;
+    }
+
+    // Sleep until the thread becomes safe or blocks.
+    if(!(safety & E_THREAD_WAITED) &&
+       !__atomic_compare_exchange_n(&thread->safety, &safety, safety | E_THREAD_WAITED, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      continue;
+    }
+    global_futexWait(&thread->safety, safety | E_THREAD_WAITED);
+  }
 }
 
 bool xthread::addQuarantineList(void* ptr, size_t sz) {
@@ -0,0 +1,95 @@
+/*
+ * @file   bumpalloc.cpp
+ * @brief  Measure contention on the bump allocators that feed the per-thread heaps.
+ *         Many threads start at once and allocate large objects, so their heaps keep
+ *         asking the user heap for new chunks, and initialize mutexes, whose entries
+ *         come from the internal heap of DoubleTake. Compare
+ *           ./bumpalloc-pthread 64
+ *           ./bumpalloc-doubletake 64
+ *         with different thread counts to see how chunk refills scale.
+ *         Usage: bumpalloc [threads] [MB per thread] [object KB] [mutexes per thread]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pthread_barrier_t start;
+static size_t objects;
+static size_t objectSize;
+static size_t mutexes;
+
+static void* allocate(void*) {
+  char** ptrs = (char**)malloc(objects * sizeof(char*));
+  pthread_mutex_t** locks = (pthread_mutex_t**)malloc(mutexes * sizeof(pthread_mutex_t*));
+
+  pthread_barrier_wait(&start);
+
+  for(size_t i = 0; i < objects; i++) {
+    ptrs[i] = (char*)malloc(objectSize);
+    // Touch the object, as the application would.
+    ptrs[i][0] = 1;
+  }
+
+  for(size_t i = 0; i < mutexes; i++) {
+    locks[i] = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(locks[i], NULL);
+    pthread_mutex_lock(locks[i]);
+    pthread_mutex_unlock(locks[i]);
+  }
+
+  pthread_barrier_wait(&start);
+
+  // Objects stay allocated until every thread is done, so no chunk is reused.
+  for(size_t i = 0; i < objects; i++) {
+    free(ptrs[i]);
+  }
+  for(size_t i = 0; i < mutexes; i++) {
+    pthread_mutex_destroy(locks[i]);
+    free(locks[i]);
+  }
+  free(ptrs);
+  free(locks);
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : 64;
+  size_t perThread = (argc > 2 ? atol(argv[2]) : 64) << 20;
+  objectSize = (argc > 3 ? atol(argv[3]) : 64) << 10;
+  mutexes = argc > 4 ? atol(argv[4]) : 1000;
+  objects = perThread / objectSize;
+
+  pthread_t* tids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+  pthread_barrier_init(&start, NULL, threads + 1);
+
+  for(int i = 0; i < threads; i++) {
+    pthread_create(&tids[i], NULL, allocate, NULL);
+  }
+
+  pthread_barrier_wait(&start);
+  double begin = now();
+  pthread_barrier_wait(&start);
+  double elapsed = now() - begin;
+
+  for(int i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+
+  size_t total = objects * threads;
+  printf("%d threads: %zu objects of %zu KB and %zu mutexes in %.3f s, %.0f allocations/s\n",
+         threads, total, objectSize >> 10, mutexes * threads, elapsed,
+         (total + mutexes * threads) / elapsed);
+
+  pthread_barrier_destroy(&start);
+  free(tids);
+  return 0;
+}
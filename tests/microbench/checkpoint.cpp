@@ -0,0 +1,57 @@
+/*
+ * @file   checkpoint.cpp
+ * @brief  Measure the cost of epoch checkpoints with a large, mostly read-only heap.
+ *         Every write() to /dev/null is an irrevocable system call, so DoubleTake
+ *         ends the epoch and checkpoints the heap again. Compare the backends with
+ *           DOUBLETAKE_CHECKPOINT=copy ./checkpoint-doubletake
+ *           DOUBLETAKE_CHECKPOINT=fork ./checkpoint-doubletake
+ *         The time of an epoch includes the heap integrity scan at its end, so
+ *           DOUBLETAKE_HUGEPAGES=thp ./checkpoint-doubletake 4096
+ *         shows the effect of huge pages on both the scan and the copy.
+ *         Usage: checkpoint [heap MB] [epochs] [pages written per epoch]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE_SIZE 4096
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+  size_t heapMB = argc > 1 ? atol(argv[1]) : 1024;
+  int epochs = argc > 2 ? atoi(argv[2]) : 100;
+  size_t dirtyPages = argc > 3 ? atol(argv[3]) : 64;
+
+  size_t size = heapMB << 20;
+  size_t pages = size / PAGE_SIZE;
+  char* heap = (char*)malloc(size);
+  memset(heap, 1, size);
+
+  int fd = open("/dev/null", O_WRONLY);
+  double start = now();
+
+  for(int i = 0; i < epochs; i++) {
+    for(size_t j = 0; j < dirtyPages; j++) {
+      heap[((i * dirtyPages + j) * 7919 % pages) * PAGE_SIZE] = (char)i;
+    }
+    // Ends the current epoch.
+    write(fd, heap, 1);
+  }
+
+  double elapsed = now() - start;
+  printf("heap %zu MB, %d epochs, %zu dirty pages per epoch: %.3f ms per epoch\n", heapMB, epochs,
+         dirtyPages, elapsed * 1000 / epochs);
+
+  close(fd);
+  free(heap);
+  return 0;
+}
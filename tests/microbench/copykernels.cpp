@@ -0,0 +1,83 @@
+/*
+ * @file   copykernels.cpp
+ * @brief  Compare the checkpoint copy kernels with plain memcpy.
+ *         For every kernel, report the bandwidth of copying a large region into a
+ *         backup area, and the time the "application" then needs to walk its
+ *         working set again, which shows how much of it the copy evicted.
+ *         Usage: copykernels [region MB] [working set KB] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "copykernels.hh"
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile long sink;
+
+static void walk(const long* set, size_t count) {
+  long sum = 0;
+  for(size_t i = 0; i < count; i += 8) {
+    sum += set[i];
+  }
+  sink = sum;
+}
+
+static void measure(const char* name, copykernels::copyFunc kernel, char* dest, const char* src,
+                    size_t size, const long* set, size_t count, int rounds) {
+  double copyTime = 0;
+  double walkTime = 0;
+
+  for(int i = 0; i < rounds; i++) {
+    walk(set, count);
+
+    double start = now();
+    kernel(dest, src, size);
+    copyTime += now() - start;
+
+    start = now();
+    walk(set, count);
+    walkTime += now() - start;
+  }
+
+  printf("%-8s copy %8.1f MB/s, working set walk after copy %8.1f us\n", name,
+         size * rounds / copyTime / 1048576, walkTime * 1e6 / rounds);
+}
+
+int main(int argc, char** argv) {
+  size_t size = (argc > 1 ? atol(argv[1]) : 256) << 20;
+  size_t setSize = (argc > 2 ? atol(argv[2]) : 4096) << 10;
+  int rounds = argc > 3 ? atoi(argv[3]) : 10;
+
+  char* src = (char*)malloc(size);
+  char* dest = (char*)malloc(size);
+  long* set = (long*)malloc(setSize);
+  memset(src, 1, size);
+  memset(dest, 0, size);
+  memset(set, 2, setSize);
+
+  size_t count = setSize / sizeof(long);
+  measure("memcpy", memcpy, dest, src, size, set, count, rounds);
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  measure("sse2", copykernels::streamCopySSE2, dest, src, size, set, count, rounds);
+  if(__builtin_cpu_supports("avx2")) {
+    measure("avx2", copykernels::streamCopyAVX2, dest, src, size, set, count, rounds);
+  }
+  if(__builtin_cpu_supports("avx512f")) {
+    measure("avx512", copykernels::streamCopyAVX512, dest, src, size, set, count, rounds);
+  }
+#endif
+
+  free(set);
+  free(dest);
+  free(src);
+  return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * @file   largealloc.cpp
+ * @brief  Measure large objects: buffers grown by realloc, as a vector that doubles, and
+ *         buffers of sizes just above a power of two that are freed and allocated again.
+ *         Unless large objects grow in place and take just the pages they need, every
+ *         growth copies the buffer and the peak resident size nearly doubles. Compare
+ *           ./largealloc-pthread
+ *           ./largealloc-doubletake
+ *         Usage: largealloc [rounds] [largest buffer in MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 10;
+  size_t largest = (argc > 2 ? atol(argv[2]) : 64) << 20;
+
+  double begin = now();
+  for(int r = 0; r < rounds; r++) {
+    size_t size = 4096;
+    char* buf = (char*)malloc(size);
+    memset(buf, 1, size);
+
+    while(size < largest) {
+      buf = (char*)realloc(buf, size * 2);
+      // Fill the new half, as a vector would.
+      memset(buf + size, 1, size);
+      size *= 2;
+    }
+    free(buf);
+  }
+  double grow = now() - begin;
+
+  // 600 KB objects, which a power-of-two class would put into 1 MB blocks.
+  enum { OBJECTS = 64 };
+  size_t objectSize = 600 * 1024;
+  char* ptrs[OBJECTS];
+
+  begin = now();
+  for(int i = 0; i < OBJECTS; i++) {
+    ptrs[i] = (char*)malloc(objectSize);
+    memset(ptrs[i], 1, objectSize);
+  }
+  for(int r = 0; r < rounds * 100; r++) {
+    int slot = r % OBJECTS;
+    free(ptrs[slot]);
+    ptrs[slot] = (char*)malloc(objectSize);
+    ptrs[slot][0] = (char)r;
+  }
+  for(int i = 0; i < OBJECTS; i++) {
+    free(ptrs[i]);
+  }
+  double churn = now() - begin;
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  printf("%d rounds of growth to %zu MB in %.3f s, %d large malloc/free pairs in %.3f s, "
+         "peak RSS %ld MB\n",
+         rounds, largest >> 20, grow, rounds * 100, churn, usage.ru_maxrss >> 10);
+  return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * @file   pipeline.cpp
+ * @brief  Measure producer/consumer pipelines, where every object is freed by another
+ *         thread than the one that allocated it. Unless those objects go back to the
+ *         heaps of the producers, the producers keep taking new chunks while the free
+ *         lists of the consumers grow, and so does the peak resident size. Compare
+ *           ./pipeline-pthread 8
+ *           ./pipeline-doubletake 8
+ *         Usage: pipeline [pairs] [objects per pair] [object bytes]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+enum { RING_SIZE = 1024 };
+
+struct ring {
+  char* slots[RING_SIZE];
+  // Written by the producer and the consumer only.
+  size_t head __attribute__((aligned(64)));
+  size_t tail __attribute__((aligned(64)));
+};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pthread_barrier_t start;
+static size_t objects;
+static size_t objectSize;
+
+static void* produce(void* arg) {
+  struct ring* r = (struct ring*)arg;
+
+  pthread_barrier_wait(&start);
+  for(size_t i = 0; i < objects; i++) {
+    char* ptr = (char*)malloc(objectSize);
+    memset(ptr, 1, objectSize);
+
+    while(r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_SIZE) {
+      sched_yield();
+    }
+    r->slots[r->head % RING_SIZE] = ptr;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+  }
+  pthread_barrier_wait(&start);
+  return NULL;
+}
+
+static void* consume(void* arg) {
+  struct ring* r = (struct ring*)arg;
+
+  pthread_barrier_wait(&start);
+  for(size_t i = 0; i < objects; i++) {
+    while(__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail) {
+      sched_yield();
+    }
+    free(r->slots[r->tail % RING_SIZE]);
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+  }
+  pthread_barrier_wait(&start);
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  int pairs = argc > 1 ? atoi(argv[1]) : 8;
+  objects = argc > 2 ? atol(argv[2]) : 1000000;
+  objectSize = argc > 3 ? atol(argv[3]) : 64;
+
+  struct ring* rings = (struct ring*)calloc(pairs, sizeof(struct ring));
+  pthread_t* tids = (pthread_t*)malloc(2 * pairs * sizeof(pthread_t));
+  pthread_barrier_init(&start, NULL, 2 * pairs + 1);
+
+  for(int i = 0; i < pairs; i++) {
+    pthread_create(&tids[2 * i], NULL, produce, &rings[i]);
+    pthread_create(&tids[2 * i + 1], NULL, consume, &rings[i]);
+  }
+
+  pthread_barrier_wait(&start);
+  double begin = now();
+  pthread_barrier_wait(&start);
+  double elapsed = now() - begin;
+
+  for(int i = 0; i < 2 * pairs; i++) {
+    pthread_join(tids[i], NULL);
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  size_t total = objects * pairs;
+  printf("%d pairs: %zu objects of %zu bytes in %.3f s, %.0f objects/s, peak RSS %ld MB\n",
+         pairs, total, objectSize, elapsed, total / elapsed, usage.ru_maxrss >> 10);
+
+  pthread_barrier_destroy(&start);
+  free(tids);
+  free(rings);
+  return 0;
+}
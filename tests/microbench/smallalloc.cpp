@@ -0,0 +1,78 @@
+/*
+ * @file   smallalloc.cpp
+ * @brief  Measure the cost of a malloc and free of small objects, the common case that
+ *         the magazines of DoubleTake serve (see magazine.h). Each thread keeps a few
+ *         objects of a few sizes alive and replaces them in turn. Compare
+ *           ./smallalloc-pthread
+ *           ./smallalloc-doubletake
+ *         Usage: smallalloc [threads] [millions of pairs per thread] [live objects]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pthread_barrier_t start;
+static size_t pairs;
+static size_t live;
+
+static void* allocate(void*) {
+  static const size_t sizes[] = { 8, 24, 40, 64, 100, 128, 200 };
+  const size_t nsizes = sizeof(sizes) / sizeof(sizes[0]);
+  char** ptrs = (char**)calloc(live, sizeof(char*));
+
+  pthread_barrier_wait(&start);
+
+  for(size_t i = 0; i < pairs; i++) {
+    size_t slot = i % live;
+
+    free(ptrs[slot]);
+    ptrs[slot] = (char*)malloc(sizes[i % nsizes]);
+    // Touch the object, as the application would.
+    ptrs[slot][0] = (char)i;
+  }
+
+  pthread_barrier_wait(&start);
+
+  for(size_t i = 0; i < live; i++) {
+    free(ptrs[i]);
+  }
+  free(ptrs);
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : 1;
+  pairs = (argc > 2 ? atol(argv[2]) : 10) * 1000000;
+  live = argc > 3 ? atol(argv[3]) : 16;
+
+  pthread_t* tids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+  pthread_barrier_init(&start, NULL, threads + 1);
+
+  for(int i = 0; i < threads; i++) {
+    pthread_create(&tids[i], NULL, allocate, NULL);
+  }
+
+  pthread_barrier_wait(&start);
+  double begin = now();
+  pthread_barrier_wait(&start);
+  double elapsed = now() - begin;
+
+  for(int i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+
+  printf("%d threads: %zu malloc/free pairs with %zu live objects in %.3f s, %.1f ns per pair\n",
+         threads, pairs * threads, live, elapsed, elapsed * 1e9 / pairs);
+
+  pthread_barrier_destroy(&start);
+  free(tids);
+  return 0;
+}
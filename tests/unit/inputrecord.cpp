@@ -0,0 +1,92 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "gtest.h"
+
+#include "inputrecord.hh"
+
+// What recordCall saves of a call: its return value and its bytes.
+struct record {
+  ssize_t ret;
+  size_t size;
+  char data[PATH_MAX + 64];
+};
+
+static void save(record* r, ssize_t ret, const struct iovec* data, int count,
+                 const struct iovec* extra, int extras) {
+  size_t length = inputrecord::getDataLength(ret, count, inputrecord::getSize(data, count));
+
+  r->ret = ret;
+  r->size = length + inputrecord::getSize(extra, extras);
+  ASSERT_LE(r->size, sizeof(r->data));
+  inputrecord::save(r->data, data, count, length, extra, extras);
+}
+
+static void replay(const record* r, const struct iovec* data, int count,
+                   const struct iovec* extra, int extras) {
+  size_t length = inputrecord::getDataLength(r->ret, count, inputrecord::getSize(data, count));
+  inputrecord::restore(r->data, data, count, length, extra, extras);
+}
+
+TEST(InputRecordTest, Getcwd) {
+  char buf[PATH_MAX];
+  struct iovec out = { buf, sizeof(buf) };
+  record r;
+
+  // getcwd returns a pointer, which is no length: only its buffer is saved.
+  ssize_t ret = (ssize_t)getcwd(buf, sizeof(buf));
+  ASSERT_NE(ret, 0);
+  save(&r, ret, NULL, 0, &out, 1);
+  ASSERT_EQ(r.size, sizeof(buf));
+
+  char again[PATH_MAX];
+  struct iovec in = { again, sizeof(again) };
+  memset(again, 0, sizeof(again));
+  replay(&r, NULL, 0, &in, 1);
+  ASSERT_STREQ(again, buf);
+  ASSERT_EQ(r.ret, ret);
+}
+
+TEST(InputRecordTest, ValueIsNoLength) {
+  record r;
+
+  // A pid or uid returned by a call without buffers takes no bytes.
+  save(&r, 3000000, NULL, 0, NULL, 0);
+  ASSERT_EQ(r.size, 0u);
+  ASSERT_EQ(r.ret, 3000000);
+
+  replay(&r, NULL, 0, NULL, 0);
+  ASSERT_EQ(inputrecord::getDataLength(getppid(), 0, 0), 0u);
+}
+
+TEST(InputRecordTest, ReadLength) {
+  char buf[16];
+  char from[8];
+  struct iovec data = { buf, sizeof(buf) };
+  struct iovec extra = { from, sizeof(from) };
+  record r;
+
+  memcpy(buf, "0123456789abcdef", sizeof(buf));
+  memcpy(from, "address", sizeof(from));
+
+  // A read returns the number of bytes in its buffers, never more than they hold.
+  ASSERT_EQ(inputrecord::getDataLength(-1, 1, sizeof(buf)), 0u);
+  ASSERT_EQ(inputrecord::getDataLength(100, 1, sizeof(buf)), sizeof(buf));
+
+  save(&r, 5, &data, 1, &extra, 1);
+  ASSERT_EQ(r.size, 5 + sizeof(from));
+
+  char again[16];
+  char againFrom[8];
+  struct iovec in = { again, sizeof(again) };
+  struct iovec inExtra = { againFrom, sizeof(againFrom) };
+  memset(again, 0, sizeof(again));
+  replay(&r, &in, 1, &inExtra, 1);
+  ASSERT_EQ(memcmp(again, "01234", 5), 0);
+  ASSERT_EQ(again[5], 0);
+  ASSERT_STREQ(againFrom, "address");
+}
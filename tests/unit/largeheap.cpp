@@ -0,0 +1,130 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// The heaps are tested without their sentinels, which need the sentinel map, and with
+// it the log of the runtime.
+#undef DETECT_OVERFLOW
+#undef DETECT_MEMORY_LEAKS
+
+#include "gtest.h"
+
+#include "largeheap.hh"
+#include "xdefines.hh"
+
+namespace {
+
+enum { REGION_SIZE = 64 * 1024 * 1024 };
+
+// A bump allocator over one region, like xheap. Every test starts over with fresh pages.
+class regionHeap {
+public:
+  void initialize() {
+    static char* region = NULL;
+    if(region == NULL) {
+      char* raw = (char*)mmap(NULL, REGION_SIZE + xdefines::HugePageSize,
+                              PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      region = (char*)alignup((uintptr_t)raw, xdefines::HugePageSize);
+    } else {
+      madvise(region, REGION_SIZE, MADV_DONTNEED);
+    }
+    _base = _position = region;
+  }
+
+  void* malloc(size_t sz) {
+    char* p = _position;
+    _position += sz;
+    return p;
+  }
+
+  bool extend(char* end, size_t sz) {
+    if(end != _position) {
+      return false;
+    }
+    _position += sz;
+    return true;
+  }
+
+  void* memalign(size_t boundary, size_t lead, size_t sz, size_t* skipped) {
+    char* start = (char*)alignup((uintptr_t)_position + lead, boundary) - lead;
+    *skipped = start - _position;
+    _position = start + alignup(sz, xdefines::PageSize);
+    return start;
+  }
+
+  char* _base;
+  char* _position;
+};
+
+}
+
+class LargeHeapTest : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    memset(_buf, 0, sizeof(_buf));
+    _heap = new (_buf) largeheap<regionHeap>;
+    _heap->initialize();
+  }
+
+  char _buf[sizeof(largeheap<regionHeap>)];
+  largeheap<regionHeap>* _heap;
+};
+
+static objectHeader* getObject(void* ptr) { return (objectHeader*)ptr - 1; }
+
+TEST_F(LargeHeapTest, AlignedIsReused) {
+  void* first = _heap->memalign(xdefines::PageSize, 64 * 1024);
+  ASSERT_EQ((uintptr_t)first % xdefines::PageSize, 0u);
+  ASSERT_TRUE(largeheap<regionHeap>::isSpanObject(first));
+  ASSERT_GE(getObject(first)->getSize(), 64u * 1024);
+  ASSERT_TRUE(getObject(first)->isObjectZero());
+  _heap->free(first);
+
+  // posix_memalign and free in a loop take no more pages.
+  char* position = _heap->_position;
+  for(int i = 0; i < 1000; i++) {
+    void* ptr = _heap->memalign(xdefines::PageSize, 64 * 1024);
+    ASSERT_EQ(ptr, first);
+    ASSERT_FALSE(getObject(ptr)->isObjectZero());
+    _heap->free(ptr);
+  }
+  ASSERT_EQ(_heap->_position, position);
+}
+
+TEST_F(LargeHeapTest, SkippedPagesAreFree) {
+  // Take the heap off the 2MB boundary.
+  void* before = _heap->malloc(xdefines::LARGE_OBJECT_THRESHOLD + 1);
+  char* aligned = (char*)_heap->memalign(xdefines::HugePageSize, 64);
+  ASSERT_EQ((uintptr_t)aligned % xdefines::HugePageSize, 0u);
+  ASSERT_LE(aligned + xdefines::PageSize, _heap->_position);
+
+  // The pages between the two objects are there for the next one.
+  char* position = _heap->_position;
+  char* between = (char*)_heap->malloc(xdefines::LARGE_OBJECT_THRESHOLD + 1);
+  ASSERT_GT(between, (char*)before);
+  ASSERT_LT(between, aligned);
+  ASSERT_EQ(_heap->_position, position);
+
+  _heap->free(aligned);
+  ASSERT_EQ(_heap->memalign(xdefines::HugePageSize, 64), aligned);
+  ASSERT_EQ(_heap->_position, position);
+}
+
+TEST_F(LargeHeapTest, FreedSpansMerge) {
+  void* a = _heap->memalign(xdefines::PageSize, 100);
+  void* b = _heap->malloc(xdefines::LARGE_OBJECT_THRESHOLD + 1);
+  void* c = _heap->memalign(8 * xdefines::PageSize, 3 * xdefines::PageSize);
+  size_t used = _heap->_position - _heap->_base;
+
+  _heap->free(b);
+  _heap->free(a);
+  _heap->free(c);
+
+  // All of it is one span again, which the largest object fits.
+  char* position = _heap->_position;
+  void* all = _heap->malloc(used - sizeof(objectHeader) - xdefines::SENTINEL_SIZE);
+  ASSERT_EQ((char*)all, _heap->_base + sizeof(objectHeader));
+  ASSERT_EQ(_heap->_position, position);
+  ASSERT_FALSE(getObject(all)->isObjectZero());
+}
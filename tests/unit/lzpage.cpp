@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtest.h"
+
+#include "lzpage.hh"
+
+enum { PAGE = 4096 };
+
+static void roundTrip(const uint8_t* page, size_t size) {
+  uint8_t packed[PAGE * 2];
+  uint8_t unpacked[PAGE];
+
+  size_t packedSize = lzpage::compress(page, size, packed, sizeof(packed));
+  ASSERT_GT(packedSize, 0u);
+  ASSERT_TRUE(lzpage::decompress(packed, packedSize, unpacked, size));
+  ASSERT_EQ(memcmp(page, unpacked, size), 0);
+}
+
+TEST(LZPageTest, RoundTrip) {
+  uint8_t page[PAGE];
+
+  // Zeros, a repeated pattern, and random bytes with runs in between.
+  memset(page, 0, PAGE);
+  roundTrip(page, PAGE);
+
+  for (int i = 0; i < PAGE; i++) {
+    page[i] = "doubletake"[i % 10];
+  }
+  roundTrip(page, PAGE);
+
+  for (int k = 0; k < 100; k++) {
+    for (int i = 0; i < PAGE; i++) {
+      page[i] = (lrand48() % 4 == 0) ? (uint8_t)lrand48() : page[(i + PAGE - 7) % PAGE];
+    }
+    roundTrip(page, PAGE);
+    roundTrip(page, lrand48() % PAGE);
+  }
+}
+
+TEST(LZPageTest, Compresses) {
+  uint8_t page[PAGE];
+  uint8_t packed[PAGE];
+
+  for (int i = 0; i < PAGE; i++) {
+    page[i] = (uint8_t)(i / 64);
+  }
+  size_t packedSize = lzpage::compress(page, PAGE, packed, sizeof(packed));
+  ASSERT_GT(packedSize, 0u);
+  ASSERT_LT(packedSize, (size_t)PAGE / 8);
+}
+
+TEST(LZPageTest, RejectsSmallCapacity) {
+  uint8_t page[PAGE];
+  uint8_t packed[PAGE];
+
+  for (int i = 0; i < PAGE; i++) {
+    page[i] = (uint8_t)lrand48();
+  }
+  ASSERT_EQ(lzpage::compress(page, PAGE, packed, PAGE - 1), 0u);
+}
+
+TEST(LZPageTest, RejectsCorruptInput) {
+  uint8_t page[PAGE];
+  uint8_t packed[PAGE];
+  uint8_t unpacked[PAGE];
+
+  memset(page, 'x', PAGE);
+  size_t packedSize = lzpage::compress(page, PAGE, packed, sizeof(packed));
+  ASSERT_GT(packedSize, 0u);
+  ASSERT_FALSE(lzpage::decompress(packed, packedSize / 2, unpacked, PAGE));
+  ASSERT_FALSE(lzpage::decompress(packed, packedSize, unpacked, PAGE - 1));
+}
@@ -0,0 +1,33 @@
+#include <stddef.h>
+
+#include "gtest.h"
+
+#include "heaps/general/quarterheap.h"
+
+TEST(QuarterSizeClassTest, Classes) {
+  const size_t expected[] = { 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160 };
+
+  for (int i = 0; i < (int)(sizeof(expected) / sizeof(expected[0])); i++) {
+    ASSERT_EQ(Quarter::class2Size(i), expected[i]);
+  }
+  ASSERT_EQ(Quarter::class2Size(Quarter::NUMBINS - 1), (size_t)1 << 31);
+
+  for (int i = 1; i < Quarter::NUMBINS; i++) {
+    ASSERT_GT(Quarter::class2Size(i), Quarter::class2Size(i - 1));
+    ASSERT_EQ(Quarter::class2Size(i) % 8, 0u);
+    ASSERT_EQ(Quarter::size2Class(Quarter::class2Size(i)), i);
+  }
+}
+
+TEST(QuarterSizeClassTest, SmallestFit) {
+  // Across the end of the lookup table, and well past it.
+  for (size_t sz = 1; sz < 70000; sz++) {
+    int cl = Quarter::size2Class(sz);
+
+    ASSERT_GE(Quarter::class2Size(cl), sz);
+    if (cl > 0) {
+      ASSERT_LT(Quarter::class2Size(cl - 1), sz);
+    }
+  }
+  ASSERT_EQ(Quarter::size2Class(33), 4);
+}
@@ -0,0 +1,179 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Without sentinels, so that the heaps need neither the sentinel map nor the runtime.
+#undef DETECT_OVERFLOW
+#undef DETECT_MEMORY_LEAKS
+
+#include "gtest.h"
+
+#include "largeheap.hh"
+#include "magazine.hh"
+#include "objectheader.hh"
+#include "xdefines.hh"
+#include "zeroalloc.hh"
+
+namespace {
+
+enum { REGION_SIZE = 64 * 1024 * 1024 };
+
+// The pages under the heaps, zero again for each test.
+class regionHeap {
+public:
+  void initialize() {
+    static char* region = NULL;
+    if(region == NULL) {
+      char* raw = (char*)mmap(NULL, REGION_SIZE + xdefines::HugePageSize,
+                              PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      region = (char*)alignup((uintptr_t)raw, xdefines::HugePageSize);
+    } else {
+      madvise(region, REGION_SIZE, MADV_DONTNEED);
+    }
+    _base = _position = region;
+  }
+
+  void* malloc(size_t sz) {
+    char* p = _position;
+    _position += sz;
+    return p;
+  }
+
+  bool extend(char* end, size_t sz) {
+    if(end != _position) {
+      return false;
+    }
+    _position += sz;
+    return true;
+  }
+
+  void* memalign(size_t boundary, size_t lead, size_t sz, size_t* skipped) {
+    char* start = (char*)alignup((uintptr_t)_position + lead, boundary) - lead;
+    *skipped = start - _position;
+    _position = start + alignup(sz, xdefines::PageSize);
+    return start;
+  }
+
+  char* _base;
+  char* _position;
+};
+
+}
+
+// The paths of xmemory::realmalloc: the magazine, small blocks, large and aligned ones.
+class ZeroAllocTest : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    memset(_buf, 0, sizeof(_buf));
+    _large = new (_buf) largeheap<regionHeap>;
+    _large->initialize();
+    // Small blocks come from the other half of the region.
+    _small.initialize();
+    _small._base = _small._position = _small._position + REGION_SIZE / 2;
+    new (&_magazine) magazine();
+  }
+
+  void* calloc(size_t nmemb, size_t sz, size_t boundary = 0) {
+    return zeroalloc::calloc(nmemb, sz, [&](size_t total, bool* isZero) -> void* {
+      size_t armed;
+      void* ptr = NULL;
+
+      if(boundary != 0) {
+        ptr = _large->memalign(boundary, total);
+      } else if(magazine::fits(total)) {
+        ptr = _magazine.pop(total, &armed);
+      }
+      if(ptr == NULL) {
+        ptr = largeheap<regionHeap>::isLarge(total) ? _large->malloc(total)
+                                                    : newSmall(total);
+      }
+      *isZero = zeroalloc::takeZero(ptr);
+      _last = *isZero;
+      return ptr;
+    });
+  }
+
+  // A small block carved out of fresh memory, as AdaptAppHeap does.
+  void* newSmall(size_t sz) {
+    objectHeader* o = new (_small.malloc(sizeof(objectHeader) + sz)) objectHeader(sz);
+    o->markObjectZero();
+    return o + 1;
+  }
+
+  static bool isZero(void* ptr, size_t sz) {
+    for(size_t i = 0; i < sz; i++) {
+      if(((char*)ptr)[i] != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  char _buf[sizeof(largeheap<regionHeap>)];
+  largeheap<regionHeap>* _large;
+  regionHeap _small;
+  magazine _magazine;
+  bool _last;
+};
+
+TEST_F(ZeroAllocTest, SizeOverflow) {
+  int calls = 0;
+
+  errno = 0;
+  void* ptr = zeroalloc::calloc((size_t)1 << 33, (size_t)1 << 31, [&](size_t, bool*) -> void* {
+    calls++;
+    return NULL;
+  });
+  ASSERT_EQ(ptr, (void*)NULL);
+  ASSERT_EQ(errno, ENOMEM);
+  ASSERT_EQ(calls, 0);
+
+  ASSERT_EQ(calloc((size_t)-1, 2), (void*)NULL);
+  ASSERT_EQ(errno, ENOMEM);
+}
+
+TEST_F(ZeroAllocTest, FreshIsNotCleared) {
+  void* ptr = calloc(10, 10);
+  ASSERT_TRUE(_last);
+  ASSERT_TRUE(isZero(ptr, 100));
+
+  // The mark is gone with the first allocation.
+  ASSERT_FALSE(zeroalloc::takeZero(ptr));
+}
+
+TEST_F(ZeroAllocTest, MagazineIsCleared) {
+  void* ptr = calloc(4, 16);
+  memset(ptr, 0xff, 64);
+  _magazine.push(64, ptr, 0);
+
+  ASSERT_EQ(calloc(2, 32), ptr);
+  ASSERT_FALSE(_last);
+  ASSERT_TRUE(isZero(ptr, 64));
+}
+
+TEST_F(ZeroAllocTest, LargeIsCleared) {
+  size_t sz = xdefines::LARGE_OBJECT_THRESHOLD + 100;
+  void* ptr = calloc(1, sz);
+  ASSERT_TRUE(_last);
+  ASSERT_TRUE(isZero(ptr, sz));
+  memset(ptr, 0xff, sz);
+  _large->free(ptr);
+
+  ASSERT_EQ(calloc(sz, 1), ptr);
+  ASSERT_FALSE(_last);
+  ASSERT_TRUE(isZero(ptr, sz));
+}
+
+TEST_F(ZeroAllocTest, AlignedIsCleared) {
+  void* ptr = calloc(64, 1024, xdefines::PageSize);
+  ASSERT_TRUE(_last);
+  ASSERT_EQ((uintptr_t)ptr % xdefines::PageSize, 0u);
+  memset(ptr, 0xff, 64 * 1024);
+  _large->free(ptr);
+
+  ASSERT_EQ(calloc(1024, 64, xdefines::PageSize), ptr);
+  ASSERT_FALSE(_last);
+  ASSERT_TRUE(isZero(ptr, 64 * 1024));
+}
@@ -0,0 +1,12 @@
+DIR                := tools
+
+DTIMAGE            := $(DIR)/dtimage
+
+# built with the tests, so that 'all' and 'clean' pick it up
+TEST_BIN_TARGETS   += $(DTIMAGE)
+
+$(DTIMAGE): $(DIR)/dtimage.cpp $(CONFIG) $(DIR)/build.mk
+	@echo "  LD    $@"
+	$(CXX) -O$(O) $(CXXFLAGS) $(LDFLAGS) -MMD -o $@ $<
+
+-include $(DTIMAGE).d
@@ -0,0 +1,115 @@
+/*
+ * @file   dtimage.cpp
+ * @brief  Saves, lists and replays checkpoint images of DoubleTake (see checkpointimage.h).
+ *         An image is only replayed at the addresses it was saved at, so the program
+ *         runs without address space randomization in both cases, with the same binary
+ *         and arguments:
+ *           dtimage save /tmp/crash.img ./program args
+ *           dtimage list /tmp/crash.img
+ *           dtimage replay /tmp/crash.img ./program args
+ *         The library comes from LD_PRELOAD, ./libdoubletake.so if it is not set.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/personality.h>
+#include <unistd.h>
+
+#include "imageformat.hh"
+
+static void usage() {
+  fprintf(stderr, "usage: dtimage list <image>\n"
+                  "       dtimage save <image> <program> [args...]\n"
+                  "       dtimage replay <image> <program> [args...]\n");
+  exit(2);
+}
+
+static int list(const char* path) {
+  FILE* file = fopen(path, "r");
+  if(file == NULL) {
+    fprintf(stderr, "dtimage: %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  struct imageHeader header;
+  if(fread(&header, sizeof(header), 1, file) != 1 ||
+     memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0) {
+    fprintf(stderr, "dtimage: %s is not a checkpoint image\n", path);
+    fclose(file);
+    return 1;
+  }
+
+  printf("version %u, %u threads, %llu sections\n", header.version, header.threads,
+         (unsigned long long)header.sections);
+  printf("layout: library %#llx globals %#llx heap %#llx stack %#llx\n",
+         (unsigned long long)header.layout[LAYOUT_LIBRARY],
+         (unsigned long long)header.layout[LAYOUT_GLOBALS],
+         (unsigned long long)header.layout[LAYOUT_HEAP],
+         (unsigned long long)header.layout[LAYOUT_STACK]);
+
+  unsigned long long totals[IMAGE_KINDS] = {};
+  for(uint64_t i = 0; i < header.sections; i++) {
+    struct imageSection section;
+
+    if(fread(&section, sizeof(section), 1, file) != 1 ||
+       fseeko(file, section.size, SEEK_CUR) != 0) {
+      fprintf(stderr, "dtimage: %s is truncated\n", path);
+      fclose(file);
+      return 1;
+    }
+
+    printf("  %-10s thread %-3u %#14llx %10llu bytes\n", imageKindName(section.kind),
+           section.thread, (unsigned long long)section.address,
+           (unsigned long long)section.size);
+    if(section.kind < IMAGE_KINDS) {
+      totals[section.kind] += section.size;
+    }
+  }
+
+  for(int kind = 0; kind < IMAGE_KINDS; kind++) {
+    printf("%-10s %llu bytes\n", imageKindName(kind), totals[kind]);
+  }
+
+  fclose(file);
+  return 0;
+}
+
+static int run(const char* mode, const char* path, char** argv) {
+  char image[4096];
+
+  // Both modes have the same length, so the stack of the program is laid out the same.
+  snprintf(image, sizeof(image), "%s:%s", mode, path);
+  setenv("DOUBLETAKE_IMAGE", image, 1);
+  setenv("LD_PRELOAD", "./libdoubletake.so", 0);
+
+  int persona = personality(0xffffffff);
+  if(persona == -1 || personality(persona | ADDR_NO_RANDOMIZE) == -1) {
+    fprintf(stderr, "dtimage: failed to disable address space randomization: %s\n",
+            strerror(errno));
+    return 1;
+  }
+
+  execvp(argv[0], argv);
+  fprintf(stderr, "dtimage: %s: %s\n", argv[0], strerror(errno));
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  if(argc < 3) {
+    usage();
+  }
+
+  if(strcmp(argv[1], "list") == 0 && argc == 3) {
+    return list(argv[2]);
+  } else if(strcmp(argv[1], "save") == 0 && argc > 3) {
+    return run("save", argv[2], &argv[3]);
+  } else if(strcmp(argv[1], "replay") == 0 && argc > 3) {
+    return run("load", argv[2], &argv[3]);
+  }
+
+  usage();
+  return 2;
+}